@@ -0,0 +1,454 @@
+/*
+ * baseline.h
+ *
+ * Stored timings and reference renders for a fixed set of scenes, to catch regressions against
+ */
+
+// A baseline file uses the same syntax as scene files. The cases are written by hand, and
+// --update-baseline fills in the measurements and renders the reference images:
+//
+// Baseline
+// {
+// 	Threads = 4,
+// 	WarmUp = 1,
+// 	Repeat = 9,
+// 	Tolerance = 0.05,
+// 	PSNR = 40,
+// 	Case
+// 	{
+// 		Scene = "data/rand_1024_32.scn",
+// 		Resolution = 128,
+// 		Samples = 2,
+// 		Reference = "output/baseline_rand_1024_32.pfm",
+// 		Rays = 1319424,
+// 		Load = (0.004113, 0.000052),
+// 		Build = (0.002318, 0.000031),
+// 		Render = (0.512334, 0.004410),
+// 	},
+// }
+//
+// Timings are the median and the median absolute deviation of the timed runs. Case settings that
+// are left out take their value from the command line, and are written out when it is updated.
+
+#define MAX_BASELINE_CASES 32
+#define BASELINE_NOISE_SPREADS 3.0 // How far a median may move, in spreads of both runs relative to their medians
+#define BASELINE_MIN_SECONDS 0.001 // Changes smaller than this are timer and scheduling noise
+#define BASELINE_MIN_GATED_SECONDS 0.01 // Load and build times shorter than this are reported but never fail
+#define BASELINE_ATTEMPTS 3 // Times a case is measured before its timings count as regressed
+
+typedef struct baseline_timing
+{
+	f64 Median;
+	f64 Spread;
+} baseline_timing;
+
+typedef struct baseline_case
+{
+	const char* Scene;
+	const char* Reference;
+	s32 Resolution;
+	s32 SamplesPerPixel;
+	s32 MaxBounces;
+	b32 SpatialPartition;
+	s32 ObjectsPerLeaf;
+	s32 LeafDepth;
+	b32 Recorded; // Whether the measurements below were stored, rather than left out of the file
+	s64 RaysCast;
+	baseline_timing Load;
+	baseline_timing Build;
+	baseline_timing Render;
+} baseline_case;
+
+typedef struct baseline
+{
+	s32 Threads;
+	s32 WarmUpRuns;
+	s32 Repeats;
+	f64 Tolerance; // Slowdown that is always allowed, as a fraction of the stored median
+	f64 MinPSNR;
+	s32 CaseCount;
+	baseline_case Cases[MAX_BASELINE_CASES];
+} baseline;
+
+// Reads '= Value' for a whole number of at least MinValue
+function s32
+ParseBaselineCount(tokenizer* Tokenizer, s32 MinValue)
+{
+	ExpectToken(Tokenizer, Token_Equals);
+	f32 ValueF = ParseNumber(Tokenizer);
+	s32 Value = (s32)ValueF;
+	if ((f32)Value != ValueF || Value < MinValue)
+	{
+		Tokenizer->Error = true;
+	}
+	return Value;
+}
+
+// Reads '= (Median, Spread)'
+function baseline_timing
+ParseBaselineTiming(tokenizer* Tokenizer)
+{
+	baseline_timing Timing = {};
+	ExpectToken(Tokenizer, Token_Equals);
+	ExpectToken(Tokenizer, Token_LeftParen);
+	Timing.Median = ParseNumber(Tokenizer);
+	ExpectToken(Tokenizer, Token_Comma);
+	Timing.Spread = ParseNumber(Tokenizer);
+	ExpectToken(Tokenizer, Token_RightParen);
+	return Timing;
+}
+
+function const char*
+ParseBaselineString(tokenizer* Tokenizer)
+{
+	const char* Result = 0;
+	ExpectToken(Tokenizer, Token_Equals);
+	if (ExpectToken(Tokenizer, Token_String))
+	{
+		// Strings are null terminated in place by the tokenizer
+		Result = (const char*)Tokenizer->CurrentToken.String.Data;
+	}
+	return Result;
+}
+
+function void
+ParseBaselineCase(tokenizer* Tokenizer, baseline_case* Case)
+{
+	b32 HasRays = false;
+	b32 HasLoad = false;
+	b32 HasBuild = false;
+	b32 HasRender = false;
+	ExpectToken(Tokenizer, Token_LeftBrace);
+	while (!Tokenizer->Error)
+	{
+		token Token = NextToken(Tokenizer);
+		if (Token.Type == Token_RightBrace)
+		{
+			break;
+		}
+		else if (Token.Type == Token_Scene)
+		{
+			Case->Scene = ParseBaselineString(Tokenizer);
+		}
+		else if (Token.Type == Token_Reference)
+		{
+			Case->Reference = ParseBaselineString(Tokenizer);
+		}
+		else if (Token.Type == Token_Resolution)
+		{
+			Case->Resolution = ParseBaselineCount(Tokenizer, 1);
+		}
+		else if (Token.Type == Token_Samples)
+		{
+			Case->SamplesPerPixel = ParseBaselineCount(Tokenizer, 1);
+		}
+		else if (Token.Type == Token_Bounces)
+		{
+			Case->MaxBounces = ParseBaselineCount(Tokenizer, 1);
+		}
+		else if (Token.Type == Token_SpatialPartition)
+		{
+			Case->SpatialPartition = (ParseBaselineCount(Tokenizer, 0) != 0);
+		}
+		else if (Token.Type == Token_ObjectsPerLeaf)
+		{
+			Case->ObjectsPerLeaf = ParseBaselineCount(Tokenizer, 1);
+		}
+		else if (Token.Type == Token_LeafDepth)
+		{
+			Case->LeafDepth = ParseBaselineCount(Tokenizer, 1);
+		}
+		else if (Token.Type == Token_Rays)
+		{
+			// Ray counts are compared exactly, so they are read from the text rather than as a float
+			ExpectToken(Tokenizer, Token_Equals);
+			if (ExpectToken(Tokenizer, Token_Number))
+			{
+				Case->RaysCast = strtoll((const char*)Tokenizer->CurrentToken.String.Data, 0, 10);
+				HasRays = true;
+			}
+		}
+		else if (Token.Type == Token_Load)
+		{
+			Case->Load = ParseBaselineTiming(Tokenizer);
+			HasLoad = true;
+		}
+		else if (Token.Type == Token_Build)
+		{
+			Case->Build = ParseBaselineTiming(Tokenizer);
+			HasBuild = true;
+		}
+		else if (Token.Type == Token_Render)
+		{
+			Case->Render = ParseBaselineTiming(Tokenizer);
+			HasRender = true;
+		}
+		else
+		{
+			Tokenizer->Error = true;
+			fprintf(stderr, "(%d, %d): Invalid token in baseline case: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+			break;
+		}
+		
+		if (Tokenizer->Error)
+		{
+			fprintf(stderr, "(%d, %d): Invalid baseline case %.*s declaration\n", Token.Line, Token.Column, PrintString(Token.String));
+		}
+		else
+		{
+			Token = NextToken(Tokenizer);
+			if (Token.Type == Token_RightBrace)
+			{
+				break;
+			}
+			else if (Token.Type != Token_Comma)
+			{
+				Tokenizer->Error = true;
+				fprintf(stderr, "(%d, %d): Invalid token in baseline case: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+			}
+		}
+	}
+	
+	if (!Tokenizer->Error && (!Case->Scene || !Case->Reference))
+	{
+		Tokenizer->Error = true;
+		fprintf(stderr, "Baseline case is missing its Scene or Reference\n");
+	}
+	Case->Recorded = HasRays && HasLoad && HasRender && (HasBuild || !Case->SpatialPartition);
+}
+
+// The baseline is kept in Arena, since the scene and reference file names point into it
+function b32
+LoadBaseline(const char* FileName, baseline* Baseline, baseline_case* DefaultCase, memory_arena* Arena)
+{
+	*Baseline = {};
+	Baseline->WarmUpRuns = 1;
+	Baseline->Repeats = 9;
+	Baseline->Tolerance = 0.05;
+	Baseline->MinPSNR = 40.0;
+	
+	b32 Success = true;
+	buffer Buffer = LoadEntireFile(FileName, Arena);
+	if (Buffer.Data)
+	{
+		tokenizer Tokenizer = {};
+		Tokenizer.Buffer = Buffer;
+		Tokenizer.Line = 1;
+		Tokenizer.Column = 1;
+		
+		ExpectToken(&Tokenizer, Token_Baseline);
+		ExpectToken(&Tokenizer, Token_LeftBrace);
+		if (Tokenizer.Error)
+		{
+			fprintf(stderr, "(%d, %d): Invalid baseline declaration. Expected 'Baseline {', got '%.*s'\n", Tokenizer.CurrentToken.Line, Tokenizer.CurrentToken.Column, PrintString(Tokenizer.CurrentToken.String));
+		}
+		
+		while (!Tokenizer.Error)
+		{
+			token Token = NextToken(&Tokenizer);
+			if (Token.Type == Token_RightBrace)
+			{
+				break;
+			}
+			else if (Token.Type == Token_Case)
+			{
+				if (Baseline->CaseCount < MAX_BASELINE_CASES)
+				{
+					baseline_case* Case = Baseline->Cases + Baseline->CaseCount++;
+					*Case = *DefaultCase;
+					ParseBaselineCase(&Tokenizer, Case);
+				}
+				else
+				{
+					Tokenizer.Error = true;
+				}
+			}
+			else if (Token.Type == Token_Threads)
+			{
+				Baseline->Threads = ParseBaselineCount(&Tokenizer, 1);
+			}
+			else if (Token.Type == Token_WarmUp)
+			{
+				Baseline->WarmUpRuns = ParseBaselineCount(&Tokenizer, 0);
+			}
+			else if (Token.Type == Token_Repeat)
+			{
+				Baseline->Repeats = ParseBaselineCount(&Tokenizer, 1);
+			}
+			else if (Token.Type == Token_Tolerance)
+			{
+				ExpectToken(&Tokenizer, Token_Equals);
+				Baseline->Tolerance = ParseNumber(&Tokenizer);
+			}
+			else if (Token.Type == Token_PSNR)
+			{
+				ExpectToken(&Tokenizer, Token_Equals);
+				Baseline->MinPSNR = ParseNumber(&Tokenizer);
+			}
+			else
+			{
+				Tokenizer.Error = true;
+				fprintf(stderr, "(%d, %d): Invalid token in baseline declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+				break;
+			}
+			
+			if (Tokenizer.Error)
+			{
+				fprintf(stderr, "(%d, %d): Invalid baseline %.*s declaration\n", Token.Line, Token.Column, PrintString(Token.String));
+			}
+			else
+			{
+				Token = NextToken(&Tokenizer);
+				if (Token.Type == Token_RightBrace)
+				{
+					break;
+				}
+				else if (Token.Type != Token_Comma)
+				{
+					Tokenizer.Error = true;
+					fprintf(stderr, "(%d, %d): Invalid token in baseline declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+				}
+			}
+		}
+		
+		Success = !Tokenizer.Error;
+	}
+	else
+	{
+		Success = false;
+	}
+	
+	if (!Success)
+	{
+		fprintf(stderr, "Error loading baseline: '%s'\n", FileName);
+	}
+	return Success;
+}
+
+function b32
+WriteBaseline(baseline* Baseline, const char* FileName)
+{
+	FILE* File = fopen(FileName, "w");
+	b32 Success = (File != 0);
+	if (Success)
+	{
+		fprintf(File, "# Written by ray --update-baseline\n");
+		fprintf(File, "Baseline\n{\n");
+		fprintf(File, "\tThreads = %d,\n\tWarmUp = %d,\n\tRepeat = %d,\n\tTolerance = %.3f,\n\tPSNR = %.1f,\n",
+			Baseline->Threads, Baseline->WarmUpRuns, Baseline->Repeats, Baseline->Tolerance, Baseline->MinPSNR);
+		for (s32 Index = 0; Index < Baseline->CaseCount; ++Index)
+		{
+			baseline_case* Case = Baseline->Cases + Index;
+			fprintf(File, "\tCase\n\t{\n");
+			fprintf(File, "\t\tScene = \"%s\",\n\t\tResolution = %d,\n\t\tSamples = %d,\n\t\tBounces = %d,\n",
+				Case->Scene, Case->Resolution, Case->SamplesPerPixel, Case->MaxBounces);
+			fprintf(File, "\t\tSpatialPartition = %d,\n\t\tObjectsPerLeaf = %d,\n\t\tLeafDepth = %d,\n",
+				Case->SpatialPartition ? 1 : 0, Case->ObjectsPerLeaf, Case->LeafDepth);
+			fprintf(File, "\t\tReference = \"%s\",\n", Case->Reference);
+			if (Case->Recorded)
+			{
+				fprintf(File, "\t\tRays = %ld,\n", Case->RaysCast);
+				fprintf(File, "\t\tLoad = (%.9f, %.9f),\n", Case->Load.Median, Case->Load.Spread);
+				if (Case->SpatialPartition)
+				{
+					fprintf(File, "\t\tBuild = (%.9f, %.9f),\n", Case->Build.Median, Case->Build.Spread);
+				}
+				fprintf(File, "\t\tRender = (%.9f, %.9f),\n", Case->Render.Median, Case->Render.Spread);
+			}
+			fprintf(File, "\t},\n");
+		}
+		fprintf(File, "}\n");
+		Success = (fclose(File) == 0);
+	}
+	
+	if (!Success)
+	{
+		fprintf(stderr, "Error writing baseline to file: '%s'\n", FileName);
+	}
+	return Success;
+}
+
+// Median and median absolute deviation, which one slow run cannot drag along the way a mean and
+// standard deviation would. The times are overwritten.
+function baseline_timing
+SummarizeBaselineTimes(f64* Seconds, s32 Count)
+{
+	baseline_timing Timing = {};
+	SortSeconds(Seconds, Count);
+	Timing.Median = MedianOfSorted(Seconds, Count);
+	for (s32 Index = 0; Index < Count; ++Index)
+	{
+		Seconds[Index] = fabs(Seconds[Index] - Timing.Median);
+	}
+	SortSeconds(Seconds, Count);
+	Timing.Spread = MedianOfSorted(Seconds, Count);
+	return Timing;
+}
+
+// A timing has regressed when its median grew by more than the tolerance, by more than the noise seen
+// in both the stored and the current runs relative to their medians, and by more than a millisecond.
+// Timings shorter than MinGatedSeconds are mostly noise, so they are reported without being checked.
+function b32
+CompareBaselineTiming(const char* Name, baseline_timing* Stored, baseline_timing* Current, f64 Tolerance,
+	f64 MinGatedSeconds, b32 Print)
+{
+	f64 AllowedFraction = Tolerance;
+	f64 Noise = BASELINE_NOISE_SPREADS*((Stored->Median > 0 ? Stored->Spread / Stored->Median : 0) +
+		(Current->Median > 0 ? Current->Spread / Current->Median : 0));
+	if (Noise > AllowedFraction)
+	{
+		AllowedFraction = Noise;
+	}
+	f64 Allowed = AllowedFraction*Stored->Median;
+	if (BASELINE_MIN_SECONDS > Allowed)
+	{
+		Allowed = BASELINE_MIN_SECONDS;
+	}
+	b32 Gated = (Stored->Median >= MinGatedSeconds);
+	b32 Regressed = Gated && (Current->Median > Stored->Median + Allowed);
+	if (Print)
+	{
+		f64 Change = Stored->Median > 0 ? 100.0*(Current->Median - Stored->Median) / Stored->Median : 0;
+		f64 AllowedChange = Stored->Median > 0 ? 100.0*Allowed / Stored->Median : 0;
+		printf("\t%-7s %10.6f -> %10.6f (s) %+7.1f%% (allowed %+.1f%%)%s\n", Name, Stored->Median, Current->Median,
+			Change, AllowedChange, Regressed ? " REGRESSION" : Gated ? "" : " not checked, too short");
+	}
+	return Regressed;
+}
+
+function b32
+CompareBaselineTimings(baseline_case* Stored, baseline_case* Current, f64 Tolerance, b32 Print)
+{
+	b32 Regressed = CompareBaselineTiming("load", &Stored->Load, &Current->Load, Tolerance, BASELINE_MIN_GATED_SECONDS, Print);
+	if (Stored->SpatialPartition)
+	{
+		Regressed = CompareBaselineTiming("build", &Stored->Build, &Current->Build, Tolerance, BASELINE_MIN_GATED_SECONDS, Print) || Regressed;
+	}
+	Regressed = CompareBaselineTiming("render", &Stored->Render, &Current->Render, Tolerance, 0, Print) || Regressed;
+	return Regressed;
+}
+
+// Peak signal to noise ratio of the displayed colors, after clamping and the same gamma as the .tga
+// output, so differences too dark or too bright to see count for little. Identical images give infinity.
+function f64
+GetImagePSNR(surface* Reference, surface* Image, f64* MaxError)
+{
+	f64 SquaredErrorSum = 0;
+	*MaxError = 0;
+	s64 PixelCount = (s64)Image->Width*Image->Height;
+	for (s64 Index = 0; Index < PixelCount; ++Index)
+	{
+		for (s32 Channel = 0; Channel < 3; ++Channel)
+		{
+			f64 Error = sqrtf(Clamp01(Image->Pixels[Index].E[Channel])) - sqrtf(Clamp01(Reference->Pixels[Index].E[Channel]));
+			SquaredErrorSum += Error*Error;
+			if (fabs(Error) > *MaxError)
+			{
+				*MaxError = fabs(Error);
+			}
+		}
+	}
+	f64 MeanSquaredError = PixelCount > 0 ? SquaredErrorSum / (f64)(3*PixelCount) : 0;
+	f64 Result = MeanSquaredError > 0 ? -10.0*log10(MeanSquaredError) : INFINITY;
+	return Result;
+}
\ No newline at end of file
@@ -0,0 +1,348 @@
+/*
+ * bench.h
+ *
+ * Benchmark manifests and the CSV or JSON results written for them
+ */
+
+// A manifest lists the values to sweep for each setting, in the same syntax as .scn files:
+//
+// Bench
+// {
+// 	Scenes = ("data/rand_1024_32.scn", "data/rand_4096_32.scn"),
+// 	Resolution = (256, 512),
+// 	Samples = (1, 2, 4),
+// 	Threads = (16, 32),
+// 	Repeat = 3,
+// 	Results = "stats/bench.csv",
+// }
+//
+// Every combination is rendered. Settings that are left out take their value from the command line.
+
+#define MAX_BENCH_VALUES 32
+
+typedef struct bench_values
+{
+	s32 Count;
+	s32 Values[MAX_BENCH_VALUES];
+} bench_values;
+
+typedef struct bench_manifest
+{
+	s32 SceneCount;
+	const char* Scenes[MAX_BENCH_VALUES];
+	bench_values Resolutions;
+	bench_values Samples;
+	bench_values Bounces;
+	bench_values Threads;
+	bench_values SpatialPartition;
+	bench_values ObjectsPerLeaf;
+	bench_values LeafDepths;
+	s32 WarmUpRuns;
+	s32 Repeats;
+	const char* ResultsFile;
+} bench_manifest;
+
+typedef struct bench_result
+{
+	const char* Scene;
+	s32 Width;
+	s32 Height;
+	s32 SamplesPerPixel;
+	s32 MaxBounces;
+	s32 Threads;
+	b32 SpatialPartition;
+	s32 ObjectsPerLeaf;
+	s32 LeafDepth;
+	s32 Runs;
+	f64 BuildSeconds;
+	f64 MinSeconds;
+	f64 MedianSeconds;
+	f64 MeanSeconds;
+	f64 MaxSeconds;
+	s64 RaysCast;
+	s64 SpatialNodesChecked;
+	s64 ObjectsChecked;
+	f64 Imbalance;
+} bench_result;
+
+// Reads '= Value' or '= (Value, Value, ...)'
+function void
+ParseBenchValues(tokenizer* Tokenizer, bench_values* Values, s32 MinValue)
+{
+	ExpectToken(Tokenizer, Token_Equals);
+	tokenizer Peek = *Tokenizer;
+	b32 IsTuple = (NextToken(&Peek).Type == Token_LeftParen);
+	if (IsTuple)
+	{
+		NextToken(Tokenizer);
+	}
+	
+	Values->Count = 0;
+	do
+	{
+		if (Values->Count >= MAX_BENCH_VALUES)
+		{
+			Tokenizer->Error = true;
+			break;
+		}
+		f32 ValueF = ParseNumber(Tokenizer);
+		s32 Value = (s32)ValueF;
+		if ((f32)Value != ValueF || Value < MinValue)
+		{
+			Tokenizer->Error = true;
+		}
+		Values->Values[Values->Count++] = Value;
+	} while (IsTuple && !Tokenizer->Error && NextToken(Tokenizer).Type == Token_Comma);
+	if (IsTuple && !Tokenizer->Error && Tokenizer->CurrentToken.Type != Token_RightParen)
+	{
+		Tokenizer->Error = true;
+	}
+}
+
+function void
+ParseBenchScenes(tokenizer* Tokenizer, bench_manifest* Manifest)
+{
+	ExpectToken(Tokenizer, Token_Equals);
+	tokenizer Peek = *Tokenizer;
+	b32 IsTuple = (NextToken(&Peek).Type == Token_LeftParen);
+	if (IsTuple)
+	{
+		NextToken(Tokenizer);
+	}
+	
+	Manifest->SceneCount = 0;
+	do
+	{
+		if (Manifest->SceneCount >= MAX_BENCH_VALUES || !ExpectToken(Tokenizer, Token_String))
+		{
+			Tokenizer->Error = true;
+			break;
+		}
+		// Strings are null terminated in place by the tokenizer
+		Manifest->Scenes[Manifest->SceneCount++] = (const char*)Tokenizer->CurrentToken.String.Data;
+	} while (IsTuple && !Tokenizer->Error && NextToken(Tokenizer).Type == Token_Comma);
+	if (IsTuple && !Tokenizer->Error && Tokenizer->CurrentToken.Type != Token_RightParen)
+	{
+		Tokenizer->Error = true;
+	}
+}
+
+// The manifest is kept in Arena, since the scene and results file names point into it
+function b32
+LoadBenchManifest(const char* FileName, bench_manifest* Manifest, memory_arena* Arena)
+{
+	*Manifest = {};
+	Manifest->WarmUpRuns = 1;
+	Manifest->Repeats = 3;
+	
+	b32 Success = true;
+	buffer Buffer = LoadEntireFile(FileName, Arena);
+	if (Buffer.Data)
+	{
+		tokenizer Tokenizer = {};
+		Tokenizer.Buffer = Buffer;
+		Tokenizer.Line = 1;
+		Tokenizer.Column = 1;
+		
+		ExpectToken(&Tokenizer, Token_Bench);
+		ExpectToken(&Tokenizer, Token_LeftBrace);
+		if (Tokenizer.Error)
+		{
+			fprintf(stderr, "(%d, %d): Invalid bench declaration. Expected 'Bench {', got '%.*s'\n", Tokenizer.CurrentToken.Line, Tokenizer.CurrentToken.Column, PrintString(Tokenizer.CurrentToken.String));
+		}
+		
+		while (!Tokenizer.Error)
+		{
+			token Token = NextToken(&Tokenizer);
+			if (Token.Type == Token_RightBrace)
+			{
+				break;
+			}
+			else if (Token.Type == Token_Scenes)
+			{
+				ParseBenchScenes(&Tokenizer, Manifest);
+			}
+			else if (Token.Type == Token_Resolution)
+			{
+				ParseBenchValues(&Tokenizer, &Manifest->Resolutions, 1);
+			}
+			else if (Token.Type == Token_Samples)
+			{
+				ParseBenchValues(&Tokenizer, &Manifest->Samples, 1);
+			}
+			else if (Token.Type == Token_Bounces)
+			{
+				ParseBenchValues(&Tokenizer, &Manifest->Bounces, 1);
+			}
+			else if (Token.Type == Token_Threads)
+			{
+				ParseBenchValues(&Tokenizer, &Manifest->Threads, 1);
+			}
+			else if (Token.Type == Token_SpatialPartition)
+			{
+				ParseBenchValues(&Tokenizer, &Manifest->SpatialPartition, 0);
+			}
+			else if (Token.Type == Token_ObjectsPerLeaf)
+			{
+				ParseBenchValues(&Tokenizer, &Manifest->ObjectsPerLeaf, 1);
+			}
+			else if (Token.Type == Token_LeafDepth)
+			{
+				ParseBenchValues(&Tokenizer, &Manifest->LeafDepths, 1);
+			}
+			else if (Token.Type == Token_WarmUp || Token.Type == Token_Repeat)
+			{
+				b32 WarmUp = (Token.Type == Token_WarmUp);
+				ExpectToken(&Tokenizer, Token_Equals);
+				f32 CountF = ParseNumber(&Tokenizer);
+				s32 Count = (s32)CountF;
+				if ((f32)Count != CountF || Count < (WarmUp ? 0 : 1))
+				{
+					Tokenizer.Error = true;
+				}
+				*(WarmUp ? &Manifest->WarmUpRuns : &Manifest->Repeats) = Count;
+			}
+			else if (Token.Type == Token_Results)
+			{
+				ExpectToken(&Tokenizer, Token_Equals);
+				if (ExpectToken(&Tokenizer, Token_String))
+				{
+					Manifest->ResultsFile = (const char*)Tokenizer.CurrentToken.String.Data;
+				}
+			}
+			else
+			{
+				Tokenizer.Error = true;
+				fprintf(stderr, "(%d, %d): Invalid token in bench declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+				break;
+			}
+			
+			if (Tokenizer.Error)
+			{
+				fprintf(stderr, "(%d, %d): Invalid bench %.*s declaration\n", Token.Line, Token.Column, PrintString(Token.String));
+			}
+			else
+			{
+				Token = NextToken(&Tokenizer);
+				if (Token.Type == Token_RightBrace)
+				{
+					break;
+				}
+				else if (Token.Type != Token_Comma)
+				{
+					Tokenizer.Error = true;
+					fprintf(stderr, "(%d, %d): Invalid token in bench declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+				}
+			}
+		}
+		
+		Success = !Tokenizer.Error;
+	}
+	else
+	{
+		Success = false;
+	}
+	
+	if (!Success)
+	{
+		fprintf(stderr, "Error loading bench manifest: '%s'\n", FileName);
+	}
+	return Success;
+}
+
+function void
+SortSeconds(f64* Seconds, s32 Count)
+{
+	for (s32 Index = 1; Index < Count; ++Index)
+	{
+		f64 Value = Seconds[Index];
+		s32 Dest = Index;
+		while (Dest > 0 && Seconds[Dest - 1] > Value)
+		{
+			Seconds[Dest] = Seconds[Dest - 1];
+			--Dest;
+		}
+		Seconds[Dest] = Value;
+	}
+}
+
+function f64
+MedianOfSorted(f64* Seconds, s32 Count)
+{
+	f64 Result = (Count % 2) ? Seconds[Count/2] : 0.5*(Seconds[Count/2 - 1] + Seconds[Count/2]);
+	return Result;
+}
+
+// Fills in the timing columns from the individual run times, which get sorted
+function void
+SummarizeBenchRuns(bench_result* Result, f64* Seconds, s32 RunCount)
+{
+	SortSeconds(Seconds, RunCount);
+	
+	f64 Total = 0;
+	for (s32 Index = 0; Index < RunCount; ++Index)
+	{
+		Total += Seconds[Index];
+	}
+	Result->Runs = RunCount;
+	Result->MinSeconds = Seconds[0];
+	Result->MaxSeconds = Seconds[RunCount - 1];
+	Result->MeanSeconds = Total / (f64)RunCount;
+	Result->MedianSeconds = MedianOfSorted(Seconds, RunCount);
+}
+
+function void
+BeginBenchResults(FILE* File, b32 JSON)
+{
+	if (JSON)
+	{
+		fprintf(File, "[\n");
+	}
+	else
+	{
+		fprintf(File, "scene,width,height,samples,bounces,threads,spatial_partition,objects_per_leaf,leaf_depth,runs,"
+			"build_s,min_s,median_s,mean_s,max_s,rays,rays_per_s,nodes_per_ray,objects_per_ray,imbalance\n");
+	}
+}
+
+// Rays per second are taken from the median run, so one slow outlier does not skew them
+function void
+WriteBenchResult(FILE* File, bench_result* Result, b32 JSON, b32 First)
+{
+	f64 Rays = (f64)Result->RaysCast;
+	f64 RaysPerSecond = Result->MedianSeconds > 0 ? Rays / Result->MedianSeconds : 0;
+	f64 NodesPerRay = Rays > 0 ? (f64)Result->SpatialNodesChecked / Rays : 0;
+	f64 ObjectsPerRay = Rays > 0 ? (f64)Result->ObjectsChecked / Rays : 0;
+	if (JSON)
+	{
+		fprintf(File, "%s\t{\"scene\": ", First ? "" : ",\n");
+		WriteJSONString(File, Result->Scene);
+		fprintf(File, ", \"width\": %d, \"height\": %d, \"samples\": %d, \"bounces\": %d, \"threads\": %d, "
+			"\"spatial_partition\": %s, \"objects_per_leaf\": %d, \"leaf_depth\": %d, \"runs\": %d, "
+			"\"build_s\": %.6f, \"min_s\": %.6f, \"median_s\": %.6f, \"mean_s\": %.6f, \"max_s\": %.6f, "
+			"\"rays\": %ld, \"rays_per_s\": %.1f, \"nodes_per_ray\": %.3f, \"objects_per_ray\": %.3f, \"imbalance\": %.3f}",
+			Result->Width, Result->Height, Result->SamplesPerPixel, Result->MaxBounces, Result->Threads,
+			Result->SpatialPartition ? "true" : "false", Result->ObjectsPerLeaf, Result->LeafDepth, Result->Runs,
+			Result->BuildSeconds, Result->MinSeconds, Result->MedianSeconds, Result->MeanSeconds, Result->MaxSeconds,
+			Result->RaysCast, RaysPerSecond, NodesPerRay, ObjectsPerRay, Result->Imbalance);
+	}
+	else
+	{
+		fprintf(File, "%s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%ld,%.1f,%.3f,%.3f,%.3f\n",
+			Result->Scene, Result->Width, Result->Height, Result->SamplesPerPixel, Result->MaxBounces, Result->Threads,
+			Result->SpatialPartition ? 1 : 0, Result->ObjectsPerLeaf, Result->LeafDepth, Result->Runs,
+			Result->BuildSeconds, Result->MinSeconds, Result->MedianSeconds, Result->MeanSeconds, Result->MaxSeconds,
+			Result->RaysCast, RaysPerSecond, NodesPerRay, ObjectsPerRay, Result->Imbalance);
+	}
+	fflush(File);
+}
+
+function void
+EndBenchResults(FILE* File, b32 JSON)
+{
+	if (JSON)
+	{
+		fprintf(File, "\n]\n");
+	}
+	fflush(File);
+}
\ No newline at end of file
@@ -0,0 +1,118 @@
+/*
+ * bouncestats.h
+ *
+ * What happens to paths at each bounce, to see whether more bounces are worth their cost
+ */
+
+// Throughput is the fraction of light a path still carries back to the camera, the mean of its
+// color channels: 1 for a camera ray, and the product of the colors it bounced off after that.
+// A path that runs out of bounces while its throughput is still high was cut off with light left
+// to gather, so a scene with many of those would look different with a higher -b.
+
+#define MAX_BOUNCE_STATS 64 // Deeper bounces are counted in the last depth
+#define BOUNCE_SIGNIFICANT_THROUGHPUT 0.05f
+
+typedef struct bounce_depth_stats
+{
+	s64 Rays;
+	s64 Escapes; // Rays that hit nothing and ended on the sky
+	s64 Translucent; // Rays that passed through the object they hit rather than bouncing off it
+	f64 ThroughputSum; // Of the rays when they were cast
+} bounce_depth_stats;
+
+typedef struct bounce_stats
+{
+	s32 MaxBounces;
+	s32 DepthCount;
+	s64 Paths;
+	s64 CutOff; // Paths still going when they reached MaxBounces
+	s64 CutOffSignificant; // Of those, the ones with at least BOUNCE_SIGNIFICANT_THROUGHPUT left
+	f64 CutOffThroughputSum;
+	bounce_depth_stats Depths[MAX_BOUNCE_STATS];
+} bounce_stats;
+
+function f32
+GetThroughput(color SampleColor)
+{
+	f32 Result = (SampleColor.R + SampleColor.G + SampleColor.B)*(1.0f / 3.0f);
+	return Result;
+}
+
+function bounce_depth_stats*
+GetBounceDepth(bounce_stats* Stats, s32 Bounce)
+{
+	s32 Depth = Bounce < MAX_BOUNCE_STATS ? Bounce : MAX_BOUNCE_STATS - 1;
+	if (Depth >= Stats->DepthCount)
+	{
+		Stats->DepthCount = Depth + 1;
+	}
+	bounce_depth_stats* Result = Stats->Depths + Depth;
+	return Result;
+}
+
+function void
+RecordCutOff(bounce_stats* Stats, color SampleColor)
+{
+	f32 Throughput = GetThroughput(SampleColor);
+	++Stats->CutOff;
+	Stats->CutOffSignificant += (Throughput >= BOUNCE_SIGNIFICANT_THROUGHPUT);
+	Stats->CutOffThroughputSum += Throughput;
+}
+
+function void
+AddBounceStats(bounce_stats* Dest, bounce_stats* Source)
+{
+	Dest->Paths += Source->Paths;
+	Dest->CutOff += Source->CutOff;
+	Dest->CutOffSignificant += Source->CutOffSignificant;
+	Dest->CutOffThroughputSum += Source->CutOffThroughputSum;
+	if (Source->DepthCount > Dest->DepthCount)
+	{
+		Dest->DepthCount = Source->DepthCount;
+	}
+	for (s32 Depth = 0; Depth < Source->DepthCount; ++Depth)
+	{
+		Dest->Depths[Depth].Rays += Source->Depths[Depth].Rays;
+		Dest->Depths[Depth].Escapes += Source->Depths[Depth].Escapes;
+		Dest->Depths[Depth].Translucent += Source->Depths[Depth].Translucent;
+		Dest->Depths[Depth].ThroughputSum += Source->Depths[Depth].ThroughputSum;
+	}
+}
+
+// Escapes and translucent passes are given as shares of the rays at their depth, and the paths
+// that are left after each depth as a share of all paths, which is the termination histogram
+function void
+PrintBounceStats(bounce_stats* Stats)
+{
+	printf("Bounce stats (%ld paths, -b %d):\n", Stats->Paths, Stats->MaxBounces);
+	printf("%6s %12s %9s %12s %11s %11s\n", "Bounce", "Rays", "Escaped", "Translucent", "Throughput", "Paths left");
+	s64 PathsLeft = Stats->Paths;
+	for (s32 Depth = 0; Depth < Stats->DepthCount; ++Depth)
+	{
+		bounce_depth_stats* Bounce = Stats->Depths + Depth;
+		f64 Rays = Bounce->Rays > 0 ? (f64)Bounce->Rays : 1.0;
+		PathsLeft -= Bounce->Escapes;
+		printf("%5d%s %12ld %8.2f%% %11.2f%% %11.4f %10.2f%%\n", Depth, Depth == MAX_BOUNCE_STATS - 1 ? "+" : " ", Bounce->Rays,
+			100.0*(f64)Bounce->Escapes / Rays, 100.0*(f64)Bounce->Translucent / Rays, Bounce->ThroughputSum / Rays,
+			Stats->Paths > 0 ? 100.0*(f64)PathsLeft / (f64)Stats->Paths : 0);
+	}
+	printf("Cut off by -b %d: %ld paths (%.2f%%), %ld with throughput of at least %.2f, mean throughput %.4f\n",
+		Stats->MaxBounces, Stats->CutOff, Stats->Paths > 0 ? 100.0*(f64)Stats->CutOff / (f64)Stats->Paths : 0,
+		Stats->CutOffSignificant, BOUNCE_SIGNIFICANT_THROUGHPUT,
+		Stats->CutOff > 0 ? Stats->CutOffThroughputSum / (f64)Stats->CutOff : 0);
+}
+
+function void
+WriteBounceStatsJSON(FILE* File, bounce_stats* Stats)
+{
+	fprintf(File, "{\"max_bounces\": %d, \"paths\": %ld, \"depths\": [", Stats->MaxBounces, Stats->Paths);
+	for (s32 Depth = 0; Depth < Stats->DepthCount; ++Depth)
+	{
+		bounce_depth_stats* Bounce = Stats->Depths + Depth;
+		fprintf(File, "%s{\"bounce\": %d, \"rays\": %ld, \"escapes\": %ld, \"translucent\": %ld, \"mean_throughput\": %.6f}",
+			Depth ? ", " : "", Depth, Bounce->Rays, Bounce->Escapes, Bounce->Translucent,
+			Bounce->Rays > 0 ? Bounce->ThroughputSum / (f64)Bounce->Rays : 0);
+	}
+	fprintf(File, "], \"cut_off\": %ld, \"cut_off_significant\": %ld, \"cut_off_mean_throughput\": %.6f}",
+		Stats->CutOff, Stats->CutOffSignificant, Stats->CutOff > 0 ? Stats->CutOffThroughputSum / (f64)Stats->CutOff : 0);
+}
\ No newline at end of file
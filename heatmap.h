@@ -0,0 +1,170 @@
+/*
+ * heatmap.h
+ *
+ * Per-pixel render cost, written as false color images and raw float maps
+ */
+
+// The render fills these in only when they are asked for; otherwise the only cost is one
+// branch per pixel. Every pixel gets the sum over all of its samples.
+
+#define HEATMAP_HISTOGRAM_BINS 1024
+#define HEATMAP_PERCENTILE 0.99
+
+enum pixel_cost_type
+{
+	PixelCost_Rays,
+	PixelCost_Nodes,
+	PixelCost_Objects,
+	PixelCost_Nanoseconds,
+	
+	PixelCost_Count,
+};
+
+global const char* PixelCostNames[PixelCost_Count] =
+{
+	"rays",
+	"nodes",
+	"objects",
+	"ns",
+};
+
+typedef struct pixel_costs
+{
+	s32 Width;
+	s32 Height;
+	f32* Values[PixelCost_Count];
+} pixel_costs;
+
+function pixel_costs
+MakePixelCosts(s32 Width, s32 Height, memory_arena* Arena)
+{
+	pixel_costs Costs = {};
+	Costs.Width = Width;
+	Costs.Height = Height;
+	s64 PixelCount = (s64)Width*Height;
+	for (s32 Type = 0; Type < PixelCost_Count; ++Type)
+	{
+		Costs.Values[Type] = PushArray(Arena, PixelCount, f32);
+		for (s64 Index = 0; Index < PixelCount; ++Index)
+		{
+			Costs.Values[Type][Index] = 0;
+		}
+	}
+	return Costs;
+}
+
+// Maps 0..1 to a ramp from black through purple, red and orange to pale yellow, close to the
+// inferno color map, so brightness alone still orders the costs
+function color
+HeatmapColor(f32 T)
+{
+	color Stops[] =
+	{
+		{0.0f, 0.0f, 0.02f},
+		{0.34f, 0.06f, 0.43f},
+		{0.74f, 0.22f, 0.33f},
+		{0.98f, 0.56f, 0.04f},
+		{0.99f, 1.0f, 0.64f},
+	};
+	f32 Position = Clamp01(T)*(f32)(ArrayCount(Stops) - 1);
+	s32 Lower = (s32)Position;
+	if (Lower >= (s32)ArrayCount(Stops) - 1)
+	{
+		Lower = (s32)ArrayCount(Stops) - 2;
+	}
+	color Result = Lerp(Stops[Lower], Position - (f32)Lower, Stops[Lower + 1]);
+#ifndef NO_GAMMA_CORRECTION
+	// The stops are display values, and the TGA writer gamma encodes what it is given
+	Result.R *= Result.R;
+	Result.G *= Result.G;
+	Result.B *= Result.B;
+#endif
+	return Result;
+}
+
+// The value that HEATMAP_PERCENTILE of the pixels stay under, so a few very expensive pixels
+// do not wash out the rest of the image
+function f32
+GetHeatmapScale(f32* Values, s64 Count)
+{
+	f32 Max = 0;
+	for (s64 Index = 0; Index < Count; ++Index)
+	{
+		if (Values[Index] > Max)
+		{
+			Max = Values[Index];
+		}
+	}
+	
+	f32 Result = Max;
+	if (Max > 0)
+	{
+		s64 Histogram[HEATMAP_HISTOGRAM_BINS] = {};
+		for (s64 Index = 0; Index < Count; ++Index)
+		{
+			s32 Bin = (s32)(Values[Index] / Max*(f32)(HEATMAP_HISTOGRAM_BINS - 1));
+			++Histogram[Bin];
+		}
+		
+		s64 Threshold = (s64)(HEATMAP_PERCENTILE*(f64)Count);
+		s64 Total = 0;
+		for (s32 Bin = 0; Bin < HEATMAP_HISTOGRAM_BINS; ++Bin)
+		{
+			Total += Histogram[Bin];
+			if (Total >= Threshold)
+			{
+				Result = Max*(f32)(Bin + 1) / (f32)HEATMAP_HISTOGRAM_BINS;
+				break;
+			}
+		}
+	}
+	return Result;
+}
+
+// Writes <Prefix>_<cost>.tga in false color and <Prefix>_<cost>.pfm with the raw values for every cost
+function b32
+WriteHeatmaps(pixel_costs* Costs, const char* Prefix, memory_arena* Arena)
+{
+	b32 Success = true;
+	s64 PixelCount = (s64)Costs->Width*Costs->Height;
+	for (s32 Type = 0; Type < PixelCost_Count; ++Type)
+	{
+		temporary_memory Temp = BeginTemporaryMemory(Arena);
+		f32* Values = Costs->Values[Type];
+		f32 Scale = GetHeatmapScale(Values, PixelCount);
+		f32 InvScale = Scale > 0 ? 1.0f / Scale : 0;
+		
+		surface Heatmap = {};
+		Heatmap.Width = Costs->Width;
+		Heatmap.Height = Costs->Height;
+		Heatmap.Pixels = PushArray(Arena, PixelCount, color);
+		f64 Total = 0;
+		for (s64 Index = 0; Index < PixelCount; ++Index)
+		{
+			Heatmap.Pixels[Index] = HeatmapColor(Values[Index]*InvScale);
+			Total += Values[Index];
+		}
+		
+		char FileName[1024];
+		snprintf(FileName, sizeof(FileName), "%s_%s.tga", Prefix, PixelCostNames[Type]);
+		b32 Written = WriteTGA(&Heatmap, FileName, Arena);
+		if (Written)
+		{
+			snprintf(FileName, sizeof(FileName), "%s_%s.pfm", Prefix, PixelCostNames[Type]);
+			Written = WriteSingleChannelPFM(Values, Costs->Width, Costs->Height, FileName);
+		}
+		
+		if (Written)
+		{
+			printf("Heatmap %s: mean %.1f per pixel, full color at %.1f\n",
+				PixelCostNames[Type], Total / (f64)PixelCount, Scale);
+		}
+		else
+		{
+			Success = false;
+			fprintf(stderr, "Error writing heatmap: '%s'\n", FileName);
+		}
+		EndTemporaryMemory(Temp);
+	}
+	return Success;
+}
\ No newline at end of file
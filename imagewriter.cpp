@@ -8,6 +8,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <sys/mman.h>
+#include <emmintrin.h>
 
 #define EPSILON 0.00001f
 
@@ -0,0 +1,182 @@
+/*
+ * intersect.h
+ *
+ * Closest hit of a ray against every object of a scene, without a spatial partition
+ */
+
+// Every object is checked, so Stats gets all of them, along with the contents of every instance
+function ray_hit
+RayIntersectScene(v3 RayOrigin, v3 RayDir, scene* Scene, ray_trace_stats* Stats)
+{
+	ray_hit RayHit = {};
+	Stats->ObjectsChecked += Scene->ObjectCount;
+	for (s32 Index = 0; Index < Scene->ObjectCount; ++Index)
+	{
+		object* Object = Scene->Objects + Index;
+		switch (Object->Type)
+		{
+			case Obj_Plane:
+			{
+				f32 RayDDotNormal = Dot(RayDir, Object->Plane.Normal);
+				if (Abs(RayDDotNormal) > EPSILON)
+				{
+					f32 Hit = (Object->Plane.Displacement - Dot(RayOrigin, Object->Plane.Normal)) / RayDDotNormal;
+					if (Hit > EPSILON && (RayHit.Dist == 0 || Hit < RayHit.Dist))
+					{
+						// Record a hit
+						RayHit.Dist = Hit;
+						RayHit.Object = Object;
+						RayHit.Instance = 0;
+						RayHit.Normal = (RayDDotNormal < 0 ? Object->Plane.Normal : -Object->Plane.Normal);
+					}
+				}
+			} break;
+			
+			case Obj_Sphere:
+			{
+				v3 FromCenter = RayOrigin - Object->Sphere.Center;
+				f32 RayDDotFromCenter = Dot(RayDir, FromCenter);
+				f32 Discriminant = RayDDotFromCenter*RayDDotFromCenter - LengthSq(FromCenter) + Object->Sphere.Radius*Object->Sphere.Radius;
+				if (Discriminant > EPSILON)
+				{
+					f32 RootDisc = sqrtf(Discriminant);
+					// b32 Inside = false;
+					f32 Hit = -RayDDotFromCenter - RootDisc;
+					if (Hit <= 0)
+					{
+						Hit = -RayDDotFromCenter + RootDisc;
+						// Inside = true;
+					}
+					if (Hit > EPSILON && (RayHit.Dist == 0 || Hit < RayHit.Dist))
+					{
+						// Record a hit
+						v3 RelHitPoint = RayOrigin + RayDir*Hit - Object->Sphere.Center;
+						v3 Normal = NormOrZero(RelHitPoint);
+						RayHit.Dist = Hit;
+						RayHit.Object = Object;
+						RayHit.Instance = 0;
+						RayHit.Normal = Normal; //(Inside ? -Normal : Normal);
+					}
+				}
+			} break;
+			
+			case Obj_Triangle:
+			{
+				v3 AB = Object->Triangle.Vertex[1] - Object->Triangle.Vertex[0];
+				v3 AC = Object->Triangle.Vertex[2] - Object->Triangle.Vertex[0];
+				v3 Normal = NormOrZero(Cross(AB, AC));
+				if (Normal != (v3){0})
+				{
+					f32 RayDDotNormal = Dot(RayDir, Normal);
+					if (Abs(RayDDotNormal) > EPSILON)
+					{
+						f32 Hit = Dot(Object->Triangle.Vertex[0] - RayOrigin, Normal) / RayDDotNormal;
+						if (Hit > EPSILON && (RayHit.Dist == 0 || Hit < RayHit.Dist))
+						{
+							v3 HitP = RayOrigin + RayDir*Hit;
+							v3 AP = HitP - Object->Triangle.Vertex[0];
+							f32 ABDotAC = Dot(AB, AC);
+							v3 ABPerp = AC - AB*(ABDotAC/LengthSq(AB));
+							f32 V = Dot(AP, ABPerp)/LengthSq(ABPerp);
+							if (V > 0)
+							{
+								v3 ACPerp = AB - AC*(ABDotAC/LengthSq(AC));
+								f32 U = Dot(AP, ACPerp)/LengthSq(ACPerp);
+								if (U > 0 && U + V < 1.0f)
+								{
+									// Record a hit
+									RayHit.Dist = Hit;
+									RayHit.Object = Object;
+									RayHit.Instance = 0;
+									RayHit.Normal = (RayDDotNormal < 0 ? Normal : -Normal);
+									RayHit.UV = (uv){U, V};
+								}
+							}
+						}
+					}
+				}
+			} break;
+			
+			case Obj_Parallelogram:
+			{
+				v3 Normal = NormOrZero(Cross(Object->Parallelogram.XAxis, Object->Parallelogram.YAxis));
+				if (Normal != (v3){0})
+				{
+					f32 RayDDotNormal = Dot(RayDir, Normal);
+					if (Abs(RayDDotNormal) > EPSILON)
+					{
+						f32 Hit = Dot(Object->Parallelogram.Origin - RayOrigin, Normal) / RayDDotNormal;
+						if (Hit > EPSILON && (RayHit.Dist == 0 || Hit < RayHit.Dist))
+						{
+							v3 HitP = RayOrigin + RayDir*Hit;
+							v3 AP = HitP - Object->Parallelogram.Origin;
+							f32 ABDotAC = Dot(Object->Parallelogram.XAxis, Object->Parallelogram.YAxis);
+							v3 ABPerp = Object->Parallelogram.YAxis - Object->Parallelogram.XAxis*(ABDotAC/LengthSq(Object->Parallelogram.XAxis));
+							f32 V = Dot(AP, ABPerp)/LengthSq(ABPerp);
+							if (V > 0)
+							{
+								v3 ACPerp = Object->Parallelogram.XAxis - Object->Parallelogram.YAxis*(ABDotAC/LengthSq(Object->Parallelogram.YAxis));
+								f32 U = Dot(AP, ACPerp)/LengthSq(ACPerp);
+								if (U > 0 && U < 1.0f && V < 1.0f)
+								{
+									// Record a hit
+									RayHit.Dist = Hit;
+									RayHit.Object = Object;
+									RayHit.Instance = 0;
+									RayHit.Normal = (RayDDotNormal < 0 ? Normal : -Normal);
+									RayHit.UV = (uv){U, V};
+								}
+							}
+						}
+					}
+				}
+			} break;
+			
+			case Obj_Instance:
+			{
+				IntersectInstance(&RayHit, Scene->Instances + Object->Instance.Index, RayOrigin, RayDir, false, Stats);
+			} break;
+			
+			default:
+			{
+				fprintf(stderr, "Error: Encountered object of type %d in RayIntersectScene!\n", Object->Type);
+			} break;
+		}
+	}
+	
+	return RayHit;
+}
+
+// Traces the instance's group in its own space and keeps the hit if it is closer than RayHit.
+// The hit is converted back to a world distance before it is tested, so an instance accepts the
+// same hits however it is scaled, and whether or not its group is traced through its partition.
+function void
+IntersectInstance(ray_hit* RayHit, instance* Instance, v3 RayOrigin, v3 RayDir, b32 UsePartition, ray_trace_stats* Stats)
+{
+	v3 LocalDir = ToInstanceSpace(Instance, RayDir);
+	f32 DirScale = Length(LocalDir);
+	if (DirScale > 0)
+	{
+		v3 LocalOrigin = ToInstanceSpace(Instance, RayOrigin - Instance->Origin);
+		scene* GroupScene = &Instance->Group->Scene;
+		ray_hit InstanceHit;
+		if (UsePartition)
+		{
+			InstanceHit = RayIntersectScene(LocalOrigin, LocalDir/DirScale, GroupScene, Instance->Group->Partition, Stats);
+		}
+		else
+		{
+			InstanceHit = RayIntersectScene(LocalOrigin, LocalDir/DirScale, GroupScene, Stats);
+		}
+		f32 Hit = InstanceHit.Dist / DirScale;
+		if (Hit > EPSILON && (RayHit->Dist == 0 || Hit < RayHit->Dist))
+		{
+			// Record a hit
+			RayHit->Dist = Hit;
+			RayHit->Object = InstanceHit.Object;
+			RayHit->Instance = Instance;
+			RayHit->Normal = NormalFromInstanceSpace(Instance, InstanceHit.Normal);
+			RayHit->UV = InstanceHit.UV;
+		}
+	}
+}
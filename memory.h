@@ -4,13 +4,35 @@
  * For everything to do with memory management
  */
 
+// Arenas reserve their full capacity as address space up front and commit it in
+// chunks as allocations reach it, so resident memory follows what is actually used.
+// Chunks are the size of a huge page so that huge page backed arenas stay aligned.
+#define ARENA_COMMIT_SIZE (2*1024*1024)
+
+// Explicit huge pages are asked for at 2 MB, the commit chunk size, since the default huge page size
+// of the system may be 1 GB and chunks that are not a whole number of pages cannot be mapped. The value is
+// log2 of the page size shifted by MAP_HUGE_SHIFT, as in linux/mman.h, for headers without it.
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << 26)
+#endif
+
+enum huge_page_mode
+{
+	HugePages_None,
+	HugePages_Transparent,
+	HugePages_Explicit,
+};
+
 typedef struct memory_arena
 {
 	s64 Capacity;
+	s64 Committed;
 	s64 Allocated;
+	s64 HighWater; // Most ever allocated at once, kept across resets
 	u8* Start;
 	s64 Alignment;
 	s32 TempCount;
+	s32 HugePages;
 } memory_arena;
 
 typedef struct temporary_memory
@@ -20,30 +42,104 @@ typedef struct temporary_memory
 	s32 TempCount;
 } temporary_memory;
 
+global b32 ExplicitHugePagesExhausted; // Warned about once, rather than for every chunk
+
 function memory_arena
-MakeArena(s64 Capacity, s64 Alignment)
+MakeArena(s64 Capacity, s64 Alignment, s32 HugePages = HugePages_None)
 {
 	assert(Capacity > 0);
 	assert(Alignment > 0);
 	assert(IsPow2(Alignment));
 	memory_arena Arena =
 	{
-		.Capacity = Capacity,
+		.Capacity = AlignUp(Capacity, ARENA_COMMIT_SIZE),
+		.Committed = 0,
 		.Allocated = 0,
-		.Start = (u8*)calloc(Capacity, 1),
+		.HighWater = 0,
+		.Start = 0,
 		.Alignment = Alignment,
 		.TempCount = 0,
+		.HugePages = HugePages,
 	};
 	
-	if(!Arena.Start)
+	// Over-reserve by one chunk so the start can be aligned for huge pages. Explicit huge pages
+	// are only mapped in as chunks are committed, so they come out of the pool as they are used.
+	s64 ReserveSize = Arena.Capacity + ARENA_COMMIT_SIZE;
+	void* Reserved = mmap(0, ReserveSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (Reserved == MAP_FAILED)
 	{
 		fprintf(stderr, "Fatal Error: Ran out of memory attempting to create an arena for %ld bytes.\n", Capacity);
 		exit(1);
 	}
 	
+	u8* AlignedStart = (u8*)AlignUp((s64)Reserved, ARENA_COMMIT_SIZE);
+	s64 Before = AlignedStart - (u8*)Reserved;
+	if (Before > 0)
+	{
+		munmap(Reserved, Before);
+	}
+	if (ARENA_COMMIT_SIZE - Before > 0)
+	{
+		munmap(AlignedStart + Arena.Capacity, ARENA_COMMIT_SIZE - Before);
+	}
+	Arena.Start = AlignedStart;
+	
+	if (Arena.HugePages == HugePages_Transparent && madvise(Arena.Start, Arena.Capacity, MADV_HUGEPAGE) != 0)
+	{
+		fprintf(stderr, "Warning: Transparent huge pages are not available for this arena.\n");
+		Arena.HugePages = HugePages_None;
+	}
+	
 	return Arena;
 }
 
+function void
+CommitArena(memory_arena* Arena, s64 Size)
+{
+	s64 NewCommitted = AlignUp(Size, ARENA_COMMIT_SIZE);
+	if (NewCommitted > Arena->Capacity)
+	{
+		NewCommitted = Arena->Capacity;
+	}
+	if (Arena->HugePages == HugePages_Explicit)
+	{
+		// Each chunk is mapped over the reservation from the hugetlb pool. Chunks the pool has no room
+		// for get ordinary pages, so running out of huge pages only slows the arena down.
+		for (s64 Chunk = Arena->Committed; Chunk < NewCommitted; Chunk += ARENA_COMMIT_SIZE)
+		{
+			void* Mapped = mmap(Arena->Start + Chunk, ARENA_COMMIT_SIZE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+			if (Mapped == MAP_FAILED)
+			{
+				if (!__atomic_exchange_n(&ExplicitHugePagesExhausted, true, __ATOMIC_RELAXED))
+				{
+					fprintf(stderr, "Warning: The explicit huge page pool is used up, committing ordinary pages instead.\n");
+				}
+				Mapped = mmap(Arena->Start + Chunk, ARENA_COMMIT_SIZE, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+			}
+			if (Mapped == MAP_FAILED)
+			{
+				fprintf(stderr, "Fatal Error: Ran out of memory attempting to commit %ld bytes.\n", NewCommitted - Arena->Committed);
+				exit(1);
+			}
+		}
+	}
+	else if (mprotect(Arena->Start + Arena->Committed, NewCommitted - Arena->Committed, PROT_READ | PROT_WRITE) != 0)
+	{
+		fprintf(stderr, "Fatal Error: Ran out of memory attempting to commit %ld bytes.\n", NewCommitted - Arena->Committed);
+		exit(1);
+	}
+	Arena->Committed = NewCommitted;
+}
+
+function void
+ResetArena(memory_arena* Arena)
+{
+	assert(Arena->TempCount == 0);
+	Arena->Allocated = 0;
+}
+
 function void
 SetAlignment(memory_arena* Arena, s64 Alignment)
 {
@@ -65,6 +161,14 @@ PushSize(memory_arena* Arena, s64 Size)
 		exit(1);
 	}
 	Arena->Allocated = NewAllocStart + Size - Arena->Start;
+	if (Arena->Allocated > Arena->HighWater)
+	{
+		Arena->HighWater = Arena->Allocated;
+	}
+	if (Arena->Allocated > Arena->Committed)
+	{
+		CommitArena(Arena, Arena->Allocated);
+	}
 	
 	return NewAllocStart;
 }
@@ -91,6 +195,18 @@ PushCopyArray_(memory_arena* Arena, s64 Count, s64 ElemSize, u8* SourceArray)
 	return NewAllocStart;
 }
 
+// Carves a fixed block out of Arena that another thread can allocate from without touching Arena
+function memory_arena
+SubArena(memory_arena* Arena, s64 Capacity, s64 Alignment)
+{
+	memory_arena Result = {};
+	Result.Start = (u8*)PushSize(Arena, Capacity);
+	Result.Capacity = Capacity;
+	Result.Committed = Capacity;
+	Result.Alignment = Alignment;
+	return Result;
+}
+
 function temporary_memory
 BeginTemporaryMemory(memory_arena* Arena)
 {
@@ -117,3 +233,41 @@ KeepTemporaryMemory(temporary_memory Temp)
 	--Temp.Arena->TempCount;
 	assert(Temp.TempCount == Temp.Arena->TempCount);
 }
+
+// Each worker thread gets its own arena so it can allocate without locking. Every
+// arena struct sits on its own cache line so threads never write to a shared line,
+// and since pages are only touched by the thread that uses them, they end up local
+// to that thread's NUMA node.
+#define CACHE_LINE_SIZE 64
+
+typedef struct thread_arena
+{
+	memory_arena Arena;
+	u8 Padding[CACHE_LINE_SIZE - sizeof(memory_arena) % CACHE_LINE_SIZE];
+} thread_arena;
+
+typedef struct thread_arenas
+{
+	s32 Count;
+	thread_arena* Threads;
+} thread_arenas;
+
+function thread_arenas
+MakeThreadArenas(memory_arena* Arena, s32 Count, s64 Capacity, s32 HugePages = HugePages_None)
+{
+	assert(Count > 0);
+	s64 OldAlignment = Arena->Alignment;
+	SetAlignment(Arena, CACHE_LINE_SIZE);
+	thread_arenas ThreadArenas =
+	{
+		.Count = Count,
+		.Threads = PushArray(Arena, Count, thread_arena),
+	};
+	SetAlignment(Arena, OldAlignment);
+	
+	for (s32 Index = 0; Index < Count; ++Index)
+	{
+		ThreadArenas.Threads[Index].Arena = MakeArena(Capacity, CACHE_LINE_SIZE, HugePages);
+	}
+	return ThreadArenas;
+}
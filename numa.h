@@ -0,0 +1,160 @@
+/*
+ * numa.h
+ *
+ * NUMA node queries, per-node copies of read-mostly scene data, and reports of where pages ended up
+ */
+
+#define MAX_NUMA_NODES 64
+#define NUMA_REPORT_SAMPLES 1024
+
+function s32
+GetNumaNodeCount()
+{
+	s32 Result = 0;
+	DIR* NodeDir = opendir("/sys/devices/system/node");
+	if (NodeDir)
+	{
+		struct dirent* Entry;
+		while ((Entry = readdir(NodeDir)))
+		{
+			const char* Name = Entry->d_name;
+			if (Name[0] == 'n' && Name[1] == 'o' && Name[2] == 'd' && Name[3] == 'e' &&
+				Name[4] >= '0' && Name[4] <= '9')
+			{
+				s32 Node = (s32)strtol(Name + 4, 0, 10);
+				if (Node + 1 > Result)
+				{
+					Result = Node + 1;
+				}
+			}
+		}
+		closedir(NodeDir);
+	}
+	
+	if (Result < 1)
+	{
+		Result = 1;
+	}
+	else if (Result > MAX_NUMA_NODES)
+	{
+		Result = MAX_NUMA_NODES;
+	}
+	return Result;
+}
+
+function s32
+GetCurrentNumaNode()
+{
+	unsigned int CPU = 0;
+	unsigned int Node = 0;
+	if (syscall(SYS_getcpu, &CPU, &Node, 0) != 0)
+	{
+		Node = 0;
+	}
+	return (s32)Node;
+}
+
+// Copies of the top-level objects, materials and spatial partition, one per NUMA node, each first
+// touched by a thread running on that node. Groups, instances and textures stay shared.
+// The copies are made by ReplicateScene in spatialpartition.h.
+typedef struct numa_replicas
+{
+	s32 NodeCount;
+	memory_arena* NodeArenas;
+	b32 Built[MAX_NUMA_NODES];
+	scene Scenes[MAX_NUMA_NODES];
+	struct spatial_partition* Partitions[MAX_NUMA_NODES];
+} numa_replicas;
+
+function numa_replicas*
+MakeNumaReplicas(memory_arena* Arena, s64 CapacityPerNode, s32 HugePages)
+{
+	numa_replicas* Replicas = PushStruct(Arena, numa_replicas);
+	*Replicas = {};
+	Replicas->NodeCount = GetNumaNodeCount();
+	Replicas->NodeArenas = PushArray(Arena, Replicas->NodeCount, memory_arena);
+	for (s32 Node = 0; Node < Replicas->NodeCount; ++Node)
+	{
+		Replicas->NodeArenas[Node] = MakeArena(CapacityPerNode, 16, HugePages);
+	}
+	return Replicas;
+}
+
+// Picks the copies for the node the calling thread runs on, or leaves the shared ones in place
+function void
+GetNumaReplica(numa_replicas* Replicas, scene** Scene, struct spatial_partition** Partition)
+{
+	if (Replicas)
+	{
+		s32 Node = GetCurrentNumaNode();
+		if (Node < Replicas->NodeCount && Replicas->Built[Node])
+		{
+			*Scene = Replicas->Scenes + Node;
+			if (Partition && Replicas->Partitions[Node])
+			{
+				*Partition = Replicas->Partitions[Node];
+			}
+		}
+	}
+}
+
+function void
+ReportNumaPlacement(const char* Name, void* Start, s64 Size)
+{
+	f64 Megabytes = (f64)Size / (1024.0*1024.0);
+	if (Size > 0)
+	{
+		s64 PageSize = sysconf(_SC_PAGESIZE);
+		u8* FirstPage = (u8*)(((s64)Start / PageSize) * PageSize);
+		s64 PageCount = ((u8*)Start + Size - FirstPage + PageSize - 1) / PageSize;
+		
+		// Sample evenly spaced pages so huge allocations stay cheap to report
+		s64 SampleCount = PageCount < NUMA_REPORT_SAMPLES ? PageCount : NUMA_REPORT_SAMPLES;
+		void* Pages[NUMA_REPORT_SAMPLES];
+		int Status[NUMA_REPORT_SAMPLES];
+		for (s64 Index = 0; Index < SampleCount; ++Index)
+		{
+			Pages[Index] = FirstPage + (Index * PageCount / SampleCount) * PageSize;
+		}
+		
+		// With no target nodes, move_pages only reports the node each page is on
+		if (syscall(SYS_move_pages, 0, (unsigned long)SampleCount, Pages, 0, Status, 0) == 0)
+		{
+			s64 NodeCounts[MAX_NUMA_NODES] = {};
+			s64 NotResident = 0;
+			for (s64 Index = 0; Index < SampleCount; ++Index)
+			{
+				if (Status[Index] >= 0 && Status[Index] < MAX_NUMA_NODES)
+				{
+					++NodeCounts[Status[Index]];
+				}
+				else
+				{
+					++NotResident;
+				}
+			}
+			
+			printf("\t%s: %.2f MB,", Name, Megabytes);
+			for (s32 Node = 0; Node < MAX_NUMA_NODES; ++Node)
+			{
+				if (NodeCounts[Node])
+				{
+					printf(" node%d %.1f%%", Node, 100.0*(f64)NodeCounts[Node] / (f64)SampleCount);
+				}
+			}
+			if (NotResident)
+			{
+				printf(" not resident %.1f%%", 100.0*(f64)NotResident / (f64)SampleCount);
+			}
+			printf("\n");
+		}
+		else
+		{
+			printf("\t%s: %.2f MB, page placement unavailable\n", Name, Megabytes);
+		}
+	}
+	else
+	{
+		printf("\t%s: empty\n", Name);
+	}
+}
\ No newline at end of file
@@ -45,6 +45,35 @@ enum token_type
 	Token_UVMap,
 	Token_LookAt,
 	Token_SkyColor,
+	Token_Group,
+	Token_Instance,
+	Token_Name,
+	Token_Scale,
+	Token_Repeat,
+	Token_Count,
+	Token_Offset,
+	Token_Material,
+	Token_Bench,
+	Token_Scenes,
+	Token_Resolution,
+	Token_Samples,
+	Token_Bounces,
+	Token_Threads,
+	Token_SpatialPartition,
+	Token_ObjectsPerLeaf,
+	Token_LeafDepth,
+	Token_WarmUp,
+	Token_Results,
+	Token_Baseline,
+	Token_Case,
+	Token_Scene,
+	Token_Reference,
+	Token_Rays,
+	Token_Load,
+	Token_Build,
+	Token_Render,
+	Token_Tolerance,
+	Token_PSNR,
 	
 	Token_EOF,
 };
@@ -100,6 +129,35 @@ global keyword_def KeywordDefs[] =
 	KEYWORD(UVMap),
 	KEYWORD(LookAt),
 	KEYWORD(SkyColor),
+	KEYWORD(Group),
+	KEYWORD(Instance),
+	KEYWORD(Name),
+	KEYWORD(Scale),
+	KEYWORD(Repeat),
+	KEYWORD(Count),
+	KEYWORD(Offset),
+	KEYWORD(Material),
+	KEYWORD(Bench),
+	KEYWORD(Scenes),
+	KEYWORD(Resolution),
+	KEYWORD(Samples),
+	KEYWORD(Bounces),
+	KEYWORD(Threads),
+	KEYWORD(SpatialPartition),
+	KEYWORD(ObjectsPerLeaf),
+	KEYWORD(LeafDepth),
+	KEYWORD(WarmUp),
+	KEYWORD(Results),
+	KEYWORD(Baseline),
+	KEYWORD(Case),
+	KEYWORD(Scene),
+	KEYWORD(Reference),
+	KEYWORD(Rays),
+	KEYWORD(Load),
+	KEYWORD(Build),
+	KEYWORD(Render),
+	KEYWORD(Tolerance),
+	KEYWORD(PSNR),
 };
 #undef KEYWORD
 
@@ -397,7 +455,10 @@ ExpectToken(tokenizer* Tokenizer, token_type Type)
 {
 	token Token = NextToken(Tokenizer);
 	b32 Success = Token.Type == Type;
-	Tokenizer->Error = !Success;
+	if (!Success)
+	{
+		Tokenizer->Error = true; // Errors stick, so a later match cannot hide an earlier mistake
+	}
 	return Success;
 }
 
@@ -424,8 +485,113 @@ ParseNumber(tokenizer* Tokenizer)
 	return Result;
 }
 	
+// Deduplicates materials while a scene is parsed. Materials are zero initialized before their
+// properties are read, so equal materials are equal byte for byte and can be hashed that way.
+typedef struct named_material
+{
+	string Name;
+	u32 Material;
+} named_material;
+
+typedef struct material_table
+{
+	s32 MaxCount;
+	u32 SlotMask;
+	s32* Slots; // One past the material's index, or 0 for an empty slot
+	s32 NameCount;
+	named_material* Names;
+} material_table;
+
+function material_table*
+MakeMaterialTable(s32 MaxCount, memory_arena* Arena)
+{
+	material_table* Table = PushStruct(Arena, material_table);
+	*Table = {};
+	Table->MaxCount = MaxCount;
+	u32 SlotCount = 1;
+	while (SlotCount < 2*(u32)MaxCount)
+	{
+		SlotCount *= 2;
+	}
+	Table->SlotMask = SlotCount - 1;
+	Table->Slots = PushArray(Arena, SlotCount, s32);
+	for (u32 Slot = 0; Slot < SlotCount; ++Slot)
+	{
+		Table->Slots[Slot] = 0;
+	}
+	Table->Names = PushArray(Arena, MaxCount, named_material);
+	return Table;
+}
+
+function u32
+HashMaterial(material* Material)
+{
+	// FNV-1a
+	u8* Bytes = (u8*)Material;
+	u32 Hash = 2166136261u;
+	for (u64 Index = 0; Index < sizeof(material); ++Index)
+	{
+		Hash = (Hash ^ Bytes[Index])*16777619u;
+	}
+	return Hash;
+}
+
+function b32
+MaterialsMatch(material* A, material* B)
+{
+	b32 Result = true;
+	u8* BytesA = (u8*)A;
+	u8* BytesB = (u8*)B;
+	for (u64 Index = 0; Index < sizeof(material); ++Index)
+	{
+		if (BytesA[Index] != BytesB[Index])
+		{
+			Result = false;
+			break;
+		}
+	}
+	return Result;
+}
+
+// Returns the index of an equal material in the scene's table, adding it if there is none yet
+function u32
+AddMaterial(scene* DestScene, material* Material)
+{
+	material_table* Table = DestScene->MaterialTable;
+	u32 Slot = HashMaterial(Material) & Table->SlotMask;
+	while (Table->Slots[Slot] && !MaterialsMatch(DestScene->Materials + Table->Slots[Slot] - 1, Material))
+	{
+		Slot = (Slot + 1) & Table->SlotMask;
+	}
+	
+	if (!Table->Slots[Slot])
+	{
+		assert(DestScene->MaterialCount < Table->MaxCount);
+		DestScene->Materials[DestScene->MaterialCount] = *Material;
+		Table->Slots[Slot] = ++DestScene->MaterialCount;
+	}
+	u32 Result = (u32)(Table->Slots[Slot] - 1);
+	return Result;
+}
+
+function material*
+FindNamedMaterial(scene* DestScene, string Name)
+{
+	material* Result = 0;
+	material_table* Table = DestScene->MaterialTable;
+	for (s32 Index = 0; Index < Table->NameCount; ++Index)
+	{
+		if (StringsMatch(Table->Names[Index].Name, Name))
+		{
+			Result = DestScene->Materials + Table->Names[Index].Material;
+			break;
+		}
+	}
+	return Result;
+}
+
 function void
-ParseObjectProperties(tokenizer* Tokenizer, object* Object, scene* DestScene)
+ParseMaterialProperties(tokenizer* Tokenizer, material* Material, scene* DestScene)
 {
 	ExpectToken(Tokenizer, Token_LeftBrace);
 	if (Tokenizer->Error)
@@ -439,6 +605,7 @@ ParseObjectProperties(tokenizer* Tokenizer, object* Object, scene* DestScene)
 	b32 ReadRefraction = false;
 	b32 ReadTexture = false;
 	b32 ReadUVMap = false;
+	material* Base = 0;
 	
 	while (!Tokenizer->Error)
 	{
@@ -467,9 +634,9 @@ ParseObjectProperties(tokenizer* Tokenizer, object* Object, scene* DestScene)
 				}
 				else
 				{
-					Object->Color.R = R;
-					Object->Color.G = G;
-					Object->Color.B = B;
+					Material->Color.R = R;
+					Material->Color.G = G;
+					Material->Color.B = B;
 				}
 				Token = NextToken(Tokenizer);
 				if (Token.Type == Token_RightBrace)
@@ -502,7 +669,7 @@ ParseObjectProperties(tokenizer* Tokenizer, object* Object, scene* DestScene)
 				}
 				else
 				{
-					Object->Glossy = Glossy;
+					Material->Glossy = Glossy;
 				}
 				Token = NextToken(Tokenizer);
 				if (Token.Type == Token_RightBrace)
@@ -535,7 +702,7 @@ ParseObjectProperties(tokenizer* Tokenizer, object* Object, scene* DestScene)
 				}
 				else
 				{
-					Object->Translucency = Translucency;
+					Material->Translucency = Translucency;
 				}
 				Token = NextToken(Tokenizer);
 				if (Token.Type == Token_RightBrace)
@@ -568,7 +735,7 @@ ParseObjectProperties(tokenizer* Tokenizer, object* Object, scene* DestScene)
 				}
 				else
 				{
-					Object->Refraction = Refraction;
+					Material->Refraction = Refraction;
 				}
 				Token = NextToken(Tokenizer);
 				if (Token.Type == Token_RightBrace)
@@ -605,14 +772,14 @@ ParseObjectProperties(tokenizer* Tokenizer, object* Object, scene* DestScene)
 					Tokenizer->Error = true;
 					fprintf(stderr, "(%d, %d): Invalid texture index: '%f'\n", Tokenizer->CurrentToken.Line, Tokenizer->CurrentToken.Column, IndexF);
 				}
-				else if (DestScene->Textures[Index - 1].Pixels == 0)
+				else if (DestScene->Textures[Index - 1].Texels == 0)
 				{
 					Tokenizer->Error = true;
 					fprintf(stderr, "(%d, %d): Texture index not found in texture table: '%d'\n", Tokenizer->CurrentToken.Line, Tokenizer->CurrentToken.Column, Index);
 				}
 				else
 				{
-					Object->Texture.Index = Index;
+					Material->Texture.Index = Index;
 				}
 				Token = NextToken(Tokenizer);
 				if (Token.Type == Token_RightBrace)
@@ -663,12 +830,12 @@ ParseObjectProperties(tokenizer* Tokenizer, object* Object, scene* DestScene)
 				}
 				else
 				{
-					Object->UVMap.VertexUV[0].U = U0;
-					Object->UVMap.VertexUV[0].V = V0;
-					Object->UVMap.VertexUV[1].U = U1;
-					Object->UVMap.VertexUV[1].V = V1;
-					Object->UVMap.VertexUV[2].U = U2;
-					Object->UVMap.VertexUV[2].V = V2;
+					Material->UVMap.VertexUV[0].U = U0;
+					Material->UVMap.VertexUV[0].V = V0;
+					Material->UVMap.VertexUV[1].U = U1;
+					Material->UVMap.VertexUV[1].V = V1;
+					Material->UVMap.VertexUV[2].U = U2;
+					Material->UVMap.VertexUV[2].V = V2;
 				}
 				Token = NextToken(Tokenizer);
 				if (Token.Type == Token_RightBrace)
@@ -687,12 +854,174 @@ ParseObjectProperties(tokenizer* Tokenizer, object* Object, scene* DestScene)
 				fprintf(stderr, "(%d, %d): Extra uv map in object properties declaration\n", Token.Line, Token.Column);
 			}
 		}
+		else if (Token.Type == Token_Material)
+		{
+			if (!Base)
+			{
+				ExpectToken(Tokenizer, Token_Equals);
+				ExpectToken(Tokenizer, Token_String);
+				
+				if (Tokenizer->Error)
+				{
+					fprintf(stderr, "(%d, %d): Invalid material name declaration\n", Token.Line, Token.Column);
+				}
+				else
+				{
+					Base = FindNamedMaterial(DestScene, Tokenizer->CurrentToken.String);
+					if (!Base)
+					{
+						Tokenizer->Error = true;
+						fprintf(stderr, "(%d, %d): Material not found: '%.*s'\n", Token.Line, Token.Column, PrintString(Tokenizer->CurrentToken.String));
+					}
+				}
+				Token = NextToken(Tokenizer);
+				if (Token.Type == Token_RightBrace)
+				{
+					break;
+				}
+				else if (Token.Type != Token_Comma)
+				{
+					Tokenizer->Error = true;
+					fprintf(stderr, "(%d, %d): Invalid token in object properties declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+				}
+			}
+			else
+			{
+				Tokenizer->Error = true;
+				fprintf(stderr, "(%d, %d): Extra material in object properties declaration\n", Token.Line, Token.Column);
+			}
+		}
 		else
 		{
 			Tokenizer->Error = true;
 			fprintf(stderr, "(%d, %d): Invalid token in object properties declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
 		}
 	}
+	
+	// Anything not given here comes from the named material
+	if (Base && !Tokenizer->Error)
+	{
+		if (!ReadColor)
+		{
+			Material->Color = Base->Color;
+		}
+		if (!ReadGlossy)
+		{
+			Material->Glossy = Base->Glossy;
+		}
+		if (!ReadTranslucency)
+		{
+			Material->Translucency = Base->Translucency;
+		}
+		if (!ReadRefraction)
+		{
+			Material->Refraction = Base->Refraction;
+		}
+		if (!ReadTexture)
+		{
+			Material->Texture = Base->Texture;
+		}
+		if (!ReadUVMap)
+		{
+			Material->UVMap = Base->UVMap;
+		}
+	}
+}
+
+function void
+ParseObjectProperties(tokenizer* Tokenizer, object* Object, scene* DestScene)
+{
+	material Material = {};
+	ParseMaterialProperties(Tokenizer, &Material, DestScene);
+	if (!Tokenizer->Error)
+	{
+		Object->Material = AddMaterial(DestScene, &Material);
+	}
+}
+
+// Material (Name = "name") { properties }, for objects to refer to with Material = "name"
+function void
+ParseMaterialDecl(tokenizer* Tokenizer, scene* DestScene)
+{
+	ExpectToken(Tokenizer, Token_LeftParen);
+	if (Tokenizer->Error)
+	{
+		fprintf(stderr, "(%d, %d): Invalid material declaration. Expected '(', got '%.*s'\n", Tokenizer->CurrentToken.Line, Tokenizer->CurrentToken.Column, PrintString(Tokenizer->CurrentToken.String));
+	}
+	
+	string Name = {};
+	b32 ReadName = false;
+	
+	while (!Tokenizer->Error)
+	{
+		token Token = NextToken(Tokenizer);
+		if (Token.Type == Token_RightParen)
+		{
+			break;
+		}
+		else if (Token.Type == Token_Name)
+		{
+			if (!ReadName)
+			{
+				ReadName = true;
+				ExpectToken(Tokenizer, Token_Equals);
+				ExpectToken(Tokenizer, Token_String);
+				
+				if (Tokenizer->Error)
+				{
+					fprintf(stderr, "(%d, %d): Invalid material name declaration\n", Token.Line, Token.Column);
+				}
+				else if (FindNamedMaterial(DestScene, Tokenizer->CurrentToken.String))
+				{
+					Tokenizer->Error = true;
+					fprintf(stderr, "(%d, %d): Material name already in use: '%.*s'\n", Token.Line, Token.Column, PrintString(Tokenizer->CurrentToken.String));
+				}
+				else
+				{
+					Name = Tokenizer->CurrentToken.String;
+				}
+				Token = NextToken(Tokenizer);
+				if (Token.Type == Token_RightParen)
+				{
+					break;
+				}
+				else if (Token.Type != Token_Comma)
+				{
+					Tokenizer->Error = true;
+					fprintf(stderr, "(%d, %d): Invalid token in material declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+				}
+			}
+			else
+			{
+				Tokenizer->Error = true;
+				fprintf(stderr, "(%d, %d): Extra name in material declaration\n", Token.Line, Token.Column);
+			}
+		}
+		else
+		{
+			Tokenizer->Error = true;
+			fprintf(stderr, "(%d, %d): Invalid token in material declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+		}
+	}
+	
+	if (!Tokenizer->Error && !ReadName)
+	{
+		Tokenizer->Error = true;
+		fprintf(stderr, "(%d, %d): Material declaration is missing a name\n", Tokenizer->CurrentToken.Line, Tokenizer->CurrentToken.Column);
+	}
+	
+	if (!Tokenizer->Error)
+	{
+		material Material = {};
+		ParseMaterialProperties(Tokenizer, &Material, DestScene);
+		if (!Tokenizer->Error)
+		{
+			material_table* Table = DestScene->MaterialTable;
+			named_material* Named = Table->Names + Table->NameCount++;
+			Named->Name = Name;
+			Named->Material = AddMaterial(DestScene, &Material);
+		}
+	}
 }
 
 function void
@@ -1442,84 +1771,876 @@ ParseCameraDecl(tokenizer* Tokenizer, scene* DestScene, memory_arena* Arena)
 	}
 }
 
+function u32
+AddInstance(scene* DestScene, instance Instance, memory_arena* ScratchArena)
+{
+	// Instances collect in scratch while parsing and are moved into the scene by FinalizeInstances
+	instance* DestInstance = PushStruct(ScratchArena, instance); // Lengthen Array
+	*DestInstance = Instance;
+	u32 Result = (u32)DestScene->InstanceCount++;
+	return Result;
+}
+
+function void ParseInstanceDecl(tokenizer* Tokenizer, scene* DestScene, memory_arena* Arena, memory_arena* ScratchArena);
+
 function void
-LoadTextures(tokenizer* Tokenizer, scene* DestScene, memory_arena* Arena)
+ParseRepeatDecl(tokenizer* Tokenizer, scene* DestScene, memory_arena* Arena, memory_arena* ScratchArena, b32 InGroup)
 {
-	s32 TextureCount = 0;
-	ExpectToken(Tokenizer, Token_LeftBrace);
-	tokenizer FirstPassTok = *Tokenizer;
-	tokenizer* FirstPass = &FirstPassTok;
-	while (HasMoreTokens(FirstPass) && !FirstPass->Error)
+	ExpectToken(Tokenizer, Token_LeftParen);
+	if (Tokenizer->Error)
 	{
-		token Token = NextToken(FirstPass);
-		if (Token.Type == Token_RightBrace)
+		fprintf(stderr, "(%d, %d): Invalid repeat declaration. Expected '(', got '%.*s'\n", Tokenizer->CurrentToken.Line, Tokenizer->CurrentToken.Column, PrintString(Tokenizer->CurrentToken.String));
+	}
+	
+	s32 Counts[3] = {1, 1, 1};
+	v3 Offsets[3] = {};
+	s32 CountDimensions = 0;
+	s32 OffsetDimensions = 0;
+	
+	while (!Tokenizer->Error)
+	{
+		token Token = NextToken(Tokenizer);
+		if (Token.Type == Token_RightParen)
 		{
 			break;
 		}
-		else if (Token.Type == Token_Number)
+		else if (Token.Type == Token_Count)
 		{
-			s32 Index = (s32)Token.Value;
-			if ((f32)Index != Token.Value)
-			{
-				FirstPass->Error = true;
-				fprintf(stderr, "(%d, %d): Texture index not an integer: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
-			}
-			else if (Index >= 1)
+			if (CountDimensions == 0)
 			{
-				ExpectToken(FirstPass, Token_Equals);
-				Token = NextToken(FirstPass);
-				if (Token.Type != Token_String)
+				ExpectToken(Tokenizer, Token_Equals);
+				// Either a single count or a tuple of up to three counts for a grid
+				tokenizer Peek = *Tokenizer;
+				b32 IsTuple = (NextToken(&Peek).Type == Token_LeftParen);
+				if (IsTuple)
 				{
-					FirstPass->Error = true;
-					fprintf(stderr, "(%d, %d): Invalid token in texture declaration. Expected string, got '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+					NextToken(Tokenizer);
 				}
-				
-				if (!FirstPass->Error)
+				do
 				{
-					if (Index > TextureCount)
+					if (CountDimensions >= 3)
 					{
-						TextureCount = Index;
+						Tokenizer->Error = true;
+						break;
 					}
-					Token = NextToken(FirstPass);
-					if (Token.Type == Token_RightBrace)
+					f32 CountF = ParseNumber(Tokenizer);
+					s32 Count = (s32)CountF;
+					if ((f32)Count != CountF || Count < 1)
+					{
+						Tokenizer->Error = true;
+					}
+					Counts[CountDimensions++] = Count;
+				} while (IsTuple && !Tokenizer->Error && NextToken(Tokenizer).Type == Token_Comma);
+				if (IsTuple && !Tokenizer->Error && Tokenizer->CurrentToken.Type != Token_RightParen)
+				{
+					Tokenizer->Error = true;
+				}
+				
+				if (Tokenizer->Error)
+				{
+					fprintf(stderr, "(%d, %d): Invalid repeat count declaration\n", Token.Line, Token.Column);
+				}
+				Token = NextToken(Tokenizer);
+				if (Token.Type == Token_RightParen)
+				{
+					break;
+				}
+				else if (Token.Type != Token_Comma)
+				{
+					Tokenizer->Error = true;
+					fprintf(stderr, "(%d, %d): Invalid token in repeat declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+				}
+			}
+			else
+			{
+				Tokenizer->Error = true;
+				fprintf(stderr, "(%d, %d): Extra count in repeat declaration\n", Token.Line, Token.Column);
+			}
+		}
+		else if (Token.Type == Token_Offset)
+		{
+			if (OffsetDimensions == 0)
+			{
+				ExpectToken(Tokenizer, Token_Equals);
+				ExpectToken(Tokenizer, Token_LeftParen);
+				// Either a single vector or a tuple of vectors, one per count
+				tokenizer Peek = *Tokenizer;
+				b32 IsTuple = (NextToken(&Peek).Type == Token_LeftParen);
+				do
+				{
+					if (OffsetDimensions >= 3)
 					{
+						Tokenizer->Error = true;
 						break;
 					}
-					else if (Token.Type != Token_Comma)
+					if (IsTuple)
 					{
-						FirstPass->Error = true;
-						fprintf(stderr, "(%d, %d): Invalid token in textures declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+						ExpectToken(Tokenizer, Token_LeftParen);
 					}
+					f32 X = ParseNumber(Tokenizer);
+					ExpectToken(Tokenizer, Token_Comma);
+					f32 Y = ParseNumber(Tokenizer);
+					ExpectToken(Tokenizer, Token_Comma);
+					f32 Z = ParseNumber(Tokenizer);
+					ExpectToken(Tokenizer, Token_RightParen);
+					Offsets[OffsetDimensions++] = (v3){X, Y, Z};
+				} while (IsTuple && !Tokenizer->Error && NextToken(Tokenizer).Type == Token_Comma);
+				if (IsTuple && !Tokenizer->Error && Tokenizer->CurrentToken.Type != Token_RightParen)
+				{
+					Tokenizer->Error = true;
+				}
+				
+				if (Tokenizer->Error)
+				{
+					fprintf(stderr, "(%d, %d): Invalid repeat offset declaration\n", Token.Line, Token.Column);
+				}
+				Token = NextToken(Tokenizer);
+				if (Token.Type == Token_RightParen)
+				{
+					break;
+				}
+				else if (Token.Type != Token_Comma)
+				{
+					Tokenizer->Error = true;
+					fprintf(stderr, "(%d, %d): Invalid token in repeat declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
 				}
 			}
 			else
 			{
-				FirstPass->Error = true;
-				fprintf(stderr, "(%d, %d): Texture index out of range: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+				Tokenizer->Error = true;
+				fprintf(stderr, "(%d, %d): Extra offset in repeat declaration\n", Token.Line, Token.Column);
 			}
 		}
 		else
 		{
-			FirstPass->Error = true;
-			fprintf(stderr, "(%d, %d): Invalid token in textures declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+			Tokenizer->Error = true;
+			fprintf(stderr, "(%d, %d): Invalid token in repeat declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
 		}
 	}
 	
-	Tokenizer->Error = FirstPass->Error;
-	
-	if (!Tokenizer->Error)
+	if (!Tokenizer->Error && (CountDimensions == 0 || CountDimensions != OffsetDimensions))
+	{
+		Tokenizer->Error = true;
+		fprintf(stderr, "(%d, %d): Repeat declaration needs one offset for each count\n", Tokenizer->CurrentToken.Line, Tokenizer->CurrentToken.Column);
+	}
+	
+	if (!Tokenizer->Error)
+	{
+		ExpectToken(Tokenizer, Token_LeftBrace);
+		if (Tokenizer->Error)
+		{
+			fprintf(stderr, "(%d, %d): Invalid repeat declaration. Expected '{', got '%.*s'\n", Tokenizer->CurrentToken.Line, Tokenizer->CurrentToken.Column, PrintString(Tokenizer->CurrentToken.String));
+		}
+	}
+	
+	// Parse the body once, then stamp out copies of its objects, so the body is only tokenized once
+	s32 FirstObjectIndex = DestScene->ObjectCount;
+	while (!Tokenizer->Error)
+	{
+		token Token = NextToken(Tokenizer);
+		if (Token.Type == Token_RightBrace)
+		{
+			break;
+		}
+		else if (Token.Type == Token_Plane)
+		{
+			ParsePlaneDecl(Tokenizer, DestScene, Arena);
+		}
+		else if (Token.Type == Token_Sphere)
+		{
+			ParseSphereDecl(Tokenizer, DestScene, Arena);
+		}
+		else if (Token.Type == Token_Triangle)
+		{
+			ParseTriangleDecl(Tokenizer, DestScene, Arena);
+		}
+		else if (Token.Type == Token_Parallelogram)
+		{
+			ParseParallelogramDecl(Tokenizer, DestScene, Arena);
+		}
+		else if (Token.Type == Token_Instance && !InGroup)
+		{
+			ParseInstanceDecl(Tokenizer, DestScene, Arena, ScratchArena);
+		}
+		else if (Token.Type == Token_Repeat)
+		{
+			ParseRepeatDecl(Tokenizer, DestScene, Arena, ScratchArena, InGroup);
+		}
+		else
+		{
+			Tokenizer->Error = true;
+			fprintf(stderr, "(%d, %d): Expected object declaration in repeat, got '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+		}
+	}
+	
+	if (!Tokenizer->Error)
+	{
+		s32 OnePastLastObjectIndex = DestScene->ObjectCount;
+		for (s32 K = 0; K < Counts[2]; ++K)
+		{
+			for (s32 J = 0; J < Counts[1]; ++J)
+			{
+				for (s32 I = 0; I < Counts[0]; ++I)
+				{
+					if (I == 0 && J == 0 && K == 0)
+					{
+						continue; // The body itself
+					}
+					v3 Offset = (f32)I*Offsets[0] + (f32)J*Offsets[1] + (f32)K*Offsets[2];
+					for (s32 Index = FirstObjectIndex; Index < OnePastLastObjectIndex; ++Index)
+					{
+						object Object = DestScene->Objects[Index];
+						if (Object.Type == Obj_Instance)
+						{
+							instance Instance = DestScene->Instances[Object.Instance.Index];
+							Instance.Origin = Instance.Origin + Offset;
+							Object.Instance.Index = AddInstance(DestScene, Instance, ScratchArena);
+						}
+						else
+						{
+							TranslateObject(DestScene, &Object, Offset);
+						}
+						object* DestObject = PushStruct(Arena, object); // Lengthen Array
+						*DestObject = Object;
+						++DestScene->ObjectCount;
+					}
+				}
+			}
+		}
+	}
+}
+
+function object_group*
+FindGroup(scene* DestScene, string Name)
+{
+	object_group* Result = 0;
+	for (s32 Index = 0; Index < DestScene->GroupCount; ++Index)
+	{
+		if (StringsMatch(DestScene->Groups[Index].Name, Name))
+		{
+			Result = DestScene->Groups + Index;
+			break;
+		}
+	}
+	return Result;
+}
+
+function void
+ParseGroupDecl(tokenizer* Tokenizer, scene* DestScene, memory_arena* Arena, memory_arena* ScratchArena)
+{
+	ExpectToken(Tokenizer, Token_LeftParen);
+	if (Tokenizer->Error)
+	{
+		fprintf(stderr, "(%d, %d): Invalid group declaration. Expected '(', got '%.*s'\n", Tokenizer->CurrentToken.Line, Tokenizer->CurrentToken.Column, PrintString(Tokenizer->CurrentToken.String));
+	}
+	
+	string Name = {};
+	b32 ReadName = false;
+	
+	while (!Tokenizer->Error)
+	{
+		token Token = NextToken(Tokenizer);
+		if (Token.Type == Token_RightParen)
+		{
+			break;
+		}
+		else if (Token.Type == Token_Name)
+		{
+			if (!ReadName)
+			{
+				ReadName = true;
+				ExpectToken(Tokenizer, Token_Equals);
+				ExpectToken(Tokenizer, Token_String);
+				
+				if (Tokenizer->Error)
+				{
+					fprintf(stderr, "(%d, %d): Invalid group name declaration\n", Token.Line, Token.Column);
+				}
+				else if (FindGroup(DestScene, Tokenizer->CurrentToken.String))
+				{
+					Tokenizer->Error = true;
+					fprintf(stderr, "(%d, %d): Group name already in use: '%.*s'\n", Token.Line, Token.Column, PrintString(Tokenizer->CurrentToken.String));
+				}
+				else
+				{
+					Name = Tokenizer->CurrentToken.String;
+				}
+				Token = NextToken(Tokenizer);
+				if (Token.Type == Token_RightParen)
+				{
+					break;
+				}
+				else if (Token.Type != Token_Comma)
+				{
+					Tokenizer->Error = true;
+					fprintf(stderr, "(%d, %d): Invalid token in group declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+				}
+			}
+			else
+			{
+				Tokenizer->Error = true;
+				fprintf(stderr, "(%d, %d): Extra name in group declaration\n", Token.Line, Token.Column);
+			}
+		}
+		else
+		{
+			Tokenizer->Error = true;
+			fprintf(stderr, "(%d, %d): Invalid token in group declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+		}
+	}
+	
+	if (!Tokenizer->Error && !ReadName)
+	{
+		Tokenizer->Error = true;
+		fprintf(stderr, "(%d, %d): Group declaration is missing a name\n", Tokenizer->CurrentToken.Line, Tokenizer->CurrentToken.Column);
+	}
+	
+	if (!Tokenizer->Error)
+	{
+		ExpectToken(Tokenizer, Token_LeftBrace);
+		if (Tokenizer->Error)
+		{
+			fprintf(stderr, "(%d, %d): Invalid group declaration. Expected '{', got '%.*s'\n", Tokenizer->CurrentToken.Line, Tokenizer->CurrentToken.Column, PrintString(Tokenizer->CurrentToken.String));
+		}
+	}
+	
+	// Group objects are appended to the scene's object array like any other object, then moved
+	// behind the top level objects by FinalizeGroups once parsing is done
+	s32 FirstObjectIndex = DestScene->ObjectCount;
+	while (!Tokenizer->Error)
+	{
+		token Token = NextToken(Tokenizer);
+		if (Token.Type == Token_RightBrace)
+		{
+			break;
+		}
+		else if (Token.Type == Token_Plane)
+		{
+			ParsePlaneDecl(Tokenizer, DestScene, Arena);
+		}
+		else if (Token.Type == Token_Sphere)
+		{
+			ParseSphereDecl(Tokenizer, DestScene, Arena);
+		}
+		else if (Token.Type == Token_Triangle)
+		{
+			ParseTriangleDecl(Tokenizer, DestScene, Arena);
+		}
+		else if (Token.Type == Token_Parallelogram)
+		{
+			ParseParallelogramDecl(Tokenizer, DestScene, Arena);
+		}
+		else if (Token.Type == Token_Repeat)
+		{
+			ParseRepeatDecl(Tokenizer, DestScene, Arena, ScratchArena, true);
+		}
+		else
+		{
+			Tokenizer->Error = true;
+			fprintf(stderr, "(%d, %d): Expected object declaration in group, got '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+		}
+	}
+	
+	if (!Tokenizer->Error)
+	{
+		object_group* Group = DestScene->Groups + DestScene->GroupCount++;
+		*Group = {};
+		Group->Name = Name;
+		Group->Scene.ObjectCount = DestScene->ObjectCount - FirstObjectIndex;
+		Group->Scene.Objects = DestScene->Objects + FirstObjectIndex;
+		Group->Scene.TextureCount = DestScene->TextureCount;
+		Group->Scene.Textures = DestScene->Textures;
+		Group->Scene.Materials = DestScene->Materials;
+	}
+}
+
+function void
+ParseInstanceDecl(tokenizer* Tokenizer, scene* DestScene, memory_arena* Arena, memory_arena* ScratchArena)
+{
+	ExpectToken(Tokenizer, Token_LeftParen);
+	if (Tokenizer->Error)
+	{
+		fprintf(stderr, "(%d, %d): Invalid instance declaration. Expected '(', got '%.*s'\n", Tokenizer->CurrentToken.Line, Tokenizer->CurrentToken.Column, PrintString(Tokenizer->CurrentToken.String));
+	}
+	
+	object_group* Group = 0;
+	v3 Origin = {0, 0, 0};
+	v3 Axes[3] = {{1.0f, 0, 0}, {0, 1.0f, 0}, {0, 0, 1.0f}};
+	f32 Scale = 1.0f;
+	
+	b32 ReadGroup = false;
+	b32 ReadOrigin = false;
+	b32 ReadAxes = false;
+	b32 ReadScale = false;
+	
+	while (!Tokenizer->Error)
+	{
+		token Token = NextToken(Tokenizer);
+		if (Token.Type == Token_RightParen)
+		{
+			break;
+		}
+		else if (Token.Type == Token_Group)
+		{
+			if (!ReadGroup)
+			{
+				ReadGroup = true;
+				ExpectToken(Tokenizer, Token_Equals);
+				ExpectToken(Tokenizer, Token_String);
+				
+				if (Tokenizer->Error)
+				{
+					fprintf(stderr, "(%d, %d): Invalid instance group declaration\n", Token.Line, Token.Column);
+				}
+				else
+				{
+					Group = FindGroup(DestScene, Tokenizer->CurrentToken.String);
+					if (!Group)
+					{
+						Tokenizer->Error = true;
+						fprintf(stderr, "(%d, %d): Group not found: '%.*s'\n", Token.Line, Token.Column, PrintString(Tokenizer->CurrentToken.String));
+					}
+				}
+				Token = NextToken(Tokenizer);
+				if (Token.Type == Token_RightParen)
+				{
+					break;
+				}
+				else if (Token.Type != Token_Comma)
+				{
+					Tokenizer->Error = true;
+					fprintf(stderr, "(%d, %d): Invalid token in instance declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+				}
+			}
+			else
+			{
+				Tokenizer->Error = true;
+				fprintf(stderr, "(%d, %d): Extra group in instance declaration\n", Token.Line, Token.Column);
+			}
+		}
+		else if (Token.Type == Token_Origin)
+		{
+			if (!ReadOrigin)
+			{
+				ReadOrigin = true;
+				ExpectToken(Tokenizer, Token_Equals);
+				ExpectToken(Tokenizer, Token_LeftParen);
+				f32 X = ParseNumber(Tokenizer);
+				ExpectToken(Tokenizer, Token_Comma);
+				f32 Y = ParseNumber(Tokenizer);
+				ExpectToken(Tokenizer, Token_Comma);
+				f32 Z = ParseNumber(Tokenizer);
+				ExpectToken(Tokenizer, Token_RightParen);
+				
+				if (Tokenizer->Error)
+				{
+					fprintf(stderr, "(%d, %d): Invalid instance origin declaration\n", Token.Line, Token.Column);
+				}
+				else
+				{
+					Origin = (v3){X, Y, Z};
+				}
+				Token = NextToken(Tokenizer);
+				if (Token.Type == Token_RightParen)
+				{
+					break;
+				}
+				else if (Token.Type != Token_Comma)
+				{
+					Tokenizer->Error = true;
+					fprintf(stderr, "(%d, %d): Invalid token in instance declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+				}
+			}
+			else
+			{
+				Tokenizer->Error = true;
+				fprintf(stderr, "(%d, %d): Extra origin in instance declaration\n", Token.Line, Token.Column);
+			}
+		}
+		else if (Token.Type == Token_Axes)
+		{
+			if (!ReadAxes)
+			{
+				ReadAxes = true;
+				ExpectToken(Tokenizer, Token_Equals);
+				ExpectToken(Tokenizer, Token_LeftParen);
+				for (s32 AxisIndex = 0; AxisIndex < 3 && !Tokenizer->Error; ++AxisIndex)
+				{
+					if (AxisIndex > 0)
+					{
+						ExpectToken(Tokenizer, Token_Comma);
+					}
+					ExpectToken(Tokenizer, Token_LeftParen);
+					f32 X = ParseNumber(Tokenizer);
+					ExpectToken(Tokenizer, Token_Comma);
+					f32 Y = ParseNumber(Tokenizer);
+					ExpectToken(Tokenizer, Token_Comma);
+					f32 Z = ParseNumber(Tokenizer);
+					ExpectToken(Tokenizer, Token_RightParen);
+					Axes[AxisIndex] = (v3){X, Y, Z};
+				}
+				ExpectToken(Tokenizer, Token_RightParen);
+				
+				if (Tokenizer->Error)
+				{
+					fprintf(stderr, "(%d, %d): Invalid instance axes declaration\n", Token.Line, Token.Column);
+				}
+				Token = NextToken(Tokenizer);
+				if (Token.Type == Token_RightParen)
+				{
+					break;
+				}
+				else if (Token.Type != Token_Comma)
+				{
+					Tokenizer->Error = true;
+					fprintf(stderr, "(%d, %d): Invalid token in instance declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+				}
+			}
+			else
+			{
+				Tokenizer->Error = true;
+				fprintf(stderr, "(%d, %d): Extra axes in instance declaration\n", Token.Line, Token.Column);
+			}
+		}
+		else if (Token.Type == Token_Scale)
+		{
+			if (!ReadScale)
+			{
+				ReadScale = true;
+				ExpectToken(Tokenizer, Token_Equals);
+				Scale = ParseNumber(Tokenizer);
+				
+				if (Tokenizer->Error)
+				{
+					fprintf(stderr, "(%d, %d): Invalid instance scale declaration\n", Token.Line, Token.Column);
+				}
+				Token = NextToken(Tokenizer);
+				if (Token.Type == Token_RightParen)
+				{
+					break;
+				}
+				else if (Token.Type != Token_Comma)
+				{
+					Tokenizer->Error = true;
+					fprintf(stderr, "(%d, %d): Invalid token in instance declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+				}
+			}
+			else
+			{
+				Tokenizer->Error = true;
+				fprintf(stderr, "(%d, %d): Extra scale in instance declaration\n", Token.Line, Token.Column);
+			}
+		}
+		else
+		{
+			Tokenizer->Error = true;
+			fprintf(stderr, "(%d, %d): Invalid token in instance declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+		}
+	}
+	
+	if (!Tokenizer->Error && !Group)
+	{
+		Tokenizer->Error = true;
+		fprintf(stderr, "(%d, %d): Instance declaration is missing a group\n", Tokenizer->CurrentToken.Line, Tokenizer->CurrentToken.Column);
+	}
+	
+	if (!Tokenizer->Error)
+	{
+		instance Instance = {};
+		Instance.Group = Group;
+		Instance.Origin = Origin;
+		Instance.Axis[0] = Scale*Axes[0];
+		Instance.Axis[1] = Scale*Axes[1];
+		Instance.Axis[2] = Scale*Axes[2];
+		
+		// Inverse of the matrix whose columns are the axes
+		f32 Determinant = Dot(Instance.Axis[0], Cross(Instance.Axis[1], Instance.Axis[2]));
+		if (Abs(Determinant) > EPSILON*EPSILON)
+		{
+			Instance.InvAxis[0] = Cross(Instance.Axis[1], Instance.Axis[2]) / Determinant;
+			Instance.InvAxis[1] = Cross(Instance.Axis[2], Instance.Axis[0]) / Determinant;
+			Instance.InvAxis[2] = Cross(Instance.Axis[0], Instance.Axis[1]) / Determinant;
+			
+			object Object = {};
+			Object.Type = Obj_Instance;
+			Object.Instance.Index = AddInstance(DestScene, Instance, ScratchArena);
+			object* DestObject = PushStruct(Arena, object); // Lengthen Array
+			*DestObject = Object;
+			++DestScene->ObjectCount;
+		}
+		else
+		{
+			Tokenizer->Error = true;
+			fprintf(stderr, "(%d, %d): Instance axes are degenerate\n", Tokenizer->CurrentToken.Line, Tokenizer->CurrentToken.Column);
+		}
+	}
+}
+
+function void
+FinalizeGroups(scene* DestScene, memory_arena* Arena, memory_arena* ScratchArena)
+{
+	// Move the objects of all groups behind the top level objects, so that Objects[0..ObjectCount)
+	// only contains what lives directly in the scene
+	temporary_memory Temp = BeginTemporaryMemory(ScratchArena);
+	s32 TotalObjectCount = DestScene->ObjectCount;
+	object* AllObjects = (object*)PushCopyArray(ScratchArena, TotalObjectCount, DestScene->Objects);
+	
+	s32 ObjectCount = 0;
+	s32 GroupIndex = 0;
+	for (s32 Index = 0; Index < TotalObjectCount;)
+	{
+		if (GroupIndex < DestScene->GroupCount &&
+			DestScene->Groups[GroupIndex].Scene.Objects == DestScene->Objects + Index)
+		{
+			Index += DestScene->Groups[GroupIndex].Scene.ObjectCount;
+			++GroupIndex;
+		}
+		else
+		{
+			DestScene->Objects[ObjectCount++] = AllObjects[Index++];
+		}
+	}
+	
+	s32 GroupObjectCount = ObjectCount;
+	for (GroupIndex = 0; GroupIndex < DestScene->GroupCount; ++GroupIndex)
+	{
+		object_group* Group = DestScene->Groups + GroupIndex;
+		s32 OldIndex = (s32)(Group->Scene.Objects - DestScene->Objects);
+		Group->Scene.Objects = DestScene->Objects + GroupObjectCount;
+		for (s32 Index = 0; Index < Group->Scene.ObjectCount; ++Index)
+		{
+			DestScene->Objects[GroupObjectCount++] = AllObjects[OldIndex + Index];
+		}
+	}
+	DestScene->ObjectCount = ObjectCount;
+	
+	// Groups share the scene's material table, which is only complete now
+	for (GroupIndex = 0; GroupIndex < DestScene->GroupCount; ++GroupIndex)
+	{
+		DestScene->Groups[GroupIndex].Scene.MaterialCount = DestScene->MaterialCount;
+	}
+	
+	// Names still point into the scene file buffer, so give them a home of their own
+	for (GroupIndex = 0; GroupIndex < DestScene->GroupCount; ++GroupIndex)
+	{
+		object_group* Group = DestScene->Groups + GroupIndex;
+		Group->Name.Data = PushCopyArray(Arena, Group->Name.Count, Group->Name.Data);
+	}
+	
+	EndTemporaryMemory(Temp);
+}
+
+function void
+FinalizeInstances(scene* DestScene, memory_arena* Arena)
+{
+	// Move the instances out of scratch memory. Objects refer to them by index, so they need no fixing up.
+	DestScene->Instances = (instance*)PushCopyArray(Arena, DestScene->InstanceCount, DestScene->Instances);
+}
+
+function s64
+GetFileModifiedTime(const char* FileName)
+{
+	s64 Result = 0;
+	struct stat FileStat;
+	if (stat(FileName, &FileStat) == 0)
+	{
+		Result = (s64)FileStat.st_mtim.tv_sec*1000000000ll + (s64)FileStat.st_mtim.tv_nsec;
+	}
+	return Result;
+}
+
+// Keeps decoded textures around between scene loads, so reloading a scene only decodes textures
+// whose paths it has not seen before, or whose files changed since they were decoded
+typedef struct texture_cache_entry
+{
+	string Path;
+	s64 ModifiedTime;
+	texture Texture;
+} texture_cache_entry;
+
+typedef struct texture_cache
+{
+	memory_arena* Arena;
+	s32 EntryCount;
+	s32 MaxEntryCount;
+	texture_cache_entry* Entries;
+} texture_cache;
+
+function texture_cache
+MakeTextureCache(memory_arena* Arena, s32 MaxEntryCount)
+{
+	texture_cache Cache = {};
+	Cache.Arena = Arena;
+	Cache.MaxEntryCount = MaxEntryCount;
+	Cache.Entries = PushArray(Arena, MaxEntryCount, texture_cache_entry);
+	return Cache;
+}
+
+function texture_cache_entry*
+FindCachedTexture(texture_cache* Cache, string Path)
+{
+	texture_cache_entry* Result = 0;
+	if (Cache)
+	{
+		for (s32 Index = 0; Index < Cache->EntryCount; ++Index)
+		{
+			if (StringsMatch(Cache->Entries[Index].Path, Path))
+			{
+				Result = Cache->Entries + Index;
+				break;
+			}
+		}
+	}
+	return Result;
+}
+
+// One distinct texture file of a scene. Loads are planned on the main thread, each with arenas
+// of its own, so the files can then be decoded on all threads at once.
+typedef struct texture_load
+{
+	token Token;
+	s64 ModifiedTime;
+	b32 Decode;
+	b32 StoreInCache;
+	texture_cache_entry* CacheEntry;
+	memory_arena Arena;
+	memory_arena ScratchArena;
+	texture Texture;
+} texture_load;
+
+function void
+PlanTextureLoad(texture_load* Load, texture_cache* Cache, memory_arena* Arena, memory_arena* ScratchArena)
+{
+	const char* FileName = (const char*)Load->Token.String.Data;
+	Load->ModifiedTime = GetFileModifiedTime(FileName);
+	
+	Load->CacheEntry = FindCachedTexture(Cache, Load->Token.String);
+	if (Load->CacheEntry && Load->CacheEntry->ModifiedTime == Load->ModifiedTime)
+	{
+		Load->Texture = Load->CacheEntry->Texture;
+	}
+	else
+	{
+		// Textures replaced in the cache stay allocated, since earlier scenes may still use them.
+		// New entries are claimed now and only match once their texture has loaded.
+		Load->Decode = true;
+		Load->StoreInCache = Cache && (Load->CacheEntry || Cache->EntryCount < Cache->MaxEntryCount);
+		if (Load->StoreInCache && !Load->CacheEntry)
+		{
+			Load->CacheEntry = Cache->Entries + Cache->EntryCount++;
+			Load->CacheEntry->Path.Count = Load->Token.String.Count;
+			Load->CacheEntry->Path.Data = PushCopyArray(Cache->Arena, Load->Token.String.Count, Load->Token.String.Data);
+			Load->CacheEntry->ModifiedTime = -1;
+			Load->CacheEntry->Texture = {};
+		}
+		s64 ArenaSize = 0;
+		s64 ScratchSize = 0;
+		GetTextureLoadSizes(FileName, &ArenaSize, &ScratchSize);
+		Load->Arena = SubArena(Load->StoreInCache ? Cache->Arena : Arena, ArenaSize, 16);
+		Load->ScratchArena = SubArena(ScratchArena, ScratchSize, 16);
+	}
+}
+
+function void
+FinishTextureLoad(texture_load* Load)
+{
+	if (Load->Decode && Load->StoreInCache && Load->Texture.Texels)
+	{
+		Load->CacheEntry->ModifiedTime = Load->ModifiedTime;
+		Load->CacheEntry->Texture = Load->Texture;
+	}
+}
+
+function void
+LoadTextures(tokenizer* Tokenizer, scene* DestScene, memory_arena* Arena, memory_arena* ScratchArena, texture_cache* TextureCache)
+{
+	s32 TextureCount = 0;
+	s32 EntryCount = 0;
+	ExpectToken(Tokenizer, Token_LeftBrace);
+	tokenizer FirstPassTok = *Tokenizer;
+	tokenizer* FirstPass = &FirstPassTok;
+	while (HasMoreTokens(FirstPass) && !FirstPass->Error)
+	{
+		token Token = NextToken(FirstPass);
+		if (Token.Type == Token_RightBrace)
+		{
+			break;
+		}
+		else if (Token.Type == Token_Number)
+		{
+			s32 Index = (s32)Token.Value;
+			if ((f32)Index != Token.Value)
+			{
+				FirstPass->Error = true;
+				fprintf(stderr, "(%d, %d): Texture index not an integer: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+			}
+			else if (Index >= 1)
+			{
+				ExpectToken(FirstPass, Token_Equals);
+				Token = NextToken(FirstPass);
+				if (Token.Type != Token_String)
+				{
+					FirstPass->Error = true;
+					fprintf(stderr, "(%d, %d): Invalid token in texture declaration. Expected string, got '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+				}
+				
+				if (!FirstPass->Error)
+				{
+					if (Index > TextureCount)
+					{
+						TextureCount = Index;
+					}
+					++EntryCount;
+					Token = NextToken(FirstPass);
+					if (Token.Type == Token_RightBrace)
+					{
+						break;
+					}
+					else if (Token.Type != Token_Comma)
+					{
+						FirstPass->Error = true;
+						fprintf(stderr, "(%d, %d): Invalid token in textures declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+					}
+				}
+			}
+			else
+			{
+				FirstPass->Error = true;
+				fprintf(stderr, "(%d, %d): Texture index out of range: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+			}
+		}
+		else
+		{
+			FirstPass->Error = true;
+			fprintf(stderr, "(%d, %d): Invalid token in textures declaration: '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+		}
+	}
+	
+	Tokenizer->Error = FirstPass->Error;
+	
+	if (!Tokenizer->Error)
 	{
 		DestScene->TextureCount = TextureCount;
 		if (TextureCount > 0)
 		{
-			DestScene->Textures = PushArray(Arena, TextureCount, surface);
+			DestScene->Textures = PushArray(Arena, TextureCount, texture);
 			for (s32 Index = 0; Index < TextureCount; ++Index)
 			{
-				DestScene->Textures[Index].Pixels = 0;
+				DestScene->Textures[Index].Texels = 0;
 			}
 		}
 	}
 	
+	// Every index gets the load of the first index that named the same file
+	temporary_memory Temp = BeginTemporaryMemory(ScratchArena);
+	texture_load* Loads = PushArray(ScratchArena, EntryCount, texture_load);
+	s32* LoadForIndex = PushArray(ScratchArena, TextureCount, s32);
+	s32 LoadCount = 0;
+	for (s32 Index = 0; Index < TextureCount; ++Index)
+	{
+		LoadForIndex[Index] = -1;
+	}
+	
 	while (HasMoreTokens(Tokenizer) && !Tokenizer->Error)
 	{
 		token Token = NextToken(Tokenizer);
@@ -1532,12 +2653,17 @@ LoadTextures(tokenizer* Tokenizer, scene* DestScene, memory_arena* Arena)
 			s32 Index = (s32)Token.Value - 1;
 			ExpectToken(Tokenizer, Token_Equals);
 			Token = NextToken(Tokenizer);
-			DestScene->Textures[Index] = LoadTGA((const char*)Token.String.Data, Arena);
-			if (DestScene->Textures[Index].Pixels == 0)
+			s32 LoadIndex = 0;
+			while (LoadIndex < LoadCount && !StringsMatch(Loads[LoadIndex].Token.String, Token.String))
 			{
-				Tokenizer->Error = true;
-				fprintf(stderr, "(%d, %d): Could not load texture from file '%.*s'\n", Token.Line, Token.Column, PrintString(Token.String));
+				++LoadIndex;
+			}
+			if (LoadIndex == LoadCount)
+			{
+				Loads[LoadCount++] = (texture_load){ .Token = Token };
 			}
+			LoadForIndex[Index] = LoadIndex;
+			
 			Token = NextToken(Tokenizer);
 			if (Token.Type == Token_RightBrace)
 			{
@@ -1545,10 +2671,55 @@ LoadTextures(tokenizer* Tokenizer, scene* DestScene, memory_arena* Arena)
 			}
 		}
 	}
+	
+	if (!Tokenizer->Error)
+	{
+		for (s32 LoadIndex = 0; LoadIndex < LoadCount; ++LoadIndex)
+		{
+			PlanTextureLoad(Loads + LoadIndex, TextureCache, Arena, ScratchArena);
+		}
+		
+		InitColorComponentTable();
+		#pragma omp parallel for schedule(dynamic)
+		for (s32 LoadIndex = 0; LoadIndex < LoadCount; ++LoadIndex)
+		{
+			texture_load* Load = Loads + LoadIndex;
+			if (Load->Decode)
+			{
+				f64 StartTime = TraceStart();
+				Load->Texture = LoadTexture((const char*)Load->Token.String.Data, &Load->Arena, &Load->ScratchArena);
+				TraceEvent("load texture", StartTime, LoadIndex);
+			}
+		}
+		
+		for (s32 LoadIndex = 0; LoadIndex < LoadCount; ++LoadIndex)
+		{
+			texture_load* Load = Loads + LoadIndex;
+			if (Load->Texture.Texels)
+			{
+				FinishTextureLoad(Load);
+			}
+			else
+			{
+				Tokenizer->Error = true;
+				fprintf(stderr, "(%d, %d): Could not load texture from file '%.*s'\n", Load->Token.Line, Load->Token.Column, PrintString(Load->Token.String));
+			}
+		}
+		
+		for (s32 Index = 0; Index < TextureCount; ++Index)
+		{
+			if (LoadForIndex[Index] >= 0)
+			{
+				DestScene->Textures[Index] = Loads[LoadForIndex[Index]].Texture;
+			}
+		}
+	}
+	EndTemporaryMemory(Temp);
 }
 
 function b32
-LoadSceneFromFile(const char* FileName, scene* DestScene, memory_arena* Arena, memory_arena* ScratchArena)
+LoadSceneFromFile(const char* FileName, scene* DestScene, memory_arena* Arena, memory_arena* ScratchArena, texture_cache* TextureCache = 0,
+	f64* TextureSeconds = 0)
 {
 	b32 Success = true;
 	temporary_memory Temp = BeginTemporaryMemory(ScratchArena);
@@ -1566,7 +2737,13 @@ LoadSceneFromFile(const char* FileName, scene* DestScene, memory_arena* Arena, m
 		token Token = NextToken(&Tokenizer);
 		if (Token.Type == Token_Textures)
 		{
-			LoadTextures(&Tokenizer, DestScene, Arena);
+			f64 TextureStartTime = omp_get_wtime();
+			LoadTextures(&Tokenizer, DestScene, Arena, ScratchArena, TextureCache);
+			if (TextureSeconds)
+			{
+				*TextureSeconds = omp_get_wtime() - TextureStartTime;
+			}
+			TraceEvent("load textures", TextureStartTime);
 			Token = NextToken(&Tokenizer);
 		}
 		
@@ -1574,6 +2751,30 @@ LoadSceneFromFile(const char* FileName, scene* DestScene, memory_arena* Arena, m
 		{
 			s64 OldAlignment = Arena->Alignment;
 			SetAlignment(Arena, 16);
+			
+			// Reserve room for groups up front, since the object array is grown in place.
+			// Counting the keyword over the raw text can only overestimate.
+			s32 MaxGroupCount = (s32)CountOccurrences(SceneBuffer, ConstString("Group"));
+			DestScene->GroupCount = 0;
+			DestScene->Groups = PushArray(Arena, MaxGroupCount, object_group);
+			
+			// Every object and named material adds at most one material, which the table deduplicates
+			s32 MaxMaterialCount = (s32)(CountOccurrences(SceneBuffer, ConstString("Plane")) +
+				CountOccurrences(SceneBuffer, ConstString("Sphere")) +
+				CountOccurrences(SceneBuffer, ConstString("Triangle")) +
+				CountOccurrences(SceneBuffer, ConstString("Parallelogram")) +
+				CountOccurrences(SceneBuffer, ConstString("Material")));
+			DestScene->MaterialCount = 0;
+			DestScene->Materials = PushArray(Arena, MaxMaterialCount, material);
+			DestScene->MaterialTable = MakeMaterialTable(MaxMaterialCount, ScratchArena);
+			
+			// Instances can be multiplied by repeats, so they grow in scratch memory instead
+			s64 OldScratchAlignment = ScratchArena->Alignment;
+			SetAlignment(ScratchArena, 16);
+			DestScene->InstanceCount = 0;
+			DestScene->Instances = PushArray(ScratchArena, 0, instance);
+			SetAlignment(ScratchArena, 1);
+			
 			DestScene->Objects = PushArray(Arena, 0, object);
 			SetAlignment(Arena, 1);
 			
@@ -1595,10 +2796,26 @@ LoadSceneFromFile(const char* FileName, scene* DestScene, memory_arena* Arena, m
 				{
 					ParseParallelogramDecl(&Tokenizer, DestScene, Arena);
 				}
+				else if (Token.Type == Token_Group)
+				{
+					ParseGroupDecl(&Tokenizer, DestScene, Arena, ScratchArena);
+				}
+				else if (Token.Type == Token_Instance)
+				{
+					ParseInstanceDecl(&Tokenizer, DestScene, Arena, ScratchArena);
+				}
+				else if (Token.Type == Token_Repeat)
+				{
+					ParseRepeatDecl(&Tokenizer, DestScene, Arena, ScratchArena, false);
+				}
 				else if (Token.Type == Token_Camera)
 				{
 					ParseCameraDecl(&Tokenizer, DestScene, Arena);
 				}
+				else if (Token.Type == Token_Material)
+				{
+					ParseMaterialDecl(&Tokenizer, DestScene);
+				}
 				else if (Token.Type == Token_EOF)
 				{
 					break;
@@ -1613,6 +2830,18 @@ LoadSceneFromFile(const char* FileName, scene* DestScene, memory_arena* Arena, m
 			}
 			
 			SetAlignment(Arena, OldAlignment);
+			
+			SetAlignment(ScratchArena, OldScratchAlignment);
+			DestScene->MaterialTable = 0;
+			
+			if (!Tokenizer.Error && DestScene->GroupCount > 0)
+			{
+				FinalizeGroups(DestScene, Arena, ScratchArena);
+			}
+			if (!Tokenizer.Error)
+			{
+				FinalizeInstances(DestScene, Arena);
+			}
 		}
 		
 		Success = !Tokenizer.Error;
@@ -0,0 +1,253 @@
+/*
+ * perfcounters.h
+ *
+ * Hardware event counts for the calling thread from perf_event_open
+ */
+
+// Each counter is opened on its own, so a machine that lacks one event still reports the others.
+// Containers and virtual machines often allow none of them, or perf_event_paranoid forbids them,
+// in which case the counts are marked invalid and the render carries on without them.
+
+enum perf_counter_kind
+{
+	PerfCounter_Cycles,
+	PerfCounter_Instructions,
+	PerfCounter_L1DMisses,
+	PerfCounter_LLCMisses,
+	PerfCounter_BranchMisses,
+	PerfCounter_Count,
+};
+
+global const char* PerfCounterNames[PerfCounter_Count] =
+{
+	"cycles",
+	"instructions",
+	"l1d_misses",
+	"llc_misses",
+	"branch_misses",
+};
+
+typedef struct perf_counts
+{
+	s64 Values[PerfCounter_Count];
+	s64 ValidMask; // Bit per counter that was counted, so a missing one is not mistaken for zero
+	s32 Missing[PerfCounter_Count]; // For a sum, the parts that did not count each counter and are left out of it
+} perf_counts;
+
+typedef struct perf_counters
+{
+	int Files[PerfCounter_Count];
+	int Errors[PerfCounter_Count];
+} perf_counters;
+
+function perf_counters
+OpenPerfCounters()
+{
+	perf_counters Counters;
+	for (s32 Kind = 0; Kind < PerfCounter_Count; ++Kind)
+	{
+		struct perf_event_attr Attr = {};
+		Attr.size = sizeof(Attr);
+		Attr.type = PERF_TYPE_HARDWARE;
+		switch (Kind)
+		{
+			case PerfCounter_Cycles:
+				Attr.config = PERF_COUNT_HW_CPU_CYCLES;
+				break;
+			case PerfCounter_Instructions:
+				Attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+				break;
+			case PerfCounter_L1DMisses:
+				Attr.type = PERF_TYPE_HW_CACHE;
+				Attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+				break;
+			case PerfCounter_LLCMisses:
+				Attr.config = PERF_COUNT_HW_CACHE_MISSES;
+				break;
+			case PerfCounter_BranchMisses:
+				Attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+				break;
+		}
+		Attr.disabled = 1;
+		Attr.exclude_kernel = 1;
+		Attr.exclude_hv = 1;
+		// With more events than hardware counters the kernel takes turns, so the times are needed to scale the counts
+		Attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		Counters.Files[Kind] = (int)syscall(SYS_perf_event_open, &Attr, 0, -1, -1, 0);
+		Counters.Errors[Kind] = Counters.Files[Kind] < 0 ? errno : 0;
+	}
+	return Counters;
+}
+
+function void
+StartPerfCounters(perf_counters* Counters)
+{
+	for (s32 Kind = 0; Kind < PerfCounter_Count; ++Kind)
+	{
+		if (Counters->Files[Kind] >= 0)
+		{
+			ioctl(Counters->Files[Kind], PERF_EVENT_IOC_RESET, 0);
+			ioctl(Counters->Files[Kind], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+}
+
+function perf_counts
+StopPerfCounters(perf_counters* Counters)
+{
+	perf_counts Counts = {};
+	for (s32 Kind = 0; Kind < PerfCounter_Count; ++Kind)
+	{
+		if (Counters->Files[Kind] >= 0)
+		{
+			ioctl(Counters->Files[Kind], PERF_EVENT_IOC_DISABLE, 0);
+			u64 Data[3]; // Value, time enabled, time running
+			if (read(Counters->Files[Kind], Data, sizeof(Data)) == sizeof(Data) && Data[2] > 0)
+			{
+				Counts.Values[Kind] = (s64)((f64)Data[0]*((f64)Data[1] / (f64)Data[2]));
+				Counts.ValidMask |= (1 << Kind);
+			}
+		}
+	}
+	return Counts;
+}
+
+function void
+ClosePerfCounters(perf_counters* Counters)
+{
+	for (s32 Kind = 0; Kind < PerfCounter_Count; ++Kind)
+	{
+		if (Counters->Files[Kind] >= 0)
+		{
+			close(Counters->Files[Kind]);
+			Counters->Files[Kind] = -1;
+		}
+	}
+}
+
+// Every thread opens its own counters, so on a machine with many cores they can run past the soft
+// limit on open files, and every thread past it would go without. The limit is raised as far as
+// the hard limit allows, with a warning if that is still too few for ThreadCount threads.
+function void
+RaisePerfCounterFileLimit(s32 ThreadCount)
+{
+	struct rlimit Limit;
+	if (getrlimit(RLIMIT_NOFILE, &Limit) == 0)
+	{
+		if (Limit.rlim_cur != Limit.rlim_max)
+		{
+			rlim_t Soft = Limit.rlim_cur;
+			Limit.rlim_cur = Limit.rlim_max;
+			if (setrlimit(RLIMIT_NOFILE, &Limit) != 0)
+			{
+				Limit.rlim_cur = Soft;
+			}
+		}
+		// One set for each thread and one for the main thread, with room for the scene, textures and output
+		rlim_t Needed = (rlim_t)(ThreadCount + 1)*PerfCounter_Count + 64;
+		if (Limit.rlim_cur != RLIM_INFINITY && Limit.rlim_cur < Needed)
+		{
+			fprintf(stderr, "Warning: Only %lu files can be open at once and %d threads need %lu for their counters, "
+				"so some threads will not be counted.\n", (u64)Limit.rlim_cur, ThreadCount, (u64)Needed);
+		}
+	}
+}
+
+// Tries every counter once so a run can say up front which ones it will not get
+function void
+CheckPerfCounters()
+{
+	perf_counters Counters = OpenPerfCounters();
+	for (s32 Kind = 0; Kind < PerfCounter_Count; ++Kind)
+	{
+		if (Counters.Files[Kind] < 0)
+		{
+			fprintf(stderr, "Warning: Hardware counter %s is not available (%s), it will not be reported.\n",
+				PerfCounterNames[Kind], strerror(Counters.Errors[Kind]));
+		}
+	}
+	ClosePerfCounters(&Counters);
+}
+
+// A sum covers the parts that counted each counter, and keeps a tally of the ones that did not,
+// so one thread that could not open its counters does not leave the whole sum without them
+function void
+AddPerfCounts(perf_counts* Dest, perf_counts* Source)
+{
+	for (s32 Kind = 0; Kind < PerfCounter_Count; ++Kind)
+	{
+		if (Source->ValidMask & (1 << Kind))
+		{
+			Dest->Values[Kind] += Source->Values[Kind];
+			Dest->ValidMask |= (1 << Kind);
+		}
+		else
+		{
+			++Dest->Missing[Kind];
+		}
+	}
+}
+
+function void
+PrintPerfCounts(const char* Label, perf_counts* Counts)
+{
+	printf("%s:", Label);
+	for (s32 Kind = 0; Kind < PerfCounter_Count; ++Kind)
+	{
+		if ((Counts->ValidMask & (1 << Kind)) && Counts->Missing[Kind] > 0)
+		{
+			printf(" %ld %s (%d threads not counted),", Counts->Values[Kind], PerfCounterNames[Kind], Counts->Missing[Kind]);
+		}
+		else if (Counts->ValidMask & (1 << Kind))
+		{
+			printf(" %ld %s,", Counts->Values[Kind], PerfCounterNames[Kind]);
+		}
+		else
+		{
+			printf(" n/a %s,", PerfCounterNames[Kind]);
+		}
+	}
+	b32 HasIPC = (Counts->ValidMask & (1 << PerfCounter_Cycles)) && (Counts->ValidMask & (1 << PerfCounter_Instructions)) &&
+		Counts->Values[PerfCounter_Cycles] > 0;
+	if (HasIPC)
+	{
+		printf(" IPC %.2f\n", (f64)Counts->Values[PerfCounter_Instructions] / (f64)Counts->Values[PerfCounter_Cycles]);
+	}
+	else
+	{
+		printf(" IPC n/a\n");
+	}
+}
+
+function void
+WritePerfCountsJSON(FILE* File, perf_counts* Counts)
+{
+	fprintf(File, "{");
+	for (s32 Kind = 0; Kind < PerfCounter_Count; ++Kind)
+	{
+		fprintf(File, "%s\"%s\": ", Kind ? ", " : "", PerfCounterNames[Kind]);
+		if (Counts->ValidMask & (1 << Kind))
+		{
+			fprintf(File, "%ld", Counts->Values[Kind]);
+		}
+		else
+		{
+			fprintf(File, "null");
+		}
+	}
+	b32 AnyMissing = false;
+	for (s32 Kind = 0; Kind < PerfCounter_Count; ++Kind)
+	{
+		AnyMissing |= (Counts->Missing[Kind] > 0);
+	}
+	if (AnyMissing)
+	{
+		fprintf(File, ", \"missing\": {");
+		for (s32 Kind = 0; Kind < PerfCounter_Count; ++Kind)
+		{
+			fprintf(File, "%s\"%s\": %d", Kind ? ", " : "", PerfCounterNames[Kind], Counts->Missing[Kind]);
+		}
+		fprintf(File, "}");
+	}
+	fprintf(File, "}");
+}
\ No newline at end of file
@@ -0,0 +1,232 @@
+/*
+ * pfm.h
+ *
+ * For writing and reading linear float images as PFM files
+ */
+
+// The color is a standard little-endian RGB PFM, so other tools can open it directly. When
+// the surface has sample counts they follow as a second, single channel PFM image in the
+// same file; readers that only expect one image ignore it. Rows go bottom to top, as in
+// the surface itself.
+
+function b32
+IsLittleEndian()
+{
+	u16 Value = 1;
+	b32 Result = (*(u8*)&Value == 1);
+	return Result;
+}
+
+// Formats the text header of a PFM image, "PF" for RGB or "Pf" for a single channel
+function s32
+FormatPFMHeader(char* Dest, s32 DestSize, const char* Type, s32 Width, s32 Height)
+{
+	// A negative scale marks the data as little-endian
+	f32 Scale = IsLittleEndian() ? -1.0f : 1.0f;
+	s32 Result = snprintf(Dest, DestSize, "%s\n%d %d\n%.1f\n", Type, Width, Height, Scale);
+	return Result;
+}
+
+function b32
+WritePFM(surface* Surface, const char* FileName)
+{
+	b32 Success = true;
+	FILE* DestFile = fopen(FileName, "wb");
+	
+	if (DestFile)
+	{
+		char Header[64];
+		s64 PixelCount = (s64)Surface->Width*Surface->Height;
+		s32 HeaderSize = FormatPFMHeader(Header, sizeof(Header), "PF", Surface->Width, Surface->Height);
+		Success = (fwrite(Header, HeaderSize, 1, DestFile) == 1);
+		if (Success)
+		{
+			Success = (fwrite(Surface->Pixels, sizeof(color), PixelCount, DestFile) == (size_t)PixelCount);
+		}
+		if (Success && Surface->SampleCounts)
+		{
+			HeaderSize = FormatPFMHeader(Header, sizeof(Header), "Pf", Surface->Width, Surface->Height);
+			Success = (fwrite(Header, HeaderSize, 1, DestFile) == 1);
+			if (Success)
+			{
+				Success = (fwrite(Surface->SampleCounts, sizeof(f32), PixelCount, DestFile) == (size_t)PixelCount);
+			}
+		}
+		fclose(DestFile);
+	}
+	else
+	{
+		Success = false;
+	}
+	
+	return Success;
+}
+
+// Writes a standalone single channel PFM image, for float maps that are not colors
+function b32
+WriteSingleChannelPFM(f32* Values, s32 Width, s32 Height, const char* FileName)
+{
+	b32 Success = true;
+	FILE* DestFile = fopen(FileName, "wb");
+	
+	if (DestFile)
+	{
+		char Header[64];
+		s64 PixelCount = (s64)Width*Height;
+		s32 HeaderSize = FormatPFMHeader(Header, sizeof(Header), "Pf", Width, Height);
+		Success = (fwrite(Header, HeaderSize, 1, DestFile) == 1) &&
+			(fwrite(Values, sizeof(f32), PixelCount, DestFile) == (size_t)PixelCount);
+		Success = (fclose(DestFile) == 0) && Success;
+	}
+	else
+	{
+		Success = false;
+	}
+	
+	return Success;
+}
+
+// Reads one PFM header, returning the number of channels it declares (3 or 1), or 0 if it is invalid
+function s32
+ReadPFMHeader(FILE* SourceFile, s32* Width, s32* Height, b32* IsLittle)
+{
+	s32 ChannelCount = 0;
+	char Type[3] = {};
+	f32 Scale = 0;
+	if (fscanf(SourceFile, "%2s %d %d %f", Type, Width, Height, &Scale) == 4 &&
+		*Width > 0 && *Height > 0 && Scale != 0 && fgetc(SourceFile) != EOF)
+	{
+		if (CStrEq(Type, "PF"))
+		{
+			ChannelCount = 3;
+		}
+		else if (CStrEq(Type, "Pf"))
+		{
+			ChannelCount = 1;
+		}
+		*IsLittle = (Scale < 0);
+	}
+	return ChannelCount;
+}
+
+function void
+SwapFloatBytes(f32* Values, s64 Count)
+{
+	for (s64 Index = 0; Index < Count; ++Index)
+	{
+		u8* Bytes = (u8*)(Values + Index);
+		u8 Swap = Bytes[0];
+		Bytes[0] = Bytes[3];
+		Bytes[3] = Swap;
+		Swap = Bytes[1];
+		Bytes[1] = Bytes[2];
+		Bytes[2] = Swap;
+	}
+}
+
+function surface
+LoadPFM(const char* FileName, memory_arena* Arena)
+{
+	surface Surface = {};
+	FILE* SourceFile = fopen(FileName, "rb");
+	
+	if (SourceFile)
+	{
+		temporary_memory Temp = BeginTemporaryMemory(Arena);
+		b32 Error = false;
+		b32 IsLittle = true;
+		s32 Width = 0;
+		s32 Height = 0;
+		if (ReadPFMHeader(SourceFile, &Width, &Height, &IsLittle) == 3)
+		{
+			s64 PixelCount = (s64)Width*Height;
+			Surface.Width = Width;
+			Surface.Height = Height;
+			Surface.Pixels = PushArray(Arena, PixelCount, color);
+			if (fread(Surface.Pixels, sizeof(color), PixelCount, SourceFile) == (size_t)PixelCount)
+			{
+				if (IsLittle != IsLittleEndian())
+				{
+					SwapFloatBytes((f32*)Surface.Pixels, 3*PixelCount);
+				}
+				
+				// The sample counts are optional, but must match the color image if they are there
+				s32 CountWidth = 0;
+				s32 CountHeight = 0;
+				s32 ChannelCount = ReadPFMHeader(SourceFile, &CountWidth, &CountHeight, &IsLittle);
+				if (ChannelCount == 1 && CountWidth == Width && CountHeight == Height)
+				{
+					Surface.SampleCounts = PushArray(Arena, PixelCount, f32);
+					if (fread(Surface.SampleCounts, sizeof(f32), PixelCount, SourceFile) == (size_t)PixelCount)
+					{
+						if (IsLittle != IsLittleEndian())
+						{
+							SwapFloatBytes(Surface.SampleCounts, PixelCount);
+						}
+					}
+					else
+					{
+						Error = true;
+						fprintf(stderr, "Error reading file %s: Sample counts are truncated\n", FileName);
+					}
+				}
+				else if (ChannelCount != 0)
+				{
+					Error = true;
+					fprintf(stderr, "Error reading file %s: Sample counts do not match the image\n", FileName);
+				}
+			}
+			else
+			{
+				Error = true;
+				fprintf(stderr, "Error reading file %s: Pixel data is truncated\n", FileName);
+			}
+		}
+		else
+		{
+			Error = true;
+			fprintf(stderr, "Error reading file %s: Not an RGB PFM file\n", FileName);
+		}
+		
+		if (Error)
+		{
+			Surface = {};
+			EndTemporaryMemory(Temp);
+		}
+		else
+		{
+			KeepTemporaryMemory(Temp);
+		}
+		fclose(SourceFile);
+	}
+	else
+	{
+		fprintf(stderr, "Error reading file %s\n", FileName);
+	}
+	
+	return Surface;
+}
+
+// Averages Source into Dest, weighting each pixel by how many samples went into it. Images
+// without sample counts count as one sample per pixel. Dest must have sample counts.
+function b32
+MergeSurface(surface* Dest, surface* Source)
+{
+	b32 Success = (Dest->Width == Source->Width && Dest->Height == Source->Height && Dest->SampleCounts);
+	if (Success)
+	{
+		s64 PixelCount = (s64)Dest->Width*Dest->Height;
+		for (s64 Index = 0; Index < PixelCount; ++Index)
+		{
+			f32 DestCount = Dest->SampleCounts[Index];
+			f32 SourceCount = Source->SampleCounts ? Source->SampleCounts[Index] : 1.0f;
+			f32 TotalCount = DestCount + SourceCount;
+			if (TotalCount > 0)
+			{
+				Dest->Pixels[Index] = (Dest->Pixels[Index]*DestCount + Source->Pixels[Index]*SourceCount) / TotalCount;
+			}
+			Dest->SampleCounts[Index] = TotalCount;
+		}
+	}
+	return Success;
+}
\ No newline at end of file
@@ -0,0 +1,806 @@
+/*
+ * png.h
+ *
+ * For writing the surface out to a PNG file, with its own deflate encoder
+ */
+
+// The filtered image is cut into segments of whole rows that are compressed in parallel.
+// Every segment but the last ends on a byte boundary with an empty stored block, so the
+// compressed segments can simply be concatenated. Each segment may still match against
+// the 32K of data before it, which keeps the compression ratio close to a serial encoder.
+#define PNG_SEGMENT_SIZE (256*1024)
+#define PNG_MAX_IDAT_SIZE (1 << 30)
+
+#define DEFLATE_WINDOW_SIZE 32768
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_MAX_CHAIN 64
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_MAX_BLOCK_SYMBOLS 32768
+#define DEFLATE_LITLEN_CODES 286
+#define DEFLATE_DIST_CODES 30
+#define DEFLATE_CODE_LENGTH_CODES 19
+
+global u16 DeflateLengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+global u8 DeflateLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+global u16 DeflateDistBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+global u8 DeflateDistExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+global u8 DeflateCodeLengthOrder[DEFLATE_CODE_LENGTH_CODES] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+global u32 CRCTable[256];
+global b32 CRCTableReady;
+
+typedef struct bit_writer
+{
+	u8* Data;
+	s64 Count;
+	u64 Bits;
+	s32 BitCount;
+} bit_writer;
+
+// Dist is zero for a literal, in which case LitLen is the byte itself
+typedef struct deflate_symbol
+{
+	u16 LitLen;
+	u16 Dist;
+} deflate_symbol;
+
+typedef struct deflate_state
+{
+	s32* Head;
+	s32* Prev;
+	deflate_symbol* Symbols;
+} deflate_state;
+
+typedef struct huffman_code
+{
+	u8 Lengths[DEFLATE_LITLEN_CODES];
+	u16 Codes[DEFLATE_LITLEN_CODES];
+} huffman_code;
+
+function void
+WriteBits(bit_writer* Writer, u32 Value, s32 BitCount)
+{
+	Writer->Bits |= (u64)Value << Writer->BitCount;
+	Writer->BitCount += BitCount;
+	while (Writer->BitCount >= 8)
+	{
+		Writer->Data[Writer->Count++] = (u8)Writer->Bits;
+		Writer->Bits >>= 8;
+		Writer->BitCount -= 8;
+	}
+}
+
+function void
+AlignToByte(bit_writer* Writer)
+{
+	if (Writer->BitCount > 0)
+	{
+		WriteBits(Writer, 0, 8 - Writer->BitCount);
+	}
+}
+
+function s32
+GetLengthCode(s32 Length)
+{
+	s32 Code = 28;
+	while (DeflateLengthBase[Code] > Length)
+	{
+		--Code;
+	}
+	return Code;
+}
+
+function s32
+GetDistCode(s32 Dist)
+{
+	s32 Code = 29;
+	while (DeflateDistBase[Code] > Dist)
+	{
+		--Code;
+	}
+	return Code;
+}
+
+// Builds Huffman code lengths no longer than MaxLength. When the tree gets too deep the
+// frequencies are flattened and the tree is rebuilt, which is simple and rarely needed.
+function void
+BuildHuffmanLengths(u32* SourceFreqs, s32 Count, s32 MaxLength, u8* Lengths)
+{
+	u32 Freqs[DEFLATE_LITLEN_CODES];
+	s32 UsedCount = 0;
+	for (s32 Index = 0; Index < Count; ++Index)
+	{
+		Freqs[Index] = SourceFreqs[Index];
+		UsedCount += (Freqs[Index] > 0);
+	}
+	// Some decoders reject a code with only one symbol, so always give it at least two
+	for (s32 Index = 0; Index < Count && UsedCount < 2; ++Index)
+	{
+		if (Freqs[Index] == 0)
+		{
+			Freqs[Index] = 1;
+			++UsedCount;
+		}
+	}
+	
+	b32 Done = false;
+	while (!Done)
+	{
+		u32 NodeFreqs[2*DEFLATE_LITLEN_CODES];
+		s32 Parents[2*DEFLATE_LITLEN_CODES];
+		b32 Active[2*DEFLATE_LITLEN_CODES];
+		s32 NodeCount = Count;
+		for (s32 Index = 0; Index < Count; ++Index)
+		{
+			NodeFreqs[Index] = Freqs[Index];
+			Parents[Index] = -1;
+			Active[Index] = (Freqs[Index] > 0);
+		}
+		
+		for (s32 Merge = 0; Merge < UsedCount - 1; ++Merge)
+		{
+			s32 Smallest[2] = {-1, -1};
+			for (s32 Index = 0; Index < NodeCount; ++Index)
+			{
+				if (Active[Index])
+				{
+					if (Smallest[0] < 0 || NodeFreqs[Index] < NodeFreqs[Smallest[0]])
+					{
+						Smallest[1] = Smallest[0];
+						Smallest[0] = Index;
+					}
+					else if (Smallest[1] < 0 || NodeFreqs[Index] < NodeFreqs[Smallest[1]])
+					{
+						Smallest[1] = Index;
+					}
+				}
+			}
+			NodeFreqs[NodeCount] = NodeFreqs[Smallest[0]] + NodeFreqs[Smallest[1]];
+			Parents[NodeCount] = -1;
+			Active[NodeCount] = true;
+			Parents[Smallest[0]] = NodeCount;
+			Parents[Smallest[1]] = NodeCount;
+			Active[Smallest[0]] = false;
+			Active[Smallest[1]] = false;
+			++NodeCount;
+		}
+		
+		Done = true;
+		for (s32 Index = 0; Index < Count; ++Index)
+		{
+			s32 Length = 0;
+			if (Freqs[Index] > 0)
+			{
+				for (s32 Node = Index; Parents[Node] >= 0; Node = Parents[Node])
+				{
+					++Length;
+				}
+			}
+			Lengths[Index] = (u8)Length;
+			if (Length > MaxLength)
+			{
+				Done = false;
+			}
+		}
+		
+		if (!Done)
+		{
+			for (s32 Index = 0; Index < Count; ++Index)
+			{
+				if (Freqs[Index] > 0)
+				{
+					Freqs[Index] = (Freqs[Index] + 1) / 2;
+				}
+			}
+		}
+	}
+}
+
+// Deflate sends Huffman codes starting from their most significant bit, while the bit
+// writer fills bytes from the least significant bit, so the canonical codes are stored reversed.
+function void
+BuildHuffmanCodes(u8* Lengths, s32 Count, u16* Codes)
+{
+	s32 LengthCounts[16] = {};
+	for (s32 Index = 0; Index < Count; ++Index)
+	{
+		++LengthCounts[Lengths[Index]];
+	}
+	LengthCounts[0] = 0;
+	
+	s32 NextCode[16] = {};
+	s32 Code = 0;
+	for (s32 Length = 1; Length < 16; ++Length)
+	{
+		Code = (Code + LengthCounts[Length - 1]) << 1;
+		NextCode[Length] = Code;
+	}
+	
+	for (s32 Index = 0; Index < Count; ++Index)
+	{
+		s32 Length = Lengths[Index];
+		Codes[Index] = 0;
+		if (Length > 0)
+		{
+			s32 Canonical = NextCode[Length]++;
+			u16 Reversed = 0;
+			for (s32 Bit = 0; Bit < Length; ++Bit)
+			{
+				Reversed = (u16)((Reversed << 1) | ((Canonical >> Bit) & 1));
+			}
+			Codes[Index] = Reversed;
+		}
+	}
+}
+
+// Run-length encodes the code lengths with symbols 16 (repeat previous), 17 and 18 (runs of zeros)
+function s32
+EncodeCodeLengths(u8* Lengths, s32 Count, u8* Symbols, u8* Extras)
+{
+	s32 SymbolCount = 0;
+	s32 Index = 0;
+	while (Index < Count)
+	{
+		s32 Run = 1;
+		while (Index + Run < Count && Lengths[Index + Run] == Lengths[Index])
+		{
+			++Run;
+		}
+		
+		if (Lengths[Index] == 0 && Run >= 3)
+		{
+			s32 Take = Run > 138 ? 138 : Run;
+			if (Take >= 11)
+			{
+				Symbols[SymbolCount] = 18;
+				Extras[SymbolCount++] = (u8)(Take - 11);
+			}
+			else
+			{
+				Symbols[SymbolCount] = 17;
+				Extras[SymbolCount++] = (u8)(Take - 3);
+			}
+			Index += Take;
+		}
+		else if (Lengths[Index] != 0 && Run >= 4)
+		{
+			Symbols[SymbolCount] = Lengths[Index];
+			Extras[SymbolCount++] = 0;
+			s32 Take = (Run - 1) > 6 ? 6 : (Run - 1);
+			Symbols[SymbolCount] = 16;
+			Extras[SymbolCount++] = (u8)(Take - 3);
+			Index += 1 + Take;
+		}
+		else
+		{
+			Symbols[SymbolCount] = Lengths[Index];
+			Extras[SymbolCount++] = 0;
+			++Index;
+		}
+	}
+	return SymbolCount;
+}
+
+function void
+WriteStoredBlocks(bit_writer* Writer, u8* Data, s64 Size, b32 IsFinal)
+{
+	do
+	{
+		s64 BlockSize = Size > 65535 ? 65535 : Size;
+		WriteBits(Writer, (IsFinal && BlockSize == Size) ? 1 : 0, 1);
+		WriteBits(Writer, 0, 2);
+		AlignToByte(Writer);
+		WriteBits(Writer, (u32)BlockSize, 16);
+		WriteBits(Writer, (u32)~BlockSize & 0xFFFF, 16);
+		for (s64 Index = 0; Index < BlockSize; ++Index)
+		{
+			Writer->Data[Writer->Count++] = Data[Index];
+		}
+		Data += BlockSize;
+		Size -= BlockSize;
+	} while (Size > 0);
+}
+
+// Writes one block with its own Huffman codes, or stored if that turns out smaller
+function void
+WriteDeflateBlock(bit_writer* Writer, deflate_symbol* Symbols, s32 SymbolCount, u8* Data, s64 DataSize, b32 IsFinal)
+{
+	u32 LitLenFreqs[DEFLATE_LITLEN_CODES] = {};
+	u32 DistFreqs[DEFLATE_DIST_CODES] = {};
+	for (s32 Index = 0; Index < SymbolCount; ++Index)
+	{
+		deflate_symbol Symbol = Symbols[Index];
+		if (Symbol.Dist == 0)
+		{
+			++LitLenFreqs[Symbol.LitLen];
+		}
+		else
+		{
+			++LitLenFreqs[257 + GetLengthCode(Symbol.LitLen)];
+			++DistFreqs[GetDistCode(Symbol.Dist)];
+		}
+	}
+	++LitLenFreqs[256];
+	
+	huffman_code LitLen;
+	huffman_code Dist;
+	BuildHuffmanLengths(LitLenFreqs, DEFLATE_LITLEN_CODES, 15, LitLen.Lengths);
+	BuildHuffmanLengths(DistFreqs, DEFLATE_DIST_CODES, 15, Dist.Lengths);
+	BuildHuffmanCodes(LitLen.Lengths, DEFLATE_LITLEN_CODES, LitLen.Codes);
+	BuildHuffmanCodes(Dist.Lengths, DEFLATE_DIST_CODES, Dist.Codes);
+	
+	s32 LitLenCount = DEFLATE_LITLEN_CODES;
+	while (LitLenCount > 257 && LitLen.Lengths[LitLenCount - 1] == 0)
+	{
+		--LitLenCount;
+	}
+	s32 DistCount = DEFLATE_DIST_CODES;
+	while (DistCount > 1 && Dist.Lengths[DistCount - 1] == 0)
+	{
+		--DistCount;
+	}
+	
+	// Both sets of code lengths are sent as one run-length encoded sequence
+	u8 AllLengths[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+	for (s32 Index = 0; Index < LitLenCount; ++Index)
+	{
+		AllLengths[Index] = LitLen.Lengths[Index];
+	}
+	for (s32 Index = 0; Index < DistCount; ++Index)
+	{
+		AllLengths[LitLenCount + Index] = Dist.Lengths[Index];
+	}
+	u8 LengthSymbols[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+	u8 LengthExtras[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+	s32 LengthSymbolCount = EncodeCodeLengths(AllLengths, LitLenCount + DistCount, LengthSymbols, LengthExtras);
+	
+	u32 CodeLengthFreqs[DEFLATE_CODE_LENGTH_CODES] = {};
+	for (s32 Index = 0; Index < LengthSymbolCount; ++Index)
+	{
+		++CodeLengthFreqs[LengthSymbols[Index]];
+	}
+	u8 CodeLengthLengths[DEFLATE_CODE_LENGTH_CODES];
+	u16 CodeLengthCodes[DEFLATE_CODE_LENGTH_CODES];
+	BuildHuffmanLengths(CodeLengthFreqs, DEFLATE_CODE_LENGTH_CODES, 7, CodeLengthLengths);
+	BuildHuffmanCodes(CodeLengthLengths, DEFLATE_CODE_LENGTH_CODES, CodeLengthCodes);
+	s32 CodeLengthCount = DEFLATE_CODE_LENGTH_CODES;
+	while (CodeLengthCount > 4 && CodeLengthLengths[DeflateCodeLengthOrder[CodeLengthCount - 1]] == 0)
+	{
+		--CodeLengthCount;
+	}
+	
+	// Work out the size of the block up front to decide between Huffman coded and stored
+	s64 BitSize = 3 + 5 + 5 + 4 + 3*CodeLengthCount;
+	for (s32 Index = 0; Index < LengthSymbolCount; ++Index)
+	{
+		u8 Symbol = LengthSymbols[Index];
+		BitSize += CodeLengthLengths[Symbol] + (Symbol == 16 ? 2 : Symbol == 17 ? 3 : Symbol == 18 ? 7 : 0);
+	}
+	for (s32 Index = 0; Index < DEFLATE_LITLEN_CODES; ++Index)
+	{
+		BitSize += (s64)LitLenFreqs[Index]*LitLen.Lengths[Index];
+		if (Index >= 257)
+		{
+			BitSize += (s64)LitLenFreqs[Index]*DeflateLengthExtra[Index - 257];
+		}
+	}
+	for (s32 Index = 0; Index < DEFLATE_DIST_CODES; ++Index)
+	{
+		BitSize += (s64)DistFreqs[Index]*(Dist.Lengths[Index] + DeflateDistExtra[Index]);
+	}
+	s64 StoredSize = DataSize + 5*(DataSize/65535 + 1) + 1;
+	
+	if (BitSize/8 + 1 >= StoredSize)
+	{
+		WriteStoredBlocks(Writer, Data, DataSize, IsFinal);
+	}
+	else
+	{
+		WriteBits(Writer, IsFinal ? 1 : 0, 1);
+		WriteBits(Writer, 2, 2);
+		WriteBits(Writer, LitLenCount - 257, 5);
+		WriteBits(Writer, DistCount - 1, 5);
+		WriteBits(Writer, CodeLengthCount - 4, 4);
+		for (s32 Index = 0; Index < CodeLengthCount; ++Index)
+		{
+			WriteBits(Writer, CodeLengthLengths[DeflateCodeLengthOrder[Index]], 3);
+		}
+		for (s32 Index = 0; Index < LengthSymbolCount; ++Index)
+		{
+			u8 Symbol = LengthSymbols[Index];
+			WriteBits(Writer, CodeLengthCodes[Symbol], CodeLengthLengths[Symbol]);
+			if (Symbol >= 16)
+			{
+				WriteBits(Writer, LengthExtras[Index], Symbol == 16 ? 2 : Symbol == 17 ? 3 : 7);
+			}
+		}
+		
+		for (s32 Index = 0; Index < SymbolCount; ++Index)
+		{
+			deflate_symbol Symbol = Symbols[Index];
+			if (Symbol.Dist == 0)
+			{
+				WriteBits(Writer, LitLen.Codes[Symbol.LitLen], LitLen.Lengths[Symbol.LitLen]);
+			}
+			else
+			{
+				s32 LengthCode = GetLengthCode(Symbol.LitLen);
+				WriteBits(Writer, LitLen.Codes[257 + LengthCode], LitLen.Lengths[257 + LengthCode]);
+				WriteBits(Writer, Symbol.LitLen - DeflateLengthBase[LengthCode], DeflateLengthExtra[LengthCode]);
+				s32 DistCode = GetDistCode(Symbol.Dist);
+				WriteBits(Writer, Dist.Codes[DistCode], Dist.Lengths[DistCode]);
+				WriteBits(Writer, Symbol.Dist - DeflateDistBase[DistCode], DeflateDistExtra[DistCode]);
+			}
+		}
+		WriteBits(Writer, LitLen.Codes[256], LitLen.Lengths[256]);
+	}
+}
+
+function u32
+HashDeflate(u8* Data)
+{
+	u32 Value = (u32)Data[0] | ((u32)Data[1] << 8) | ((u32)Data[2] << 16);
+	u32 Result = (Value * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+	return Result;
+}
+
+// Compresses Data[Start, End) into Writer. Matches may reach back into the 32K before Start,
+// so Data must hold the whole input. Returns the size written, ending on a byte boundary.
+function s64
+DeflateSegment(u8* Data, s64 TotalSize, s64 Start, s64 End, b32 IsFinal, deflate_state* State, bit_writer* Writer)
+{
+	for (s32 Index = 0; Index < (1 << DEFLATE_HASH_BITS); ++Index)
+	{
+		State->Head[Index] = -1;
+	}
+	
+	s64 WindowStart = Start - DEFLATE_WINDOW_SIZE;
+	if (WindowStart < 0)
+	{
+		WindowStart = 0;
+	}
+	for (s64 Position = WindowStart; Position < Start && Position + 2 < TotalSize; ++Position)
+	{
+		u32 Hash = HashDeflate(Data + Position);
+		State->Prev[Position & (DEFLATE_WINDOW_SIZE - 1)] = State->Head[Hash];
+		State->Head[Hash] = (s32)Position;
+	}
+	
+	s32 SymbolCount = 0;
+	s64 BlockStart = Start;
+	s64 Position = Start;
+	while (Position < End)
+	{
+		s32 BestLength = 0;
+		s32 BestDist = 0;
+		if (Position + DEFLATE_MIN_MATCH <= End)
+		{
+			s32 MaxLength = (End - Position) < DEFLATE_MAX_MATCH ? (s32)(End - Position) : DEFLATE_MAX_MATCH;
+			u32 Hash = HashDeflate(Data + Position);
+			s64 Candidate = State->Head[Hash];
+			s32 ChainLength = 0;
+			while (Candidate >= 0 && Position - Candidate <= DEFLATE_WINDOW_SIZE && ChainLength++ < DEFLATE_MAX_CHAIN)
+			{
+				if (Data[Candidate + BestLength] == Data[Position + BestLength])
+				{
+					s32 Length = 0;
+					while (Length < MaxLength && Data[Candidate + Length] == Data[Position + Length])
+					{
+						++Length;
+					}
+					if (Length > BestLength)
+					{
+						BestLength = Length;
+						BestDist = (s32)(Position - Candidate);
+						if (Length == MaxLength)
+						{
+							break;
+						}
+					}
+				}
+				
+				// Chains are kept in a ring buffer, so stop once they wrap around to newer positions
+				s64 Next = State->Prev[Candidate & (DEFLATE_WINDOW_SIZE - 1)];
+				if (Next >= Candidate)
+				{
+					break;
+				}
+				Candidate = Next;
+			}
+		}
+		
+		s32 Advance = 1;
+		if (BestLength >= DEFLATE_MIN_MATCH)
+		{
+			State->Symbols[SymbolCount++] = {(u16)BestLength, (u16)BestDist};
+			Advance = BestLength;
+		}
+		else
+		{
+			State->Symbols[SymbolCount++] = {Data[Position], 0};
+		}
+		
+		for (s64 Insert = Position; Insert < Position + Advance && Insert + 2 < TotalSize; ++Insert)
+		{
+			u32 Hash = HashDeflate(Data + Insert);
+			State->Prev[Insert & (DEFLATE_WINDOW_SIZE - 1)] = State->Head[Hash];
+			State->Head[Hash] = (s32)Insert;
+		}
+		Position += Advance;
+		
+		if (SymbolCount == DEFLATE_MAX_BLOCK_SYMBOLS || Position == End)
+		{
+			WriteDeflateBlock(Writer, State->Symbols, SymbolCount, Data + BlockStart, Position - BlockStart,
+				IsFinal && Position == End);
+			SymbolCount = 0;
+			BlockStart = Position;
+		}
+	}
+	
+	if (!IsFinal)
+	{
+		// An empty stored block ends the segment on a byte boundary without ending the stream
+		WriteBits(Writer, 0, 3);
+		AlignToByte(Writer);
+		WriteBits(Writer, 0x0000, 16);
+		WriteBits(Writer, 0xFFFF, 16);
+	}
+	AlignToByte(Writer);
+	return Writer->Count;
+}
+
+function void
+InitCRCTable()
+{
+	if (!CRCTableReady)
+	{
+		for (u32 Index = 0; Index < 256; ++Index)
+		{
+			u32 Value = Index;
+			for (s32 Bit = 0; Bit < 8; ++Bit)
+			{
+				Value = (Value & 1) ? (0xEDB88320u ^ (Value >> 1)) : (Value >> 1);
+			}
+			CRCTable[Index] = Value;
+		}
+		CRCTableReady = true;
+	}
+}
+
+function u32
+UpdateCRC(u32 CRC, u8* Data, s64 Size)
+{
+	for (s64 Index = 0; Index < Size; ++Index)
+	{
+		CRC = CRCTable[(CRC ^ Data[Index]) & 0xFF] ^ (CRC >> 8);
+	}
+	return CRC;
+}
+
+function u32
+Adler32(u8* Data, s64 Size)
+{
+	u32 A = 1;
+	u32 B = 0;
+	while (Size > 0)
+	{
+		// 5552 bytes is the most that can be summed before B could overflow
+		s64 ChunkSize = Size < 5552 ? Size : 5552;
+		for (s64 Index = 0; Index < ChunkSize; ++Index)
+		{
+			A += Data[Index];
+			B += A;
+		}
+		A %= 65521;
+		B %= 65521;
+		Data += ChunkSize;
+		Size -= ChunkSize;
+	}
+	return (B << 16) | A;
+}
+
+function void
+PutU32BE(u8* Dest, u32 Value)
+{
+	Dest[0] = (u8)(Value >> 24);
+	Dest[1] = (u8)(Value >> 16);
+	Dest[2] = (u8)(Value >> 8);
+	Dest[3] = (u8)Value;
+}
+
+function b32
+WritePNGChunk(FILE* DestFile, const char* Type, u8* Data, s64 Size)
+{
+	u8 Length[4];
+	u8 CRCBytes[4];
+	PutU32BE(Length, (u32)Size);
+	u32 CRC = UpdateCRC(0xFFFFFFFFu, (u8*)Type, 4);
+	CRC = UpdateCRC(CRC, Data, Size) ^ 0xFFFFFFFFu;
+	PutU32BE(CRCBytes, CRC);
+	
+	b32 Success = (fwrite(Length, 4, 1, DestFile) == 1 && fwrite(Type, 4, 1, DestFile) == 1);
+	if (Success && Size > 0)
+	{
+		Success = (fwrite(Data, Size, 1, DestFile) == 1);
+	}
+	if (Success)
+	{
+		Success = (fwrite(CRCBytes, 4, 1, DestFile) == 1);
+	}
+	return Success;
+}
+
+function u8
+PaethPredictor(u8 Left, u8 Up, u8 UpLeft)
+{
+	s32 Estimate = (s32)Left + (s32)Up - (s32)UpLeft;
+	s32 DistLeft = abs(Estimate - Left);
+	s32 DistUp = abs(Estimate - Up);
+	s32 DistUpLeft = abs(Estimate - UpLeft);
+	u8 Result = UpLeft;
+	if (DistLeft <= DistUp && DistLeft <= DistUpLeft)
+	{
+		Result = Left;
+	}
+	else if (DistUp <= DistUpLeft)
+	{
+		Result = Up;
+	}
+	return Result;
+}
+
+// Tries every PNG filter on a row and keeps the one with the smallest sum of absolute
+// differences, the usual heuristic for which filter will compress best
+function void
+FilterPNGRow(u8* Row, u8* PrevRow, s64 RowSize, u8* Dest, u8* Candidate)
+{
+	s64 BestScore = -1;
+	for (s32 Filter = 0; Filter < 5; ++Filter)
+	{
+		s64 Score = 0;
+		for (s64 Index = 0; Index < RowSize; ++Index)
+		{
+			u8 Left = Index >= 3 ? Row[Index - 3] : 0;
+			u8 Up = PrevRow ? PrevRow[Index] : 0;
+			u8 UpLeft = (PrevRow && Index >= 3) ? PrevRow[Index - 3] : 0;
+			u8 Predicted = 0;
+			switch (Filter)
+			{
+				case 1: Predicted = Left; break;
+				case 2: Predicted = Up; break;
+				case 3: Predicted = (u8)(((s32)Left + (s32)Up) / 2); break;
+				case 4: Predicted = PaethPredictor(Left, Up, UpLeft); break;
+			}
+			u8 Value = (u8)(Row[Index] - Predicted);
+			Candidate[Index] = Value;
+			Score += (Value < 128) ? Value : 256 - Value;
+		}
+		
+		if (BestScore < 0 || Score < BestScore)
+		{
+			BestScore = Score;
+			Dest[0] = (u8)Filter;
+			for (s64 Index = 0; Index < RowSize; ++Index)
+			{
+				Dest[1 + Index] = Candidate[Index];
+			}
+		}
+	}
+}
+
+function b32
+WritePNG(surface* Surface, const char* FileName, memory_arena* Arena)
+{
+	b32 Success = true;
+	FILE* DestFile = fopen(FileName, "wb");
+	
+	if (DestFile)
+	{
+		temporary_memory Temp = BeginTemporaryMemory(Arena);
+		InitCRCTable();
+		
+		s64 RowSize = 3*(s64)Surface->Width;
+		s64 FilteredRowSize = RowSize + 1;
+		u8* ImageData = PushArray(Arena, RowSize * Surface->Height, u8);
+		u8* FilteredData = PushArray(Arena, FilteredRowSize * Surface->Height, u8);
+		s32 ThreadCount = omp_get_max_threads();
+		u8* CandidateRows = PushArray(Arena, RowSize * ThreadCount, u8);
+		
+		#pragma omp parallel for
+		for (s32 Y = 0; Y < Surface->Height; ++Y)
+		{
+			// PNG stores rows top to bottom, while the surface starts at the bottom like TARGA
+			RGB24FromColors(Surface->Pixels + (Surface->Height - 1 - Y)*Surface->Width, Surface->Width, ImageData + Y*RowSize);
+		}
+		
+		#pragma omp parallel for
+		for (s32 Y = 0; Y < Surface->Height; ++Y)
+		{
+			FilterPNGRow(ImageData + Y*RowSize, Y > 0 ? ImageData + (Y - 1)*RowSize : 0, RowSize,
+				FilteredData + Y*FilteredRowSize, CandidateRows + omp_get_thread_num()*RowSize);
+		}
+		
+		s64 FilteredSize = FilteredRowSize * Surface->Height;
+		s32 RowsPerSegment = (s32)(PNG_SEGMENT_SIZE / FilteredRowSize);
+		if (RowsPerSegment < 1)
+		{
+			RowsPerSegment = 1;
+		}
+		s32 SegmentCount = (Surface->Height + RowsPerSegment - 1) / RowsPerSegment;
+		s64 SegmentCapacity = (s64)RowsPerSegment*FilteredRowSize;
+		SegmentCapacity += SegmentCapacity/1024 + 1024;
+		u8* SegmentData = PushArray(Arena, SegmentCapacity * SegmentCount, u8);
+		s64* SegmentSizes = PushArray(Arena, SegmentCount, s64);
+		
+		deflate_state* States = PushArray(Arena, ThreadCount, deflate_state);
+		for (s32 Index = 0; Index < ThreadCount; ++Index)
+		{
+			States[Index].Head = PushArray(Arena, 1 << DEFLATE_HASH_BITS, s32);
+			States[Index].Prev = PushArray(Arena, DEFLATE_WINDOW_SIZE, s32);
+			States[Index].Symbols = PushArray(Arena, DEFLATE_MAX_BLOCK_SYMBOLS, deflate_symbol);
+		}
+		
+		#pragma omp parallel for schedule(dynamic)
+		for (s32 Segment = 0; Segment < SegmentCount; ++Segment)
+		{
+			s64 Start = (s64)Segment*RowsPerSegment*FilteredRowSize;
+			s64 End = Start + (s64)RowsPerSegment*FilteredRowSize;
+			if (End > FilteredSize)
+			{
+				End = FilteredSize;
+			}
+			bit_writer Writer = {SegmentData + Segment*SegmentCapacity, 0, 0, 0};
+			SegmentSizes[Segment] = DeflateSegment(FilteredData, FilteredSize, Start, End, Segment == SegmentCount - 1,
+				States + omp_get_thread_num(), &Writer);
+		}
+		
+		// Stitch the zlib stream together: header, the segments in order, then the checksum
+		s64 StreamSize = 2 + 4;
+		for (s32 Segment = 0; Segment < SegmentCount; ++Segment)
+		{
+			StreamSize += SegmentSizes[Segment];
+		}
+		u8* Stream = PushArray(Arena, StreamSize, u8);
+		Stream[0] = 0x78;
+		Stream[1] = 0x01;
+		s64 StreamCount = 2;
+		for (s32 Segment = 0; Segment < SegmentCount; ++Segment)
+		{
+			u8* Source = SegmentData + Segment*SegmentCapacity;
+			for (s64 Index = 0; Index < SegmentSizes[Segment]; ++Index)
+			{
+				Stream[StreamCount++] = Source[Index];
+			}
+		}
+		PutU32BE(Stream + StreamCount, Adler32(FilteredData, FilteredSize));
+		
+		u8 Signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+		u8 ImageHeader[13];
+		PutU32BE(ImageHeader + 0, (u32)Surface->Width);
+		PutU32BE(ImageHeader + 4, (u32)Surface->Height);
+		ImageHeader[8] = 8; // Bits per channel
+		ImageHeader[9] = 2; // RGB
+		ImageHeader[10] = 0; // Deflate
+		ImageHeader[11] = 0; // Adaptive filtering
+		ImageHeader[12] = 0; // No interlacing
+		
+		Success = (fwrite(Signature, sizeof(Signature), 1, DestFile) == 1) &&
+			WritePNGChunk(DestFile, "IHDR", ImageHeader, sizeof(ImageHeader));
+		for (s64 Offset = 0; Success && Offset < StreamSize; Offset += PNG_MAX_IDAT_SIZE)
+		{
+			s64 ChunkSize = StreamSize - Offset < PNG_MAX_IDAT_SIZE ? StreamSize - Offset : PNG_MAX_IDAT_SIZE;
+			Success = WritePNGChunk(DestFile, "IDAT", Stream + Offset, ChunkSize);
+		}
+		Success = Success && WritePNGChunk(DestFile, "IEND", 0, 0);
+		
+		EndTemporaryMemory(Temp);
+		fclose(DestFile);
+	}
+	else
+	{
+		Success = false;
+	}
+	
+	return Success;
+}
\ No newline at end of file
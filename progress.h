@@ -0,0 +1,169 @@
+/*
+ * progress.h
+ *
+ * For reporting how far a render has come, and how fast, while it is still running
+ */
+
+// Each render thread stores its own ray and row counts once per row, in a cache line of its own, so
+// the only cost to the render is that store. A background thread adds them up at a fixed interval and
+// prints the progress to stderr, or rewrites a status file with it that job scripts can poll.
+
+#define PROGRESS_DEFAULT_SECONDS 10.0
+#define PROGRESS_POLL_NANOSECONDS 50000000
+
+typedef struct progress_thread
+{
+	s64 RaysCast;
+	s64 RowsDone;
+	u8 Padding[CACHE_LINE_SIZE - 2*sizeof(s64)];
+} progress_thread;
+
+typedef struct progress_reporter
+{
+	progress_thread* Threads;
+	s32 ThreadCount;
+	s32 RowCount;
+	f64 Interval;
+	const char* StatusFile; // Rewritten at every interval instead of printing, when given
+	f64 StartTime;
+	s32 Finished;
+	pthread_t Thread;
+} progress_reporter;
+
+typedef struct progress_sample
+{
+	f64 Time;
+	s64 RaysCast;
+	s64 RowsDone;
+} progress_sample;
+
+function progress_sample
+SampleProgress(progress_reporter* Progress)
+{
+	progress_sample Sample = {};
+	Sample.Time = omp_get_wtime();
+	for (s32 Index = 0; Index < Progress->ThreadCount; ++Index)
+	{
+		Sample.RaysCast += __atomic_load_n(&Progress->Threads[Index].RaysCast, __ATOMIC_RELAXED);
+		Sample.RowsDone += __atomic_load_n(&Progress->Threads[Index].RowsDone, __ATOMIC_RELAXED);
+	}
+	return Sample;
+}
+
+// The rate is over the last interval, so it follows the render through cheap and expensive parts of
+// the image. The estimate of the time left assumes the remaining rows go at the average pace so far.
+function void
+ReportProgress(progress_reporter* Progress, progress_sample* Previous, progress_sample* Current, b32 Done)
+{
+	f64 Elapsed = Current->Time - Progress->StartTime;
+	f64 Interval = Current->Time - Previous->Time;
+	f64 Fraction = Progress->RowCount > 0 ? (f64)Current->RowsDone / (f64)Progress->RowCount : 1.0;
+	f64 MRaysPerSecond = Interval > 0 ? (f64)(Current->RaysCast - Previous->RaysCast) / Interval / 1e6 : 0;
+	f64 SecondsLeft = Current->RowsDone > 0 ? Elapsed*(f64)(Progress->RowCount - Current->RowsDone) / (f64)Current->RowsDone : -1;
+	if (Progress->StatusFile)
+	{
+		// Written beside the status file and renamed over it, so a reader never sees half of it
+		char TempName[1024];
+		snprintf(TempName, sizeof(TempName), "%s.tmp", Progress->StatusFile);
+		FILE* File = fopen(TempName, "w");
+		if (File)
+		{
+			fprintf(File, "{\"percent\": %.1f, \"rows_done\": %ld, \"rows\": %d, \"rays\": %ld, \"mrays_per_s\": %.3f, "
+				"\"elapsed_s\": %.1f, \"eta_s\": ", 100.0*Fraction, Current->RowsDone, Progress->RowCount,
+				Current->RaysCast, MRaysPerSecond, Elapsed);
+			if (SecondsLeft >= 0)
+			{
+				fprintf(File, "%.1f", SecondsLeft);
+			}
+			else
+			{
+				fprintf(File, "null");
+			}
+			fprintf(File, ", \"done\": %s}\n", Done ? "true" : "false");
+			if (fclose(File) == 0)
+			{
+				rename(TempName, Progress->StatusFile);
+			}
+		}
+	}
+	else
+	{
+		fprintf(stderr, "Progress: %5.1f%% (%ld/%d rows), %.3f Mrays/s, %.1f (s) elapsed, ",
+			100.0*Fraction, Current->RowsDone, Progress->RowCount, MRaysPerSecond, Elapsed);
+		if (SecondsLeft >= 0)
+		{
+			fprintf(stderr, "ETA %.1f (s)\n", SecondsLeft);
+		}
+		else
+		{
+			fprintf(stderr, "ETA unknown\n");
+		}
+	}
+}
+
+function void*
+ProgressThread(void* Data)
+{
+	progress_reporter* Progress = (progress_reporter*)Data;
+	TraceThreadName("progress");
+	progress_sample Previous = {Progress->StartTime, 0, 0};
+	f64 NextReport = Progress->StartTime + Progress->Interval;
+	while (!__atomic_load_n(&Progress->Finished, __ATOMIC_ACQUIRE))
+	{
+		// Short sleeps, so the thread is gone soon after the render ends rather than an interval later
+		struct timespec Idle = {0, PROGRESS_POLL_NANOSECONDS};
+		nanosleep(&Idle, 0);
+		if (omp_get_wtime() >= NextReport)
+		{
+			progress_sample Current = SampleProgress(Progress);
+			ReportProgress(Progress, &Previous, &Current, false);
+			Previous = Current;
+			NextReport += Progress->Interval;
+		}
+	}
+	
+	if (Progress->StatusFile)
+	{
+		progress_sample Current = SampleProgress(Progress);
+		ReportProgress(Progress, &Previous, &Current, true);
+	}
+	return 0;
+}
+
+function b32
+BeginProgress(progress_reporter* Progress, s32 ThreadCount, s32 RowCount, f64 Interval, const char* StatusFile, memory_arena* Arena)
+{
+	*Progress = {};
+	s64 OldAlignment = Arena->Alignment;
+	SetAlignment(Arena, CACHE_LINE_SIZE);
+	Progress->Threads = PushArray(Arena, ThreadCount, progress_thread);
+	SetAlignment(Arena, OldAlignment);
+	for (s32 Index = 0; Index < ThreadCount; ++Index)
+	{
+		Progress->Threads[Index] = {};
+	}
+	Progress->ThreadCount = ThreadCount;
+	Progress->RowCount = RowCount;
+	Progress->Interval = Interval;
+	Progress->StatusFile = StatusFile;
+	Progress->StartTime = omp_get_wtime();
+	b32 Success = (pthread_create(&Progress->Thread, 0, ProgressThread, Progress) == 0);
+	return Success;
+}
+
+// Called by each render thread after every row, with the rays it has cast so far
+function void
+MarkRowProgress(progress_reporter* Progress, s32 ThreadNum, s64 RaysCast)
+{
+	progress_thread* Thread = Progress->Threads + ThreadNum;
+	__atomic_store_n(&Thread->RaysCast, RaysCast, __ATOMIC_RELAXED);
+	__atomic_store_n(&Thread->RowsDone, Thread->RowsDone + 1, __ATOMIC_RELAXED);
+}
+
+// Stops the reporter once the render is over. A status file gets its final state first.
+function void
+EndProgress(progress_reporter* Progress)
+{
+	__atomic_store_n(&Progress->Finished, true, __ATOMIC_RELEASE);
+	pthread_join(Progress->Thread, 0);
+}
\ No newline at end of file
@@ -8,6 +8,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <sys/mman.h>
+#include <emmintrin.h>
 
 #define EPSILON 0.00001f
 
@@ -19,147 +21,44 @@
 #include "random.h"
 #include "scene.h"
 #include "tga.h"
+#include "texture.h"
 
 #include <omp.h>
+#include "png.h"
+#include "pfm.h"
+#include "heatmap.h"
 #include <chrono>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
 
+#include "trace.h"
+
+#include "rowwriter.h"
+#include "progress.h"
+#include "bouncestats.h"
 #include "parser.h"
+#include "numa.h"
+#include "perfcounters.h"
 #include "spatialpartition.h"
+#include "intersect.h"
+#include "bench.h"
+#include "baseline.h"
+#include "runstats.h"
 
-function ray_hit
-RayIntersectScene(v3 RayOrigin, v3 RayDir, scene* Scene)
-{
-	ray_hit RayHit = {};
-	for (s32 Index = 0; Index < Scene->ObjectCount; ++Index)
-	{
-		object* Object = Scene->Objects + Index;
-		switch (Object->Type)
-		{
-			case Obj_Plane:
-			{
-				f32 RayDDotNormal = Dot(RayDir, Object->Plane.Normal);
-				if (Abs(RayDDotNormal) > EPSILON)
-				{
-					f32 Hit = (Object->Plane.Displacement - Dot(RayOrigin, Object->Plane.Normal)) / RayDDotNormal;
-					if (Hit > EPSILON && (RayHit.Dist == 0 || Hit < RayHit.Dist))
-					{
-						// Record a hit
-						RayHit.Dist = Hit;
-						RayHit.Object = Object;
-						RayHit.Normal = (RayDDotNormal < 0 ? Object->Plane.Normal : -Object->Plane.Normal);
-					}
-				}
-			} break;
-			
-			case Obj_Sphere:
-			{
-				v3 FromCenter = RayOrigin - Object->Sphere.Center;
-				f32 RayDDotFromCenter = Dot(RayDir, FromCenter);
-				f32 Discriminant = RayDDotFromCenter*RayDDotFromCenter - LengthSq(FromCenter) + Object->Sphere.Radius*Object->Sphere.Radius;
-				if (Discriminant > EPSILON)
-				{
-					f32 RootDisc = sqrtf(Discriminant);
-					// b32 Inside = false;
-					f32 Hit = -RayDDotFromCenter - RootDisc;
-					if (Hit <= 0)
-					{
-						Hit = -RayDDotFromCenter + RootDisc;
-						// Inside = true;
-					}
-					if (Hit > EPSILON && (RayHit.Dist == 0 || Hit < RayHit.Dist))
-					{
-						// Record a hit
-						v3 RelHitPoint = RayOrigin + RayDir*Hit - Object->Sphere.Center;
-						v3 Normal = NormOrZero(RelHitPoint);
-						RayHit.Dist = Hit;
-						RayHit.Object = Object;
-						RayHit.Normal = Normal; //(Inside ? -Normal : Normal);
-					}
-				}
-			} break;
-			
-			case Obj_Triangle:
-			{
-				v3 AB = Object->Triangle.Vertex[1] - Object->Triangle.Vertex[0];
-				v3 AC = Object->Triangle.Vertex[2] - Object->Triangle.Vertex[0];
-				v3 Normal = NormOrZero(Cross(AB, AC));
-				if (Normal != (v3){0})
-				{
-					f32 RayDDotNormal = Dot(RayDir, Normal);
-					if (Abs(RayDDotNormal) > EPSILON)
-					{
-						f32 Hit = Dot(Object->Triangle.Vertex[0] - RayOrigin, Normal) / RayDDotNormal;
-						if (Hit > EPSILON && (RayHit.Dist == 0 || Hit < RayHit.Dist))
-						{
-							v3 HitP = RayOrigin + RayDir*Hit;
-							v3 AP = HitP - Object->Triangle.Vertex[0];
-							f32 ABDotAC = Dot(AB, AC);
-							v3 ABPerp = AC - AB*(ABDotAC/LengthSq(AB));
-							f32 V = Dot(AP, ABPerp)/LengthSq(ABPerp);
-							if (V > 0)
-							{
-								v3 ACPerp = AB - AC*(ABDotAC/LengthSq(AC));
-								f32 U = Dot(AP, ACPerp)/LengthSq(ACPerp);
-								if (U > 0 && U + V < 1.0f)
-								{
-									// Record a hit
-									RayHit.Dist = Hit;
-									RayHit.Object = Object;
-									RayHit.Normal = (RayDDotNormal < 0 ? Normal : -Normal);
-									RayHit.UV = (uv){U, V};
-								}
-							}
-						}
-					}
-				}
-			} break;
-			
-			case Obj_Parallelogram:
-			{
-				v3 Normal = NormOrZero(Cross(Object->Parallelogram.XAxis, Object->Parallelogram.YAxis));
-				if (Normal != (v3){0})
-				{
-					f32 RayDDotNormal = Dot(RayDir, Normal);
-					if (Abs(RayDDotNormal) > EPSILON)
-					{
-						f32 Hit = Dot(Object->Parallelogram.Origin - RayOrigin, Normal) / RayDDotNormal;
-						if (Hit > EPSILON && (RayHit.Dist == 0 || Hit < RayHit.Dist))
-						{
-							v3 HitP = RayOrigin + RayDir*Hit;
-							v3 AP = HitP - Object->Parallelogram.Origin;
-							f32 ABDotAC = Dot(Object->Parallelogram.XAxis, Object->Parallelogram.YAxis);
-							v3 ABPerp = Object->Parallelogram.YAxis - Object->Parallelogram.XAxis*(ABDotAC/LengthSq(Object->Parallelogram.XAxis));
-							f32 V = Dot(AP, ABPerp)/LengthSq(ABPerp);
-							if (V > 0)
-							{
-								v3 ACPerp = Object->Parallelogram.XAxis - Object->Parallelogram.YAxis*(ABDotAC/LengthSq(Object->Parallelogram.YAxis));
-								f32 U = Dot(AP, ACPerp)/LengthSq(ACPerp);
-								if (U > 0 && U < 1.0f && V < 1.0f)
-								{
-									// Record a hit
-									RayHit.Dist = Hit;
-									RayHit.Object = Object;
-									RayHit.Normal = (RayDDotNormal < 0 ? Normal : -Normal);
-									RayHit.UV = (uv){U, V};
-								}
-							}
-						}
-					}
-				}
-			} break;
-			
-			default:
-			{
-				fprintf(stderr, "Error: Encountered object of type %d in RayIntersectScene!\n", Object->Type);
-			} break;
-		}
-	}
-	
-	return RayHit;
-}
-
-function void
-RayTrace(scene* Scene, surface* Surface, s32 SamplesPerPixel, s32 MaxBounces, memory_arena* ScratchArena, b32 DebugOn)
+function ray_trace_stats
+RayTrace(scene* Scene, surface* Surface, s32 SamplesPerPixel, s32 MaxBounces, u64 Seed, b32 FilterTextures, memory_arena* ScratchArena, thread_arenas* ThreadArenas,
+	numa_replicas* Replicas, row_writer* RowWriter, pixel_costs* Costs, progress_reporter* Progress, ray_trace_stats* ThreadStats, bounce_stats* BounceStats, b32 CountHardwareEvents, b32 PrintStats, b32 DebugOn)
 {
 	temporary_memory Temp = BeginTemporaryMemory(ScratchArena);
 	b32 HitTexture = false; // Debug purposes
@@ -169,19 +68,28 @@ RayTrace(scene* Scene, surface* Surface, s32 SamplesPerPixel, s32 MaxBounces, me
 	f32 SampleWidth = PixelWidth / (f32) SamplesPerPixel;
 	f32 SampleHeight = PixelHeight / (f32) SamplesPerPixel;
 	f32 SampleWeight = 1.0f / (SamplesPerPixel*SamplesPerPixel);
+	f32 SampleSpread = sqrtf(SampleWidth*SampleHeight) / Scene->Camera.DistToSurface; // Angle covered by one sample's ray cone
 	v3 SurfaceOrigin = Scene->Camera.XAxis*(-0.5f*Scene->Camera.SurfaceWidth + 0.5f*SampleWidth) + Scene->Camera.YAxis*(-0.5f*Scene->Camera.SurfaceHeight + 0.5f*SampleHeight) - Scene->Camera.ZAxis*Scene->Camera.DistToSurface;
 	
-	s64 OldAlignment = ScratchArena->Alignment;
-	SetAlignment(ScratchArena, 64); // Make sure to align to cache lines to avoid false sharing
-	ray_trace_stats* AllStats = PushArray(ScratchArena, 0, ray_trace_stats); // Just find the location of the start, reserve the right number later ;)
+	ray_trace_stats** AllStats = PushArray(ScratchArena, ThreadArenas->Count, ray_trace_stats*);
+	bounce_stats** AllBounces = BounceStats ? PushArray(ScratchArena, ThreadArenas->Count, bounce_stats*) : 0;
 	s32 NumThreads;
-	#pragma omp parallel
+	#pragma omp parallel num_threads(ThreadArenas->Count)
 	{
 		s32 ThreadNum = omp_get_thread_num();
+		memory_arena* ThreadArena = &ThreadArenas->Threads[ThreadNum].Arena;
+		
+		// Intersect against this NUMA node's copy of the objects, if there is one
+		scene* ThreadScene = Scene;
+		GetNumaReplica(Replicas, &ThreadScene, 0);
+		
 		if (ThreadNum == 0)
 		{
 			NumThreads = omp_get_num_threads();
-			printf("%d Threads...\n", NumThreads);
+			if (PrintStats)
+			{
+				printf("%d Threads...\n", NumThreads);
+			}
 			if (DebugOn)
 			{
 				printf("--DEBUG OUTPUT--\n");
@@ -189,12 +97,32 @@ RayTrace(scene* Scene, surface* Surface, s32 SamplesPerPixel, s32 MaxBounces, me
 		}
 		
 		ray_trace_stats Stats = {};
-		#pragma omp for
+		bounce_stats* Bounces = 0;
+		if (BounceStats)
+		{
+			Bounces = PushStruct(ThreadArena, bounce_stats);
+			*Bounces = {};
+		}
+		perf_counters Counters = {};
+		if (CountHardwareEvents)
+		{
+			Counters = OpenPerfCounters();
+			StartPerfCounters(&Counters);
+		}
+		
+		// No barrier at the end of the rows, so the counters stop before the thread waits for the others
+		#pragma omp for nowait
 		for (s32 Y = 0; Y < Surface->Height; ++Y)
 		{
-			random_sequence RNG = SeedRandom(4815162342ull*(Y + 1) + 1123581321ull); // Make sure each thread has own random sequence. This keeps it deterministic
+			f64 RowStartTime = omp_get_wtime();
+			temporary_memory RowTemp = BeginTemporaryMemory(ThreadArena); // Anything allocated for a row is freed after it
+			random_sequence RNG = SeedRandom(4815162342ull*(Y + 1) + 1123581321ull + Seed*2654435761ull); // Make sure each thread has own random sequence. This keeps it deterministic
 			for (s32 X = 0; X < Surface->Width; ++X)
 			{
+				s64 RaysBefore = Stats.RaysCast;
+				s64 NodesBefore = Stats.SpatialNodesChecked;
+				s64 ObjectsBefore = Stats.ObjectsChecked;
+				f64 PixelStartTime = Costs ? omp_get_wtime() : 0;
 				color PixelColor = {};
 				for (s32 J = 0; J < SamplesPerPixel; ++J)
 				{
@@ -212,8 +140,21 @@ RayTrace(scene* Scene, surface* Surface, s32 SamplesPerPixel, s32 MaxBounces, me
 						v3 RayDir = NormOrZero(SurfaceOrigin + SurfaceX + SurfaceY);
 						
 						color SampleColor = {1.0f, 1.0f, 1.0f};
+						f32 ConeWidth = 0;
+						f32 ConeSpread = SampleSpread;
+						b32 Escaped = false;
+						if (Bounces)
+						{
+							++Bounces->Paths;
+						}
 						for (s32 Bounce = 0; Bounce < MaxBounces; ++Bounce)
 						{
+							bounce_depth_stats* BounceDepth = Bounces ? GetBounceDepth(Bounces, Bounce) : 0;
+							if (BounceDepth)
+							{
+								++BounceDepth->Rays;
+								BounceDepth->ThroughputSum += GetThroughput(SampleColor);
+							}
 							++Stats.RaysCast;
 							
 							if (DebugOn && Debug)
@@ -224,12 +165,13 @@ RayTrace(scene* Scene, surface* Surface, s32 SamplesPerPixel, s32 MaxBounces, me
 									RayOrigin.X, RayOrigin.Y, RayOrigin.Z, RayDir.X, RayDir.Y, RayDir.Z);
 							}
 							
-							ray_hit Hit = RayIntersectScene(RayOrigin, RayDir, Scene);
-							Stats.ObjectsChecked += Scene->ObjectCount;
+							ray_hit Hit = RayIntersectScene(RayOrigin, RayDir, ThreadScene, &Stats);
 							if (Hit.Dist > 0)
 							{
 								RayOrigin = RayOrigin + RayDir*Hit.Dist;
 								f32 RayDDotNormal = Dot(RayDir, Hit.Normal);
+								material* Material = ThreadScene->Materials + Hit.Object->Material;
+								ConeWidth += ConeSpread*Hit.Dist;
 								
 								if (DebugOn && Debug)
 								{
@@ -246,11 +188,15 @@ RayTrace(scene* Scene, surface* Surface, s32 SamplesPerPixel, s32 MaxBounces, me
 								
 								// Bounce direction
 								f32 Random = RandomUnilateral(&RNG);
-								if (Random < Hit.Object->Translucency)
+								if (Random < Material->Translucency)
 								{
 									// Pass through the object
+									if (BounceDepth)
+									{
+										++BounceDepth->Translucent;
+									}
 									v3 ParallelComponent = RayDir - Hit.Normal*RayDDotNormal;
-									f32 RefractionCoeff = 1.0f + Hit.Object->Refraction;
+									f32 RefractionCoeff = 1.0f + Material->Refraction;
 									if (RayDDotNormal < 0)
 									{
 										RefractionCoeff = 1.0f / RefractionCoeff;
@@ -268,19 +214,28 @@ RayTrace(scene* Scene, surface* Surface, s32 SamplesPerPixel, s32 MaxBounces, me
 									{
 										RandomBounce = -RandomBounce;
 									}
-									RayDir = NormOrDefault(Lerp(RandomBounce, Hit.Object->Glossy, Reflection), Hit.Normal);
+									RayDir = NormOrDefault(Lerp(RandomBounce, Material->Glossy, Reflection), Hit.Normal);
 									Falloff = Abs(Dot(RayDir, Hit.Normal));
+									ConeSpread += (1.0f - Material->Glossy)*RAY_CONE_DIFFUSE_SPREAD;
 								}
 								RayOrigin = RayOrigin + EPSILON*RayDir; // Try to move a little away from the surface to "de-bounce"
 								
-								if (Hit.Object->Texture.Index > 0)
+								if (Material->Texture.Index > 0)
 								{
-									surface* Texture = Scene->Textures + Hit.Object->Texture.Index - 1;
-									v2 SampleUV = Lerp(Hit.Object->UVMap.VertexUV[0], Hit.UV.U, Hit.Object->UVMap.VertexUV[1]) +
-										Lerp(Hit.Object->UVMap.VertexUV[0], Hit.UV.V, Hit.Object->UVMap.VertexUV[2]);
-									s32 SampleX = (s32)(SampleUV.U*(f32)Texture->Width) % Texture->Width;
-									s32 SampleY = (s32)(SampleUV.V*(f32)Texture->Height) % Texture->Height;
-									color TextureColor = Texture->Pixels[SampleY*Texture->Width + SampleX];
+									texture* Texture = Scene->Textures + Material->Texture.Index - 1;
+									v2 SampleUV = Lerp(Material->UVMap.VertexUV[0], Hit.UV.U, Material->UVMap.VertexUV[1]) +
+										Lerp(Material->UVMap.VertexUV[0], Hit.UV.V, Material->UVMap.VertexUV[2]);
+									f32 LevelOfDetail = 0;
+									color TextureColor;
+									if (FilterTextures)
+									{
+										LevelOfDetail = TextureLevelOfDetail(Texture, Hit.Object, Hit.Instance, Material, ConeWidth, RayDDotNormal);
+										TextureColor = SampleTexture(Texture, SampleUV, LevelOfDetail);
+									}
+									else
+									{
+										TextureColor = SampleTextureNearest(Texture, SampleUV);
+									}
 									
 									if (DebugOn && Debug && !HitTexture && Bounce == 0)
 									{
@@ -288,9 +243,9 @@ RayTrace(scene* Scene, surface* Surface, s32 SamplesPerPixel, s32 MaxBounces, me
 										printf("X(%d) Y(%d)\n",
 											X, Y);
 										printf("ObjectType(%d) Texture(%d)\n",
-											Hit.Object->Type, Hit.Object->Texture.Index);
-										printf("SampleUV(%.2f,%.2f) SampleX(%d) SampleY(%d)\n",
-											SampleUV.U, SampleUV.V, SampleX, SampleY);
+											Hit.Object->Type, Material->Texture.Index);
+										printf("SampleUV(%.2f,%.2f) LevelOfDetail(%.2f)\n",
+											SampleUV.U, SampleUV.V, LevelOfDetail);
 									}
 									
 									SampleColor.R *= TextureColor.R*Falloff;
@@ -299,9 +254,9 @@ RayTrace(scene* Scene, surface* Surface, s32 SamplesPerPixel, s32 MaxBounces, me
 								}
 								else
 								{
-									SampleColor.R *= Hit.Object->Color.R*Falloff;
-									SampleColor.G *= Hit.Object->Color.G*Falloff;
-									SampleColor.B *= Hit.Object->Color.B*Falloff;
+									SampleColor.R *= Material->Color.R*Falloff;
+									SampleColor.G *= Material->Color.G*Falloff;
+									SampleColor.B *= Material->Color.B*Falloff;
 								}
 								
 								if (DebugOn && Debug)
@@ -315,9 +270,18 @@ RayTrace(scene* Scene, surface* Surface, s32 SamplesPerPixel, s32 MaxBounces, me
 								SampleColor.R *= Scene->SkyColor.R;
 								SampleColor.G *= Scene->SkyColor.G;
 								SampleColor.B *= Scene->SkyColor.B;
+								if (BounceDepth)
+								{
+									++BounceDepth->Escapes;
+								}
+								Escaped = true;
 								break;
 							}
 						}
+						if (Bounces && !Escaped)
+						{
+							RecordCutOff(Bounces, SampleColor);
+						}
 						
 						PixelColor.R += SampleColor.R;
 						PixelColor.G += SampleColor.G;
@@ -325,11 +289,39 @@ RayTrace(scene* Scene, surface* Surface, s32 SamplesPerPixel, s32 MaxBounces, me
 					}
 				}
 				Surface->Pixels[Y*Surface->Width + X] = PixelColor*SampleWeight;
+				if (Costs)
+				{
+					s64 Index = (s64)Y*Surface->Width + X;
+					Costs->Values[PixelCost_Rays][Index] = (f32)(Stats.RaysCast - RaysBefore);
+					Costs->Values[PixelCost_Nodes][Index] = (f32)(Stats.SpatialNodesChecked - NodesBefore);
+					Costs->Values[PixelCost_Objects][Index] = (f32)(Stats.ObjectsChecked - ObjectsBefore);
+					Costs->Values[PixelCost_Nanoseconds][Index] = (f32)((omp_get_wtime() - PixelStartTime)*1e9);
+				}
+			}
+			if (RowWriter)
+			{
+				MarkRowDone(RowWriter, Y);
 			}
+			if (Progress)
+			{
+				MarkRowProgress(Progress, ThreadNum, Stats.RaysCast);
+			}
+			EndTemporaryMemory(RowTemp);
+			Stats.BusySeconds += omp_get_wtime() - RowStartTime;
+			TraceEvent("row", RowStartTime, Y);
+		}
+		if (CountHardwareEvents)
+		{
+			Stats.Counters = StopPerfCounters(&Counters);
+			ClosePerfCounters(&Counters);
+		}
+		AllStats[ThreadNum] = PushStruct(ThreadArena, ray_trace_stats);
+		*AllStats[ThreadNum] = Stats;
+		if (Bounces)
+		{
+			AllBounces[ThreadNum] = Bounces;
 		}
-		AllStats[ThreadNum] = Stats;
 	}
-	PushArray(ScratchArena, NumThreads, ray_trace_stats); // Actually reserve the space :)
 	
 	if (DebugOn)
 	{
@@ -339,28 +331,80 @@ RayTrace(scene* Scene, surface* Surface, s32 SamplesPerPixel, s32 MaxBounces, me
 	ray_trace_stats OverallStats = {};
 	for (s32 Index = 0; Index < NumThreads; ++Index)
 	{
-		printf("Thread %d: %ld rays cast, %ld objects checked, %ld samples computed\n",
-			Index, AllStats[Index].RaysCast, AllStats[Index].ObjectsChecked, AllStats[Index].SamplesComputed);
-		OverallStats.RaysCast += AllStats[Index].RaysCast;
-		OverallStats.ObjectsChecked += AllStats[Index].ObjectsChecked;
-		OverallStats.SamplesComputed += AllStats[Index].SamplesComputed;
+		// Callers collecting the per-thread stats get them in ThreadStats rather than one line per thread
+		if (ThreadStats)
+		{
+			ThreadStats[Index] = *AllStats[Index];
+		}
+		else if (PrintStats)
+		{
+			printf("Thread %d: %ld rays cast, %ld objects checked, %ld samples computed, %6.4f (s) busy\n",
+				Index, AllStats[Index]->RaysCast, AllStats[Index]->ObjectsChecked, AllStats[Index]->SamplesComputed, AllStats[Index]->BusySeconds);
+			if (CountHardwareEvents)
+			{
+				PrintPerfCounts("\tCounters", &AllStats[Index]->Counters);
+			}
+		}
+		OverallStats.RaysCast += AllStats[Index]->RaysCast;
+		OverallStats.ObjectsChecked += AllStats[Index]->ObjectsChecked;
+		OverallStats.SamplesComputed += AllStats[Index]->SamplesComputed;
+		OverallStats.BusySeconds += AllStats[Index]->BusySeconds;
+		AddPerfCounts(&OverallStats.Counters, &AllStats[Index]->Counters);
+		if (AllStats[Index]->BusySeconds > OverallStats.MaxBusySeconds)
+		{
+			OverallStats.MaxBusySeconds = AllStats[Index]->BusySeconds;
+		}
+	}
+	OverallStats.ThreadCount = NumThreads;
+	if (BounceStats)
+	{
+		*BounceStats = {};
+		BounceStats->MaxBounces = MaxBounces;
+		for (s32 Index = 0; Index < NumThreads; ++Index)
+		{
+			AddBounceStats(BounceStats, AllBounces[Index]);
+		}
+	}
+	if (PrintStats)
+	{
+		printf("--------\n");
+		printf("Overall: %ld rays cast, %ld objects checked, %ld samples computed, load imbalance %.2f\n",
+			OverallStats.RaysCast, OverallStats.ObjectsChecked, OverallStats.SamplesComputed, GetLoadImbalance(&OverallStats));
+		if (CountHardwareEvents)
+		{
+			PrintPerfCounts("Overall counters", &OverallStats.Counters);
+		}
 	}
-	printf("--------\n");
-	printf("Overall: %ld rays cast, %ld objects checked, %ld samples computed\n",
-		OverallStats.RaysCast, OverallStats.ObjectsChecked, OverallStats.SamplesComputed);
 	
+	// The per-thread stats were the last thing left in the thread arenas, so the pass is done with them
+	for (s32 Index = 0; Index < NumThreads; ++Index)
+	{
+		ResetArena(&ThreadArenas->Threads[Index].Arena);
+	}
 	EndTemporaryMemory(Temp);
-	SetAlignment(ScratchArena, OldAlignment);
+	return OverallStats;
 }
 
 function surface
-CreateSurface(s32 Width, s32 Height, memory_arena* Arena)
+CreateSurface(s32 Width, s32 Height, memory_arena* Arena, s32 ThreadCount = 1)
 {
 	surface Surface = {
 		.Width = Width,
 		.Height = Height,
 		.Pixels = PushArray(Arena, Width * Height, color),
 	};
+	
+	// First touch the rows with the same distribution the render uses so each row's pages
+	// end up on the NUMA node of the thread that will write them
+	#pragma omp parallel for num_threads(ThreadCount)
+	for (s32 Y = 0; Y < Height; ++Y)
+	{
+		color* Row = Surface.Pixels + Y*Width;
+		for (s32 X = 0; X < Width; ++X)
+		{
+			Row[X] = {};
+		}
+	}
 	return Surface;
 }
 
@@ -393,6 +437,9 @@ TestRNG()
 	printf("\n");
 }
 
+#define MAX_MERGE_FILES 256
+#define MAX_SCALING_STEPS 64
+
 typedef struct command_options
 {
 	b32 Error;
@@ -402,11 +449,32 @@ typedef struct command_options
 	s32 VerticalResolution;
 	s32 SamplesPerPixel;
 	s32 MaxBounces;
+	b32 FilterTextures;
 	b32 UseSpatialPartition;
 	s32 MaxObjectsPerLeaf;
 	s32 MaxLeafDepth;
 	f32 MaxDistance;
 	b32 Debug;
+	b32 Watch;
+	s32 HugePages;
+	b32 NumaReplicate;
+	b32 NumaReport;
+	b32 CompressOutput;
+	u64 Seed;
+	s32 MergeFileCount;
+	const char* MergeFiles[MAX_MERGE_FILES];
+	const char* BenchFile;
+	s32 ScalingCount;
+	s32 ScalingThreads[MAX_SCALING_STEPS];
+	const char* HeatmapPrefix;
+	const char* StatsFile;
+	const char* TraceFile;
+	b32 PerfCounters;
+	const char* BaselineFile;
+	b32 UpdateBaseline;
+	f64 ProgressSeconds;
+	const char* ProgressFile;
+	b32 BounceStats;
 } command_options;
 
 function command_options
@@ -422,10 +490,31 @@ DefaultOptions()
 		16,
 		4,
 		true,
+		true,
 		8,
 		30,
 		F32Max,
 		false,
+		false,
+		HugePages_None,
+		false,
+		false,
+		false,
+		0,
+		0,
+		{},
+		0,
+		0,
+		{},
+		0,
+		0,
+		0,
+		false,
+		0,
+		false,
+		0,
+		0,
+		false,
 	};
 	return Default;
 }
@@ -448,7 +537,13 @@ ParseArgs(int ArgCount, char** Args)
 			printf("\tDefault: -s %s\n", Defaults.SceneFile);
 			printf("-o, --output\n");
 			printf("\tSpecifies the location of the .tga file into which to write the output.\n");
+			printf("\tIf the name ends in .png, the output is written as a PNG file instead.\n");
+			printf("\tIf it ends in .pfm, the linear float colors are written as a PFM file,\n");
+			printf("\tfollowed by the number of samples in each pixel, so renders can be merged.\n");
 			printf("\tDefault: -o %s\n", Defaults.OutputFile);
+			printf("-c, --compress\n");
+			printf("\tBoolean flag that, if present, writes the output .tga file with run-length\n");
+			printf("\tencoding.\n");
 			printf("-r, --resolution\n");
 			printf("\tSpecifies the vertical resolution of the output image.\n");
 			printf("\tThe horizontal resolution is calculated from the aspect ratio of the\n");
@@ -462,9 +557,75 @@ ParseArgs(int ArgCount, char** Args)
 			printf("-b, --bounces\n");
 			printf("\tSpecifies the maximum number of bounces per ray.\n");
 			printf("\tDefault: -b %d\n", Defaults.MaxBounces);
+			printf("-sd, --seed\n");
+			printf("\tSpecifies a seed for the random sequences used while rendering. Renders\n");
+			printf("\twith different seeds can be merged into a less noisy image.\n");
+			printf("\tDefault: -sd %lu\n", Defaults.Seed);
+			printf("-hm, --heatmap\n");
+			printf("\tSpecifies a path prefix for per-pixel cost maps of the render. For each of\n");
+			printf("\trays, nodes, objects and ns (nanoseconds), <prefix>_<cost>.tga shows the\n");
+			printf("\tcost in false color and <prefix>_<cost>.pfm holds the raw float values.\n");
+			printf("-sj, --stats-json\n");
+			printf("\tSpecifies a file to write the stats of the render to as JSON: timings for\n");
+			printf("\tparsing, texture loading, building, rendering and writing, the shape of the\n");
+			printf("\tspatial partition, the counters of every thread and the peak use of every\n");
+			printf("\tarena. The per-thread lines are then left out of the printed stats.\n");
+			printf("-tr, --trace\n");
+			printf("\tSpecifies a file to write a timeline of the run to, in the Chrome trace\n");
+			printf("\tformat that Perfetto (ui.perfetto.dev) opens. It shows the scene load,\n");
+			printf("\ttexture loads, partition builds, every row on the thread that rendered it\n");
+			printf("\tand every row the background writer wrote.\n");
+			printf("-pc, --perf-counters\n");
+			printf("\tCounts cycles, instructions, L1 data cache misses, last level cache misses\n");
+			printf("\tand branch misses with perf_event_open. They are reported for the scene load,\n");
+			printf("\tthe build and the write on the main thread, and for every render thread.\n");
+			printf("\tCounters the system does not allow are reported as n/a. Each thread opens\n");
+			printf("\tits own, so the limit on open files is raised as far as it goes, and the\n");
+			printf("\toverall counts say how many threads did not count.\n");
+			printf("-bs, --bounce-stats\n");
+			printf("\tBoolean flag that, if present, reports for each bounce the rays cast, the\n");
+			printf("\tshare that escaped to the sky or passed through a translucent object, the\n");
+			printf("\tmean throughput and the paths left, and how many paths were cut off by -b\n");
+			printf("\twhile still carrying a significant share of their light.\n");
+			printf("-pg, --progress\n");
+			printf("\tSpecifies an interval in seconds at which to print the progress of the\n");
+			printf("\trender to stderr: the percentage of rows done, the rays per second over\n");
+			printf("\tthe last interval and an estimate of the time left.\n");
+			printf("-pf, --progress-file\n");
+			printf("\tSpecifies a file to rewrite with the progress as JSON at every interval,\n");
+			printf("\tinstead of printing it. Without --progress the interval is %.0f seconds.\n", PROGRESS_DEFAULT_SECONDS);
+			printf("-m, --merge\n");
+			printf("\tSpecifies a .pfm render to merge instead of rendering a scene. Give it once\n");
+			printf("\tper file. The renders are averaged, weighted by their sample counts, and\n");
+			printf("\twritten to the output file.\n");
+			printf("-bn, --bench\n");
+			printf("\tSpecifies a bench manifest to run instead of rendering a scene. Every\n");
+			printf("\tcombination of the scenes, resolutions, samples, bounces, thread counts and\n");
+			printf("\tspatial partition settings it lists is rendered after warm-up runs, and\n");
+			printf("\tthe timings are written as CSV, or as JSON if the results file ends in\n");
+			printf("\t.json. Settings the manifest leaves out come from the other options.\n");
+			printf("-sc, --scaling\n");
+			printf("\tSpecifies a comma separated list of thread counts, like 1,2,4,8, to render\n");
+			printf("\tthe scene with instead of writing an output image. The scene and spatial\n");
+			printf("\tpartition are loaded once, threads are pinned to spread over the CPUs, and\n");
+			printf("\tthe speedup, parallel efficiency and load imbalance of each count are\n");
+			printf("\treported relative to the first one.\n");
+			printf("-cb, --compare-baseline\n");
+			printf("\tSpecifies a baseline file to check instead of rendering a scene. Every case\n");
+			printf("\tit lists is loaded, built and rendered several times, and the median times\n");
+			printf("\tare compared with the stored ones, allowing for the noise of both runs. The\n");
+			printf("\trender is compared with the case's reference image by PSNR. Exits with an\n");
+			printf("\terror if any case got slower, cast different rays or changed its image.\n");
+			printf("-ub, --update-baseline\n");
+			printf("\tBoolean flag that, if present, makes --compare-baseline store the timings\n");
+			printf("\tand reference images of this machine instead of comparing against them.\n");
 			printf("-ns, --no-spatial-partition\n");
 			printf("\tBoolean flag that, if present, turns off the use of the spatial\n");
 			printf("\tpartition and reverts to a flat list of all scene objects.\n");
+			printf("-nf, --no-texture-filtering\n");
+			printf("\tBoolean flag that, if present, samples the nearest texel of the full\n");
+			printf("\tresolution texture instead of filtering between mipmap levels picked\n");
+			printf("\tfrom each ray's footprint.\n");
 			printf("-ol, --objects-per-leaf\n");
 			printf("\tSpecifies the maximum number of objects per leaf in the spatial\n");
 			printf("\tpartition.\n");
@@ -478,6 +639,21 @@ ParseArgs(int ArgCount, char** Args)
 			printf("\tDefault: -di %f\n", Defaults.MaxDistance);
 			printf("-d, --debug\n");
 			printf("\tBoolean flag that, if present, turns on printing of debug information.\n");
+			printf("-w, --watch\n");
+			printf("\tBoolean flag that, if present, keeps the scene loaded after rendering and\n");
+			printf("\tre-renders whenever the scene file changes. Spatial partitions and textures\n");
+			printf("\tare only rebuilt or reloaded when the changes require it.\n");
+			printf("-hp, --huge-pages\n");
+			printf("\tSpecifies whether memory arenas are backed by huge pages: 'none',\n");
+			printf("\t'transparent' (madvise) or 'explicit' (2 MB pages from the hugetlb pool as\n");
+			printf("\tmemory is used, and ordinary pages once the pool runs out).\n");
+			printf("\tDefault: -hp none\n");
+			printf("-nr, --numa-replicate\n");
+			printf("\tBoolean flag that, if present, gives each NUMA node its own copy of the\n");
+			printf("\ttop-level objects, materials and spatial partition for rendering.\n");
+			printf("-nm, --numa-report\n");
+			printf("\tBoolean flag that, if present, prints which NUMA nodes hold the pages of\n");
+			printf("\tthe framebuffer, objects, materials and spatial partition after rendering.\n");
 			if (ArgCount == 2)
 			{
 				Options.PerformRender = false;
@@ -509,6 +685,195 @@ ParseArgs(int ArgCount, char** Args)
 				fprintf(stderr, "No argument given after --output\n");
 			}
 		}
+		else if (CStrEq(Arg, "-sd") || CStrEq(Arg, "--seed"))
+		{
+			++ArgIndex;
+			if (ArgIndex < ArgCount)
+			{
+				char* End = 0;
+				u64 Seed = strtoull(Args[ArgIndex], &End, 10);
+				if (End != Args[ArgIndex] && *End == 0)
+				{
+					Options.Seed = Seed;
+				}
+				else
+				{
+					Options.Error = true;
+					fprintf(stderr, "Invalid seed: '%s'\n", Args[ArgIndex]);
+				}
+			}
+			else
+			{
+				Options.Error = true;
+				fprintf(stderr, "No argument given after --seed\n");
+			}
+		}
+		else if (CStrEq(Arg, "-hm") || CStrEq(Arg, "--heatmap"))
+		{
+			++ArgIndex;
+			if (ArgIndex < ArgCount)
+			{
+				Options.HeatmapPrefix = Args[ArgIndex];
+			}
+			else
+			{
+				Options.Error = true;
+				fprintf(stderr, "No argument given after --heatmap\n");
+			}
+		}
+		else if (CStrEq(Arg, "-sj") || CStrEq(Arg, "--stats-json"))
+		{
+			++ArgIndex;
+			if (ArgIndex < ArgCount)
+			{
+				Options.StatsFile = Args[ArgIndex];
+			}
+			else
+			{
+				Options.Error = true;
+				fprintf(stderr, "No argument given after --stats-json\n");
+			}
+		}
+		else if (CStrEq(Arg, "-tr") || CStrEq(Arg, "--trace"))
+		{
+			++ArgIndex;
+			if (ArgIndex < ArgCount)
+			{
+				Options.TraceFile = Args[ArgIndex];
+			}
+			else
+			{
+				Options.Error = true;
+				fprintf(stderr, "No argument given after --trace\n");
+			}
+		}
+		else if (CStrEq(Arg, "-bs") || CStrEq(Arg, "--bounce-stats"))
+		{
+			Options.BounceStats = true;
+		}
+		else if (CStrEq(Arg, "-pg") || CStrEq(Arg, "--progress"))
+		{
+			++ArgIndex;
+			if (ArgIndex < ArgCount)
+			{
+				f64 ProgressSeconds = strtod(Args[ArgIndex], 0);
+				if (ProgressSeconds > 0)
+				{
+					Options.ProgressSeconds = ProgressSeconds;
+				}
+				else
+				{
+					Options.Error = true;
+					fprintf(stderr, "Invalid progress interval: '%s'\n", Args[ArgIndex]);
+				}
+			}
+			else
+			{
+				Options.Error = true;
+				fprintf(stderr, "No argument given after --progress\n");
+			}
+		}
+		else if (CStrEq(Arg, "-pf") || CStrEq(Arg, "--progress-file"))
+		{
+			++ArgIndex;
+			if (ArgIndex < ArgCount)
+			{
+				Options.ProgressFile = Args[ArgIndex];
+			}
+			else
+			{
+				Options.Error = true;
+				fprintf(stderr, "No argument given after --progress-file\n");
+			}
+		}
+		else if (CStrEq(Arg, "-m") || CStrEq(Arg, "--merge"))
+		{
+			++ArgIndex;
+			if (ArgIndex < ArgCount)
+			{
+				if (Options.MergeFileCount < MAX_MERGE_FILES)
+				{
+					Options.MergeFiles[Options.MergeFileCount++] = Args[ArgIndex];
+				}
+				else
+				{
+					Options.Error = true;
+					fprintf(stderr, "Too many files to merge, the limit is %d\n", MAX_MERGE_FILES);
+				}
+			}
+			else
+			{
+				Options.Error = true;
+				fprintf(stderr, "No argument given after --merge\n");
+			}
+		}
+		else if (CStrEq(Arg, "-bn") || CStrEq(Arg, "--bench"))
+		{
+			++ArgIndex;
+			if (ArgIndex < ArgCount)
+			{
+				Options.BenchFile = Args[ArgIndex];
+			}
+			else
+			{
+				Options.Error = true;
+				fprintf(stderr, "No argument given after --bench\n");
+			}
+		}
+		else if (CStrEq(Arg, "-cb") || CStrEq(Arg, "--compare-baseline"))
+		{
+			++ArgIndex;
+			if (ArgIndex < ArgCount)
+			{
+				Options.BaselineFile = Args[ArgIndex];
+			}
+			else
+			{
+				Options.Error = true;
+				fprintf(stderr, "No argument given after --compare-baseline\n");
+			}
+		}
+		else if (CStrEq(Arg, "-ub") || CStrEq(Arg, "--update-baseline"))
+		{
+			Options.UpdateBaseline = true;
+		}
+		else if (CStrEq(Arg, "-sc") || CStrEq(Arg, "--scaling"))
+		{
+			++ArgIndex;
+			if (ArgIndex < ArgCount)
+			{
+				char* Next = Args[ArgIndex];
+				Options.ScalingCount = 0;
+				while (!Options.Error)
+				{
+					char* End = 0;
+					s32 Threads = (s32)strtol(Next, &End, 10);
+					if (End == Next || Threads < 1 || Options.ScalingCount >= MAX_SCALING_STEPS || (*End != ',' && *End != 0))
+					{
+						Options.Error = true;
+						fprintf(stderr, "Invalid thread counts: '%s'\n", Args[ArgIndex]);
+					}
+					else
+					{
+						Options.ScalingThreads[Options.ScalingCount++] = Threads;
+						if (*End == 0)
+						{
+							break;
+						}
+						Next = End + 1;
+					}
+				}
+			}
+			else
+			{
+				Options.Error = true;
+				fprintf(stderr, "No argument given after --scaling\n");
+			}
+		}
+		else if (CStrEq(Arg, "-c") || CStrEq(Arg, "--compress"))
+		{
+			Options.CompressOutput = true;
+		}
 		else if (CStrEq(Arg, "-r") || CStrEq(Arg, "--resolution"))
 		{
 			++ArgIndex;
@@ -579,19 +944,1075 @@ ParseArgs(int ArgCount, char** Args)
 		{
 			Options.UseSpatialPartition = false;
 		}
+		else if (CStrEq(Arg, "-nf") || CStrEq(Arg, "--no-texture-filtering"))
+		{
+			Options.FilterTextures = false;
+		}
 		else if (CStrEq(Arg, "-d") || CStrEq(Arg, "--debug"))
 		{
 			Options.Debug = true;
 		}
-		else
+		else if (CStrEq(Arg, "-w") || CStrEq(Arg, "--watch"))
 		{
-			Options.Error = true;
-			fprintf(stderr, "Unrecognized argument: '%s'\n", Arg);
+			Options.Watch = true;
 		}
-		++ArgIndex;
-	}
-	return Options;
-}
+		else if (CStrEq(Arg, "-nr") || CStrEq(Arg, "--numa-replicate"))
+		{
+			Options.NumaReplicate = true;
+		}
+		else if (CStrEq(Arg, "-nm") || CStrEq(Arg, "--numa-report"))
+		{
+			Options.NumaReport = true;
+		}
+		else if (CStrEq(Arg, "-pc") || CStrEq(Arg, "--perf-counters"))
+		{
+			Options.PerfCounters = true;
+		}
+		else if (CStrEq(Arg, "-hp") || CStrEq(Arg, "--huge-pages"))
+		{
+			++ArgIndex;
+			if (ArgIndex < ArgCount)
+			{
+				if (CStrEq(Args[ArgIndex], "none"))
+				{
+					Options.HugePages = HugePages_None;
+				}
+				else if (CStrEq(Args[ArgIndex], "transparent"))
+				{
+					Options.HugePages = HugePages_Transparent;
+				}
+				else if (CStrEq(Args[ArgIndex], "explicit"))
+				{
+					Options.HugePages = HugePages_Explicit;
+				}
+				else
+				{
+					Options.Error = true;
+					fprintf(stderr, "Invalid huge page mode: '%s'\n", Args[ArgIndex]);
+				}
+			}
+			else
+			{
+				Options.Error = true;
+				fprintf(stderr, "No argument given after --huge-pages\n");
+			}
+		}
+		else
+		{
+			Options.Error = true;
+			fprintf(stderr, "Unrecognized argument: '%s'\n", Arg);
+		}
+		++ArgIndex;
+	}
+	return Options;
+}
+
+function spatial_partition
+BuildSpatialPartition(scene* Scene, command_options* Options, memory_arena* Arena, memory_arena* ScratchArena,
+	b32 BuildGroups, temporary_memory* TopLevelTemp)
+{
+	std::chrono::time_point<std::chrono::high_resolution_clock> StartTime = std::chrono::high_resolution_clock::now();
+	f64 TraceStartTime = TraceStart();
+	
+	if (BuildGroups)
+	{
+		GenerateGroupPartitions(Scene, Arena, ScratchArena,
+			Options->MaxObjectsPerLeaf, Options->MaxLeafDepth, Options->Debug);
+	}
+	if (TopLevelTemp)
+	{
+		// Lets the top level be thrown away and rebuilt on its own
+		*TopLevelTemp = BeginTemporaryMemory(Arena);
+	}
+	f64 TopLevelStartTime = TraceStart();
+	ComputeInstanceBounds(Scene);
+	spatial_partition Partition = GenerateSpatialPartition(Scene, Arena, ScratchArena,
+		Options->MaxObjectsPerLeaf, Options->MaxLeafDepth, Options->MaxDistance, Options->Debug);
+	TraceEvent("top level partition", TopLevelStartTime);
+	TraceEvent("build partitions", TraceStartTime);
+	
+	std::chrono::time_point<std::chrono::high_resolution_clock> EndTime = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> ElapsedTime = EndTime - StartTime;
+	printf("Time to build spatial partition: %6.4f (s) \n", ElapsedTime.count());
+	if (Options->Debug)
+	{
+		printf("--DEBUG OUTPUT--\n");
+		printf("Spatial Partition:\n");
+		printf("\tRootNode:\n");
+		PrintNode(Partition.RootNode, 2);
+		if (!Partition.RootNode->IsLeaf)
+		{
+			printf("\t\tChild[0]:\n");
+			PrintNode(Partition.RootNode->Children[0], 3);
+			if (!Partition.RootNode->Children[0]->IsLeaf)
+			{
+				printf("\t\t\tChild[00]:\n");
+				PrintNode(Partition.RootNode->Children[0]->Children[0], 4);
+				printf("\t\t\tChild[01]:\n");
+				PrintNode(Partition.RootNode->Children[0]->Children[1], 4);
+			}
+			printf("\t\tChild[1]:\n");
+			PrintNode(Partition.RootNode->Children[1], 3);
+			if (!Partition.RootNode->Children[1]->IsLeaf)
+			{
+				printf("\t\t\tChild[10]:\n");
+				PrintNode(Partition.RootNode->Children[1]->Children[0], 4);
+				printf("\t\t\tChild[11]:\n");
+				PrintNode(Partition.RootNode->Children[1]->Children[1], 4);
+			}
+		}
+		printf("\tObjectCount = %d\n", Partition.ObjectCount);
+		printf("\tObjectIndices = [");
+		s32 IndicesToPrint = 256;
+		if (Partition.ObjectCount < IndicesToPrint)
+		{
+			IndicesToPrint = Partition.ObjectCount;
+		}
+		for (s32 Index = 0; Index < IndicesToPrint; ++Index)
+		{
+			if (Index > 0)
+			{
+				printf(", ");
+			}
+			printf("%d", Partition.ObjectIndices[Index]);
+		}
+		if (IndicesToPrint < Partition.ObjectCount)
+		{
+			printf(", ... (%d more)", Partition.ObjectCount - IndicesToPrint);
+		}
+		printf("]\n");
+		printf("----------------\n");
+	}
+	return Partition;
+}
+
+// Picks the output format from the extension of the output file
+function b32
+WriteSurface(surface* Surface, command_options* Options, memory_arena* ScratchArena)
+{
+	b32 Success = true;
+	string OutputFile = WrapZ(Options->OutputFile);
+	if (EndsWith(OutputFile, ConstString(".png")))
+	{
+		Success = WritePNG(Surface, Options->OutputFile, ScratchArena);
+	}
+	else if (EndsWith(OutputFile, ConstString(".pfm")))
+	{
+		Success = WritePFM(Surface, Options->OutputFile);
+	}
+	else
+	{
+		Success = WriteTGA(Surface, Options->OutputFile, ScratchArena, Options->CompressOutput);
+	}
+	if (!Success)
+	{
+		fprintf(stderr, "Error writing render to output file: '%s'\n", Options->OutputFile);
+	}
+	return Success;
+}
+
+function b32
+RenderToFile(scene* Scene, spatial_partition* Partition, command_options* Options, memory_arena* Arena, memory_arena* ScratchArena,
+	thread_arenas* ThreadArenas, numa_replicas* Replicas, run_stats* RunStats)
+{
+	b32 Success = true;
+	f32 AspectRatio = Scene->Camera.SurfaceWidth / Scene->Camera.SurfaceHeight;
+	s32 HorizontalResolution = (s32)(AspectRatio * (f32)Options->VerticalResolution);
+	surface Surface = CreateSurface(HorizontalResolution, Options->VerticalResolution, Arena, ThreadArenas->Count);
+	
+	if (Replicas)
+	{
+		f64 ReplicateStartTime = TraceStart();
+		ReplicateScene(Replicas, Scene, Partition, ThreadArenas->Count);
+		TraceEvent("replicate scene", ReplicateStartTime);
+	}
+	
+	// Keep the sample counts so float output can be merged with other renders later
+	Surface.SampleCounts = PushArray(Arena, (s64)Surface.Width*Surface.Height, f32);
+	for (s64 Index = 0; Index < (s64)Surface.Width*Surface.Height; ++Index)
+	{
+		Surface.SampleCounts[Index] = (f32)(Options->SamplesPerPixel*Options->SamplesPerPixel);
+	}
+	
+	// Formats with fixed row offsets are written by a background thread as rows finish
+	temporary_memory WriterTemp = BeginTemporaryMemory(ScratchArena);
+	pixel_costs Costs = {};
+	pixel_costs* CostsPtr = 0;
+	if (Options->HeatmapPrefix)
+	{
+		Costs = MakePixelCosts(Surface.Width, Surface.Height, ScratchArena);
+		CostsPtr = &Costs;
+	}
+	row_writer RowWriter = {};
+	row_writer* RowWriterPtr = 0;
+	if (CanStreamOutput(Options->OutputFile, Options->CompressOutput))
+	{
+		if (BeginRowWriter(&RowWriter, &Surface, Options->OutputFile, ScratchArena))
+		{
+			RowWriterPtr = &RowWriter;
+		}
+		else
+		{
+			Success = false;
+			fprintf(stderr, "Error writing render to output file: '%s'\n", Options->OutputFile);
+		}
+	}
+	
+	progress_reporter Progress = {};
+	progress_reporter* ProgressPtr = 0;
+	if (Options->ProgressSeconds > 0 || Options->ProgressFile)
+	{
+		f64 Interval = Options->ProgressSeconds > 0 ? Options->ProgressSeconds : PROGRESS_DEFAULT_SECONDS;
+		if (BeginProgress(&Progress, ThreadArenas->Count, Surface.Height, Interval, Options->ProgressFile, ScratchArena))
+		{
+			ProgressPtr = &Progress;
+		}
+		else
+		{
+			fprintf(stderr, "Warning: Could not start the progress reporter, rendering without it.\n");
+		}
+	}
+	
+	ray_trace_stats* ThreadStats = RunStats ? RunStats->Threads : 0;
+	bounce_stats BounceStats = {};
+	bounce_stats* BounceStatsPtr = Options->BounceStats ? &BounceStats : 0;
+	std::chrono::time_point<std::chrono::high_resolution_clock> StartTime = std::chrono::high_resolution_clock::now();
+	f64 RenderStartTime = TraceStart();
+	
+	ray_trace_stats Stats;
+	if (Partition)
+	{
+		Stats = RayTrace(Scene, Partition, &Surface, Options->SamplesPerPixel, Options->MaxBounces, Options->Seed, Options->FilterTextures, ScratchArena, ThreadArenas, Replicas, RowWriterPtr, CostsPtr, ProgressPtr, ThreadStats, BounceStatsPtr, Options->PerfCounters, true, Options->Debug);
+	}
+	else
+	{
+		Stats = RayTrace(Scene, &Surface, Options->SamplesPerPixel, Options->MaxBounces, Options->Seed, Options->FilterTextures, ScratchArena, ThreadArenas, Replicas, RowWriterPtr, CostsPtr, ProgressPtr, ThreadStats, BounceStatsPtr, Options->PerfCounters, true, Options->Debug);
+	}
+	
+	TraceEvent("render", RenderStartTime);
+	if (ProgressPtr)
+	{
+		EndProgress(ProgressPtr);
+	}
+	f64 WriteStartTime = TraceStart();
+	perf_counters WriteCounters = {};
+	if (Options->PerfCounters)
+	{
+		WriteCounters = OpenPerfCounters();
+		StartPerfCounters(&WriteCounters);
+	}
+	
+	std::chrono::time_point<std::chrono::high_resolution_clock> EndTime = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> ElapsedTime = EndTime - StartTime;
+	printf("Time to render scene: %6.4f (s) \n", ElapsedTime.count());
+	if (BounceStatsPtr)
+	{
+		PrintBounceStats(BounceStatsPtr);
+	}
+	
+	if (Options->NumaReport)
+	{
+		printf("NUMA placement (%d nodes):\n", GetNumaNodeCount());
+		ReportNumaPlacement("Framebuffer", Surface.Pixels, (s64)Surface.Width*Surface.Height*sizeof(color));
+		ReportNumaPlacement("Objects", Scene->Objects, Scene->ObjectCount*sizeof(object));
+		ReportNumaPlacement("Materials", Scene->Materials, Scene->MaterialCount*sizeof(material));
+		if (Partition)
+		{
+			ReportNumaPlacement("Partition object indices", Partition->ObjectIndices, Partition->ObjectCount*sizeof(s32));
+		}
+		for (s32 Index = 0; Index < Scene->TextureCount; ++Index)
+		{
+			char Name[32];
+			snprintf(Name, sizeof(Name), "Texture %d", Index + 1);
+			texture* Texture = Scene->Textures + Index;
+			ReportNumaPlacement(Name, Texture->Texels, Texture->TexelCount*sizeof(u32));
+		}
+		if (Replicas)
+		{
+			for (s32 Node = 0; Node < Replicas->NodeCount; ++Node)
+			{
+				if (Replicas->Built[Node])
+				{
+					char Name[32];
+					snprintf(Name, sizeof(Name), "Node %d copy", Node);
+					ReportNumaPlacement(Name, Replicas->NodeArenas[Node].Start, Replicas->NodeArenas[Node].Allocated);
+				}
+			}
+		}
+	}
+	
+	if (RowWriterPtr)
+	{
+		Success = EndRowWriter(RowWriterPtr);
+		if (!Success)
+		{
+			fprintf(stderr, "Error writing render to output file: '%s'\n", Options->OutputFile);
+		}
+	}
+	else if (Success)
+	{
+		Success = WriteSurface(&Surface, Options, ScratchArena);
+	}
+	if (CostsPtr)
+	{
+		Success = WriteHeatmaps(CostsPtr, Options->HeatmapPrefix, ScratchArena) && Success;
+	}
+	EndTemporaryMemory(WriterTemp);
+	TraceEvent("write output", WriteStartTime);
+	perf_counts WriteCounts = {};
+	if (Options->PerfCounters)
+	{
+		WriteCounts = StopPerfCounters(&WriteCounters);
+		ClosePerfCounters(&WriteCounters);
+	}
+	
+	std::chrono::time_point<std::chrono::high_resolution_clock> WriteEndTime = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> WriteTime = WriteEndTime - EndTime;
+	printf("Time to finish writing output: %6.4f (s) \n", WriteTime.count());
+	if (Options->PerfCounters)
+	{
+		PrintPerfCounts("Write counters (main thread)", &WriteCounts);
+	}
+	
+	if (RunStats)
+	{
+		RunStats->Width = Surface.Width;
+		RunStats->Height = Surface.Height;
+		RunStats->RenderSeconds = ElapsedTime.count();
+		RunStats->WriteSeconds = WriteTime.count();
+		RunStats->Overall = Stats;
+		RunStats->SpatialPartition = (Partition != 0);
+		RunStats->Partition = GetPartitionStats(Partition);
+		RunStats->WriteCounters = WriteCounts;
+		RunStats->Bounces = BounceStatsPtr;
+		Success = WriteRunStats(RunStats, Options->StatsFile) && Success;
+	}
+	
+	// surface TextureTest = Scene->Textures[2];
+	// Success = WriteTGA(&TextureTest, Args[2], ScratchArena);
+	return Success;
+}
+
+// Loads every render given with --merge, averages them by sample count and writes the result
+function b32
+MergeRenders(command_options* Options, memory_arena* Arena, memory_arena* ScratchArena)
+{
+	b32 Success = true;
+	surface Merged = LoadPFM(Options->MergeFiles[0], Arena);
+	Success = (Merged.Pixels != 0);
+	if (Success && !Merged.SampleCounts)
+	{
+		Merged.SampleCounts = PushArray(Arena, (s64)Merged.Width*Merged.Height, f32);
+		for (s64 Index = 0; Index < (s64)Merged.Width*Merged.Height; ++Index)
+		{
+			Merged.SampleCounts[Index] = 1.0f;
+		}
+	}
+	
+	for (s32 FileIndex = 1; Success && FileIndex < Options->MergeFileCount; ++FileIndex)
+	{
+		temporary_memory Temp = BeginTemporaryMemory(ScratchArena);
+		surface Source = LoadPFM(Options->MergeFiles[FileIndex], ScratchArena);
+		Success = (Source.Pixels != 0);
+		if (Success)
+		{
+			Success = MergeSurface(&Merged, &Source);
+			if (!Success)
+			{
+				fprintf(stderr, "Error merging '%s': Its size %dx%d does not match %dx%d\n",
+					Options->MergeFiles[FileIndex], Source.Width, Source.Height, Merged.Width, Merged.Height);
+			}
+		}
+		EndTemporaryMemory(Temp);
+	}
+	
+	if (Success)
+	{
+		printf("Merged %d renders\n", Options->MergeFileCount);
+		Success = WriteSurface(&Merged, Options, ScratchArena);
+	}
+	return Success;
+}
+
+function void
+DefaultBenchValues(bench_values* Values, s32 Value)
+{
+	if (Values->Count == 0)
+	{
+		Values->Count = 1;
+		Values->Values[0] = Value;
+	}
+}
+
+// Times one configuration after its warm-up runs. The surface is reused by every run, and is
+// KeepSurface when one is given, so the render outlives them.
+function void
+RunBenchConfig(bench_result* Result, scene* Scene, spatial_partition* Partition, s32 WarmUpRuns, s32 Repeats, command_options* Options,
+	f64* Seconds, memory_arena* ScratchArena, thread_arenas* ThreadArenas, surface* KeepSurface = 0)
+{
+	temporary_memory Temp = BeginTemporaryMemory(ScratchArena);
+	surface Surface = KeepSurface ? *KeepSurface : CreateSurface(Result->Width, Result->Height, ScratchArena, ThreadArenas->Count);
+	for (s32 Run = 0; Run < WarmUpRuns + Repeats; ++Run)
+	{
+		std::chrono::time_point<std::chrono::high_resolution_clock> StartTime = std::chrono::high_resolution_clock::now();
+		ray_trace_stats Stats;
+		if (Partition)
+		{
+			Stats = RayTrace(Scene, Partition, &Surface, Result->SamplesPerPixel, Result->MaxBounces, Options->Seed, Options->FilterTextures,
+				ScratchArena, ThreadArenas, 0, 0, 0, 0, 0, 0, false, false, false);
+		}
+		else
+		{
+			Stats = RayTrace(Scene, &Surface, Result->SamplesPerPixel, Result->MaxBounces, Options->Seed, Options->FilterTextures,
+				ScratchArena, ThreadArenas, 0, 0, 0, 0, 0, 0, false, false, false);
+		}
+		std::chrono::time_point<std::chrono::high_resolution_clock> EndTime = std::chrono::high_resolution_clock::now();
+		std::chrono::duration<double> ElapsedTime = EndTime - StartTime;
+		
+		if (Run >= WarmUpRuns)
+		{
+			// Renders are deterministic, so every run casts the same rays
+			Seconds[Run - WarmUpRuns] = ElapsedTime.count();
+			Result->RaysCast = Stats.RaysCast;
+			Result->SpatialNodesChecked = Stats.SpatialNodesChecked;
+			Result->ObjectsChecked = Stats.ObjectsChecked;
+			Result->Imbalance = GetLoadImbalance(&Stats);
+		}
+	}
+	EndTemporaryMemory(Temp);
+	SummarizeBenchRuns(Result, Seconds, Repeats);
+}
+
+// Room for the OpenMP pool at its largest plus the threads started outside of it. Benchmarks begin
+// the trace once their manifest is loaded, since it can ask for more threads than the pool has.
+function void
+BeginRunTrace(command_options* Options, s32 MaxThreadCount)
+{
+	if (Options->TraceFile)
+	{
+		if (omp_get_max_threads() > MaxThreadCount)
+		{
+			MaxThreadCount = omp_get_max_threads();
+		}
+		for (s32 Index = 0; Index < Options->ScalingCount; ++Index)
+		{
+			if (Options->ScalingThreads[Index] > MaxThreadCount)
+			{
+				MaxThreadCount = Options->ScalingThreads[Index];
+			}
+		}
+		BeginTrace(MaxThreadCount + TRACE_EXTRA_THREADS);
+		TraceThreadName("main");
+	}
+}
+
+// Renders every combination of settings in the bench manifest. Each scene is loaded once and each
+// spatial partition is built once, then reused for all resolutions, sample counts and thread counts.
+function b32
+RunBenchmark(command_options* Options, memory_arena* Arena, memory_arena* ScratchArena)
+{
+	bench_manifest Manifest;
+	b32 Success = LoadBenchManifest(Options->BenchFile, &Manifest, Arena);
+	if (Success)
+	{
+		if (Manifest.SceneCount == 0)
+		{
+			Manifest.SceneCount = 1;
+			Manifest.Scenes[0] = Options->SceneFile;
+		}
+		DefaultBenchValues(&Manifest.Resolutions, Options->VerticalResolution);
+		DefaultBenchValues(&Manifest.Samples, Options->SamplesPerPixel);
+		DefaultBenchValues(&Manifest.Bounces, Options->MaxBounces);
+		DefaultBenchValues(&Manifest.Threads, omp_get_max_threads());
+		DefaultBenchValues(&Manifest.SpatialPartition, Options->UseSpatialPartition);
+		DefaultBenchValues(&Manifest.ObjectsPerLeaf, Options->MaxObjectsPerLeaf);
+		DefaultBenchValues(&Manifest.LeafDepths, Options->MaxLeafDepth);
+		
+		s32 MaxThreads = 1;
+		for (s32 Index = 0; Index < Manifest.Threads.Count; ++Index)
+		{
+			if (Manifest.Threads.Values[Index] > MaxThreads)
+			{
+				MaxThreads = Manifest.Threads.Values[Index];
+			}
+		}
+		BeginRunTrace(Options, MaxThreads);
+		thread_arenas AllThreadArenas = MakeThreadArenas(Arena, MaxThreads, 256*1024*1024, Options->HugePages);
+		f64* Seconds = PushArray(Arena, Manifest.Repeats, f64);
+		
+		// Scenes in a manifest often share textures, so each one is decoded once for the whole run
+		// and kept out of the arena that is rolled back after every scene
+		memory_arena TextureArena = MakeArena(1024*1024*1024, 16, Options->HugePages);
+		texture_cache TextureCache = MakeTextureCache(&TextureArena, 1024);
+		
+		// Partition settings only multiply the partitioned configurations
+		s32 PartitionedCount = 0;
+		for (s32 Index = 0; Index < Manifest.SpatialPartition.Count; ++Index)
+		{
+			PartitionedCount += (Manifest.SpatialPartition.Values[Index] != 0);
+		}
+		s32 LeafSettingCount = Manifest.ObjectsPerLeaf.Count*Manifest.LeafDepths.Count;
+		s32 PartitionConfigCount = Manifest.SpatialPartition.Count - PartitionedCount + PartitionedCount*LeafSettingCount;
+		s32 RenderConfigCount = Manifest.Resolutions.Count*Manifest.Samples.Count*Manifest.Bounces.Count*Manifest.Threads.Count;
+		s32 ConfigCount = Manifest.SceneCount*PartitionConfigCount*RenderConfigCount;
+		
+		FILE* ResultsFile = stdout;
+		b32 JSON = false;
+		if (Manifest.ResultsFile)
+		{
+			ResultsFile = fopen(Manifest.ResultsFile, "w");
+			JSON = EndsWith(WrapZ(Manifest.ResultsFile), ConstString(".json"));
+			if (!ResultsFile)
+			{
+				Success = false;
+				fprintf(stderr, "Error opening bench results file: '%s'\n", Manifest.ResultsFile);
+			}
+		}
+		
+		if (Success)
+		{
+			printf("Running %d bench configurations, %d warm-up and %d timed runs each\n",
+				ConfigCount, Manifest.WarmUpRuns, Manifest.Repeats);
+			BeginBenchResults(ResultsFile, JSON);
+			s32 ConfigIndex = 0;
+			for (s32 SceneIndex = 0; SceneIndex < Manifest.SceneCount; ++SceneIndex)
+			{
+				const char* SceneFile = Manifest.Scenes[SceneIndex];
+				temporary_memory SceneTemp = BeginTemporaryMemory(Arena);
+				scene Scene = {};
+				if (LoadSceneFromFile(SceneFile, &Scene, Arena, ScratchArena, &TextureCache))
+				{
+					for (s32 PartitionIndex = 0; PartitionIndex < Manifest.SpatialPartition.Count; ++PartitionIndex)
+					{
+						b32 UsePartition = (Manifest.SpatialPartition.Values[PartitionIndex] != 0);
+						for (s32 LeafSetting = 0; LeafSetting < (UsePartition ? LeafSettingCount : 1); ++LeafSetting)
+						{
+							bench_result Result = {};
+							Result.Scene = SceneFile;
+							Result.SpatialPartition = UsePartition;
+							
+							temporary_memory PartitionTemp = BeginTemporaryMemory(Arena);
+							spatial_partition Partition = {};
+							if (UsePartition)
+							{
+								command_options PartitionOptions = *Options;
+								PartitionOptions.MaxObjectsPerLeaf = Manifest.ObjectsPerLeaf.Values[LeafSetting / Manifest.LeafDepths.Count];
+								PartitionOptions.MaxLeafDepth = Manifest.LeafDepths.Values[LeafSetting % Manifest.LeafDepths.Count];
+								PartitionOptions.Debug = false;
+								Result.ObjectsPerLeaf = PartitionOptions.MaxObjectsPerLeaf;
+								Result.LeafDepth = PartitionOptions.MaxLeafDepth;
+								
+								std::chrono::time_point<std::chrono::high_resolution_clock> StartTime = std::chrono::high_resolution_clock::now();
+								Partition = BuildSpatialPartition(&Scene, &PartitionOptions, Arena, ScratchArena, true, 0);
+								std::chrono::time_point<std::chrono::high_resolution_clock> EndTime = std::chrono::high_resolution_clock::now();
+								std::chrono::duration<double> ElapsedTime = EndTime - StartTime;
+								Result.BuildSeconds = ElapsedTime.count();
+							}
+							
+							// Thread counts vary fastest, then bounces, samples and resolution
+							for (s32 RenderConfig = 0; RenderConfig < RenderConfigCount; ++RenderConfig)
+							{
+								s32 Rest = RenderConfig;
+								Result.Threads = Manifest.Threads.Values[Rest % Manifest.Threads.Count];
+								Rest /= Manifest.Threads.Count;
+								Result.MaxBounces = Manifest.Bounces.Values[Rest % Manifest.Bounces.Count];
+								Rest /= Manifest.Bounces.Count;
+								Result.SamplesPerPixel = Manifest.Samples.Values[Rest % Manifest.Samples.Count];
+								Rest /= Manifest.Samples.Count;
+								Result.Height = Manifest.Resolutions.Values[Rest];
+								Result.Width = (s32)(Scene.Camera.SurfaceWidth / Scene.Camera.SurfaceHeight * (f32)Result.Height);
+								
+								thread_arenas ThreadArenas = AllThreadArenas;
+								ThreadArenas.Count = Result.Threads;
+								RunBenchConfig(&Result, &Scene, UsePartition ? &Partition : 0, Manifest.WarmUpRuns, Manifest.Repeats, Options, Seconds, ScratchArena, &ThreadArenas);
+								WriteBenchResult(ResultsFile, &Result, JSON, ConfigIndex == 0);
+								
+								++ConfigIndex;
+								if (ResultsFile != stdout)
+								{
+									printf("[%d/%d] %s %dx%d -p %d -b %d, %d threads, %s: median %6.4f (s), %.0f rays/s\n",
+										ConfigIndex, ConfigCount, SceneFile, Result.Width, Result.Height, Result.SamplesPerPixel,
+										Result.MaxBounces, Result.Threads, UsePartition ? "partitioned" : "flat", Result.MedianSeconds,
+										Result.MedianSeconds > 0 ? (f64)Result.RaysCast / Result.MedianSeconds : 0);
+									fflush(stdout);
+								}
+							}
+							EndTemporaryMemory(PartitionTemp);
+						}
+					}
+				}
+				else
+				{
+					Success = false;
+					ConfigIndex += PartitionConfigCount*RenderConfigCount;
+					fprintf(stderr, "Error loading scene from file: '%s'\n", SceneFile);
+				}
+				EndTemporaryMemory(SceneTemp);
+			}
+			EndBenchResults(ResultsFile, JSON);
+			if (ResultsFile != stdout)
+			{
+				fclose(ResultsFile);
+				printf("Wrote bench results to '%s'\n", Manifest.ResultsFile);
+			}
+		}
+	}
+	return Success;
+}
+
+// Loads, builds and renders a baseline case the way --compare-baseline times it, into Case's timings
+// and rays cast. Every load and build but the last is thrown away, and the last one is rendered.
+function b32
+MeasureBaselineCase(command_options* Options, baseline* Baseline, baseline_case* Case, surface* Surface, memory_arena* Arena,
+	memory_arena* ScratchArena, thread_arenas* ThreadArenas, f64* Seconds)
+{
+	s32 RunCount = Baseline->WarmUpRuns + Baseline->Repeats;
+	scene Scene = {};
+	b32 Loaded = true;
+	for (s32 Run = 0; Loaded && Run < RunCount; ++Run)
+	{
+		temporary_memory LoadTemp = BeginTemporaryMemory(Arena);
+		Scene = {};
+		f64 StartTime = omp_get_wtime();
+		Loaded = LoadSceneFromFile(Case->Scene, &Scene, Arena, ScratchArena);
+		if (Run >= Baseline->WarmUpRuns)
+		{
+			Seconds[Run - Baseline->WarmUpRuns] = omp_get_wtime() - StartTime;
+		}
+		if (Loaded && Run == RunCount - 1)
+		{
+			KeepTemporaryMemory(LoadTemp);
+		}
+		else
+		{
+			EndTemporaryMemory(LoadTemp);
+		}
+	}
+	
+	if (Loaded)
+	{
+		Case->Load = SummarizeBaselineTimes(Seconds, Baseline->Repeats);
+		spatial_partition Partition = {};
+		if (Case->SpatialPartition)
+		{
+			for (s32 Run = 0; Run < RunCount; ++Run)
+			{
+				temporary_memory BuildTemp = BeginTemporaryMemory(Arena);
+				f64 StartTime = omp_get_wtime();
+				GenerateGroupPartitions(&Scene, Arena, ScratchArena, Case->ObjectsPerLeaf, Case->LeafDepth, false);
+				ComputeInstanceBounds(&Scene);
+				Partition = GenerateSpatialPartition(&Scene, Arena, ScratchArena, Case->ObjectsPerLeaf, Case->LeafDepth, F32Max, false);
+				if (Run >= Baseline->WarmUpRuns)
+				{
+					Seconds[Run - Baseline->WarmUpRuns] = omp_get_wtime() - StartTime;
+				}
+				if (Run == RunCount - 1)
+				{
+					KeepTemporaryMemory(BuildTemp);
+				}
+				else
+				{
+					EndTemporaryMemory(BuildTemp);
+				}
+			}
+			Case->Build = SummarizeBaselineTimes(Seconds, Baseline->Repeats);
+		}
+		
+		bench_result Result = {};
+		Result.Height = Case->Resolution;
+		Result.Width = (s32)(Scene.Camera.SurfaceWidth / Scene.Camera.SurfaceHeight * (f32)Result.Height);
+		Result.SamplesPerPixel = Case->SamplesPerPixel;
+		Result.MaxBounces = Case->MaxBounces;
+		*Surface = CreateSurface(Result.Width, Result.Height, Arena, ThreadArenas->Count);
+		RunBenchConfig(&Result, &Scene, Case->SpatialPartition ? &Partition : 0, Baseline->WarmUpRuns, Baseline->Repeats, Options,
+			Seconds, ScratchArena, ThreadArenas, Surface);
+		Case->Render = SummarizeBaselineTimes(Seconds, Baseline->Repeats);
+		Case->RaysCast = Result.RaysCast;
+		Case->Recorded = true;
+	}
+	return Loaded;
+}
+
+// Loads, builds and renders every case of the baseline file, then compares the medians, the rays cast
+// and the image with the stored ones. With --update-baseline they are stored instead. Fails if any
+// case regressed, so it can gate a build.
+function b32
+RunBaseline(command_options* Options, memory_arena* Arena, memory_arena* ScratchArena)
+{
+	baseline_case DefaultCase = {};
+	DefaultCase.Resolution = Options->VerticalResolution;
+	DefaultCase.SamplesPerPixel = Options->SamplesPerPixel;
+	DefaultCase.MaxBounces = Options->MaxBounces;
+	DefaultCase.SpatialPartition = Options->UseSpatialPartition;
+	DefaultCase.ObjectsPerLeaf = Options->MaxObjectsPerLeaf;
+	DefaultCase.LeafDepth = Options->MaxLeafDepth;
+	baseline* Baseline = PushStruct(Arena, baseline);
+	b32 Success = LoadBaseline(Options->BaselineFile, Baseline, &DefaultCase, Arena);
+	if (Success)
+	{
+		if (Baseline->Threads == 0)
+		{
+			Baseline->Threads = omp_get_max_threads();
+		}
+		thread_arenas ThreadArenas = MakeThreadArenas(Arena, Baseline->Threads, 256*1024*1024, Options->HugePages);
+		f64* Seconds = PushArray(Arena, Baseline->Repeats, f64);
+		s32 RegressionCount = 0;
+		printf("%s %d baseline cases on %d threads, %d warm-up and %d timed runs each\n",
+			Options->UpdateBaseline ? "Recording" : "Comparing", Baseline->CaseCount, Baseline->Threads,
+			Baseline->WarmUpRuns, Baseline->Repeats);
+		
+		for (s32 CaseIndex = 0; CaseIndex < Baseline->CaseCount; ++CaseIndex)
+		{
+			baseline_case* Case = Baseline->Cases + CaseIndex;
+			baseline_case Current = *Case;
+			surface Surface = {};
+			temporary_memory CaseTemp = BeginTemporaryMemory(Arena);
+			
+			// Short timings are easily thrown off by the rest of the machine, so a case whose timings
+			// regressed is measured again, and only counts as regressed when every attempt was
+			b32 Loaded = false;
+			for (s32 Attempt = 0; Attempt < BASELINE_ATTEMPTS; ++Attempt)
+			{
+				if (Attempt > 0)
+				{
+					printf("\tTimings over their allowance, measuring again (attempt %d of %d)\n", Attempt + 1, BASELINE_ATTEMPTS);
+					EndTemporaryMemory(CaseTemp);
+					CaseTemp = BeginTemporaryMemory(Arena);
+				}
+				Current = *Case;
+				Loaded = MeasureBaselineCase(Options, Baseline, &Current, &Surface, Arena, ScratchArena, &ThreadArenas, Seconds);
+				if (Loaded && Attempt == 0)
+				{
+					printf("[%d/%d] %s %dx%d -p %d -b %d, %s\n", CaseIndex + 1, Baseline->CaseCount, Case->Scene, Surface.Width, Surface.Height,
+						Case->SamplesPerPixel, Case->MaxBounces, Case->SpatialPartition ? "partitioned" : "flat");
+				}
+				if (!Loaded || Options->UpdateBaseline || !Case->Recorded ||
+					!CompareBaselineTimings(Case, &Current, Baseline->Tolerance, false))
+				{
+					break;
+				}
+			}
+			
+			if (Loaded)
+			{
+				if (Options->UpdateBaseline)
+				{
+					printf("\tload %.6f (s), ", Current.Load.Median);
+					if (Case->SpatialPartition)
+					{
+						printf("build %.6f (s), ", Current.Build.Median);
+					}
+					printf("render %.6f (s), %.0f rays/s\n", Current.Render.Median, (f64)Current.RaysCast / Current.Render.Median);
+					if (WritePFM(&Surface, Case->Reference))
+					{
+						*Case = Current;
+					}
+					else
+					{
+						Success = false;
+						fprintf(stderr, "Error writing reference render to file: '%s'\n", Case->Reference);
+					}
+				}
+				else if (Case->Recorded)
+				{
+					b32 Regressed = CompareBaselineTimings(Case, &Current, Baseline->Tolerance, true);
+					printf("\t%-7s %10.0f -> %10.0f\n", "rays/s", (f64)Case->RaysCast / Case->Render.Median,
+						(f64)Current.RaysCast / Current.Render.Median);
+					
+					// Renders are deterministic, so the same rays should be cast unless the rendering changed
+					if (Current.RaysCast != Case->RaysCast)
+					{
+						Regressed = true;
+						printf("\t%-7s %10ld -> %10ld REGRESSION\n", "rays", Case->RaysCast, Current.RaysCast);
+					}
+					
+					temporary_memory ReferenceTemp = BeginTemporaryMemory(ScratchArena);
+					surface Reference = LoadPFM(Case->Reference, ScratchArena);
+					if (!Reference.Pixels)
+					{
+						Regressed = true;
+						printf("\t%-7s cannot read reference '%s' REGRESSION\n", "image", Case->Reference);
+					}
+					else if (Reference.Width != Surface.Width || Reference.Height != Surface.Height)
+					{
+						Regressed = true;
+						printf("\t%-7s %dx%d does not match the reference's %dx%d REGRESSION\n", "image",
+							Surface.Width, Surface.Height, Reference.Width, Reference.Height);
+					}
+					else
+					{
+						f64 MaxError = 0;
+						f64 PSNR = GetImagePSNR(&Reference, &Surface, &MaxError);
+						b32 ImageRegressed = (PSNR < Baseline->MinPSNR);
+						printf("\t%-7s PSNR %.1f dB (minimum %.1f dB), max error %.4f%s\n", "image", PSNR, Baseline->MinPSNR,
+							MaxError, ImageRegressed ? " REGRESSION" : "");
+						Regressed = Regressed || ImageRegressed;
+					}
+					EndTemporaryMemory(ReferenceTemp);
+					RegressionCount += Regressed;
+				}
+				else
+				{
+					++RegressionCount;
+					printf("\tNo stored measurements, run with --update-baseline first\n");
+				}
+			}
+			else
+			{
+				Success = false;
+				fprintf(stderr, "Error loading scene from file: '%s'\n", Case->Scene);
+			}
+			EndTemporaryMemory(CaseTemp);
+		}
+		
+		if (Options->UpdateBaseline)
+		{
+			Success = Success && WriteBaseline(Baseline, Options->BaselineFile);
+			if (Success)
+			{
+				printf("Wrote baseline to '%s'\n", Options->BaselineFile);
+			}
+		}
+		else
+		{
+			printf("%d of %d baseline cases regressed\n", RegressionCount, Baseline->CaseCount);
+			Success = Success && (RegressionCount == 0);
+		}
+	}
+	return Success;
+}
+
+// Pins each thread of a team of ThreadCount threads to one of the CPUs this process may run on, spread
+// evenly over them. OpenMP keeps the same threads for following regions of the same size.
+function void
+PinThreads(s32 ThreadCount, cpu_set_t* AllowedCPUs)
+{
+	s32 CPUCount = CPU_COUNT(AllowedCPUs);
+	#pragma omp parallel num_threads(ThreadCount)
+	{
+		s32 Target = (s32)((s64)omp_get_thread_num()*CPUCount / ThreadCount);
+		for (s32 CPU = 0; CPU < CPU_SETSIZE; ++CPU)
+		{
+			if (CPU_ISSET(CPU, AllowedCPUs) && Target-- == 0)
+			{
+				cpu_set_t Pinned;
+				CPU_ZERO(&Pinned);
+				CPU_SET(CPU, &Pinned);
+				pthread_setaffinity_np(pthread_self(), sizeof(Pinned), &Pinned);
+				break;
+			}
+		}
+	}
+}
+
+// Strong scaling of the loaded scene over the thread counts given with --scaling. Speedups are relative to
+// the first count, assuming it scaled perfectly up to there, so a list starting at 1 gives the usual numbers.
+function void
+RunScaling(scene* Scene, spatial_partition* Partition, command_options* Options, memory_arena* Arena, memory_arena* ScratchArena)
+{
+	s32 MaxThreads = 1;
+	for (s32 Index = 0; Index < Options->ScalingCount; ++Index)
+	{
+		if (Options->ScalingThreads[Index] > MaxThreads)
+		{
+			MaxThreads = Options->ScalingThreads[Index];
+		}
+	}
+	thread_arenas AllThreadArenas = MakeThreadArenas(Arena, MaxThreads, 256*1024*1024, Options->HugePages);
+	
+	cpu_set_t AllowedCPUs;
+	CPU_ZERO(&AllowedCPUs);
+	b32 Pin = (sched_getaffinity(0, sizeof(AllowedCPUs), &AllowedCPUs) == 0);
+	if (!Pin)
+	{
+		fprintf(stderr, "Could not read the allowed CPUs, threads are left unpinned\n");
+	}
+	else
+	{
+		printf("Pinning threads over %d CPUs\n", CPU_COUNT(&AllowedCPUs));
+	}
+	
+	bench_result Result = {};
+	Result.Height = Options->VerticalResolution;
+	Result.Width = (s32)(Scene->Camera.SurfaceWidth / Scene->Camera.SurfaceHeight * (f32)Result.Height);
+	Result.SamplesPerPixel = Options->SamplesPerPixel;
+	Result.MaxBounces = Options->MaxBounces;
+	s32 Repeats = 3;
+	f64 Seconds[3];
+	f64 BaseThreadSeconds = 0;
+	
+	printf("Threads  Time (s)  Speedup  Efficiency  Imbalance\n");
+	for (s32 Index = 0; Index < Options->ScalingCount; ++Index)
+	{
+		s32 Threads = Options->ScalingThreads[Index];
+		if (Pin)
+		{
+			PinThreads(Threads, &AllowedCPUs);
+		}
+		thread_arenas ThreadArenas = AllThreadArenas;
+		ThreadArenas.Count = Threads;
+		RunBenchConfig(&Result, Scene, Partition, 1, Repeats, Options, Seconds, ScratchArena, &ThreadArenas);
+		
+		if (Index == 0)
+		{
+			BaseThreadSeconds = Result.MedianSeconds*(f64)Threads;
+		}
+		f64 Speedup = BaseThreadSeconds / Result.MedianSeconds;
+		printf("%7d  %8.4f  %7.2f  %9.1f%%  %9.2f\n",
+			Threads, Result.MedianSeconds, Speedup, 100.0*Speedup / (f64)Threads, Result.Imbalance);
+		fflush(stdout);
+	}
+}
+
+// Keeps the scene resident and re-renders each time the scene file changes. Scene data ping-pongs between
+// two arenas so the previous version is still around to diff against. Group partitions, the top level
+// partition and the textures each live in their own arena and are only rebuilt when the edit touches them.
+function void
+WatchScene(command_options* Options, scene* Scene, spatial_partition* Partition, memory_arena* SceneArenas, s32 CurrentSceneArena,
+	memory_arena* PartitionArena, temporary_memory* TopLevelPartitionTemp, texture_cache* TextureCache, memory_arena* ScratchArena,
+	thread_arenas* ThreadArenas, numa_replicas* Replicas, run_stats* RunStats)
+{
+	s64 LastModifiedTime = GetFileModifiedTime(Options->SceneFile);
+	s64 BuiltPartitionBytes = PartitionArena->Allocated; // Since it was last built from scratch
+	for (;;)
+	{
+		printf("Watching '%s' for changes...\n", Options->SceneFile);
+		fflush(stdout);
+		s64 ModifiedTime = LastModifiedTime;
+		while (ModifiedTime == LastModifiedTime)
+		{
+			usleep(200*1000);
+			ModifiedTime = GetFileModifiedTime(Options->SceneFile);
+		}
+		LastModifiedTime = ModifiedTime;
+		usleep(50*1000); // Give the editor a moment to finish writing
+		
+		std::chrono::time_point<std::chrono::high_resolution_clock> StartTime = std::chrono::high_resolution_clock::now();
+		f64 LoadStartTime = TraceStart();
+		
+		s32 NextSceneArena = !CurrentSceneArena;
+		ResetArena(SceneArenas + NextSceneArena);
+		scene NewScene = {};
+		f64 TextureSeconds = 0;
+		if (!LoadSceneFromFile(Options->SceneFile, &NewScene, SceneArenas + NextSceneArena, ScratchArena, TextureCache, &TextureSeconds))
+		{
+			fprintf(stderr, "Error loading scene from file: '%s'. Keeping the previous version.\n", Options->SceneFile);
+			continue;
+		}
+		TraceEvent("load scene", LoadStartTime);
+		
+		std::chrono::time_point<std::chrono::high_resolution_clock> EndTime = std::chrono::high_resolution_clock::now();
+		std::chrono::duration<double> ElapsedTime = EndTime - StartTime;
+		printf("Time to reload scene: %6.4f (s) \n", ElapsedTime.count());
+		
+		f64 BuildStartTime = omp_get_wtime();
+		if (Options->UseSpatialPartition)
+		{
+			temporary_memory Temp = BeginTemporaryMemory(ScratchArena);
+			
+			// Groups are compared one by one, so only the ones that changed are built again
+			b32 GroupsMatch = (Scene->GroupCount == NewScene.GroupCount);
+			s32 ChangedGroupCount = 0;
+			b32* GroupChanged = PushArray(ScratchArena, NewScene.GroupCount, b32);
+			for (s32 GroupIndex = 0; GroupsMatch && GroupIndex < NewScene.GroupCount; ++GroupIndex)
+			{
+				GroupChanged[GroupIndex] = !SceneGeometryMatches(&Scene->Groups[GroupIndex].Scene, &NewScene.Groups[GroupIndex].Scene);
+				if (GroupChanged[GroupIndex])
+				{
+					++ChangedGroupCount;
+				}
+				else
+				{
+					// Partitions only hold object indices, so they carry over to the new version as is
+					NewScene.Groups[GroupIndex].Partition = Scene->Groups[GroupIndex].Partition;
+					NewScene.Groups[GroupIndex].Bounds = Scene->Groups[GroupIndex].Bounds;
+				}
+			}
+			
+			// Top level objects whose geometry changed, counting instances of groups that changed
+			s32 ChangedCount = 0;
+			s32* ChangedObjects = PushArray(ScratchArena, NewScene.ObjectCount, s32);
+			b32 TopLevelMatches = GroupsMatch && (Scene->ObjectCount == NewScene.ObjectCount) &&
+				(Options->MaxDistance == F32Max || Scene->Camera.Origin == NewScene.Camera.Origin);
+			for (s32 Index = 0; TopLevelMatches && Index < NewScene.ObjectCount; ++Index)
+			{
+				object* Object = NewScene.Objects + Index;
+				if (!ObjectGeometryMatches(Scene->Objects + Index, Scene, Object, &NewScene) ||
+					(Object->Type == Obj_Instance && GroupChanged[NewScene.Instances[Object->Instance.Index].Group - NewScene.Groups]))
+				{
+					ChangedObjects[ChangedCount++] = Index;
+				}
+			}
+			
+			if (!GroupsMatch || PartitionArena->Allocated > 2*BuiltPartitionBytes)
+			{
+				printf(GroupsMatch ? "Spatial partitions have grown with updates, rebuilding all of them\n" :
+					"Groups changed, rebuilding all spatial partitions\n");
+				EndTemporaryMemory(*TopLevelPartitionTemp);
+				ResetArena(PartitionArena);
+				*Partition = BuildSpatialPartition(&NewScene, Options, PartitionArena, ScratchArena, true, TopLevelPartitionTemp);
+				BuiltPartitionBytes = PartitionArena->Allocated;
+			}
+			else if (ChangedGroupCount > 0)
+			{
+				// The top level sits above the groups in the arena, so it goes first and is built again after them
+				printf("Geometry of %d of %d groups changed, rebuilding their spatial partitions and the top level\n",
+					ChangedGroupCount, NewScene.GroupCount);
+				EndTemporaryMemory(*TopLevelPartitionTemp);
+				for (s32 GroupIndex = 0; GroupIndex < NewScene.GroupCount; ++GroupIndex)
+				{
+					if (GroupChanged[GroupIndex])
+					{
+						GenerateGroupPartition(&NewScene, GroupIndex, PartitionArena, ScratchArena,
+							Options->MaxObjectsPerLeaf, Options->MaxLeafDepth, Options->Debug);
+					}
+				}
+				*Partition = BuildSpatialPartition(&NewScene, Options, PartitionArena, ScratchArena, false, TopLevelPartitionTemp);
+			}
+			else if (TopLevelMatches && ChangedCount == 0)
+			{
+				for (s32 InstanceIndex = 0; InstanceIndex < NewScene.InstanceCount; ++InstanceIndex)
+				{
+					NewScene.Instances[InstanceIndex].Bounds = Scene->Instances[InstanceIndex].Bounds;
+				}
+				printf("Geometry unchanged, reusing spatial partition\n");
+			}
+			else
+			{
+				ComputeInstanceBounds(&NewScene);
+				if (TopLevelMatches && UpdateSpatialPartition(Partition, Scene, &NewScene, ChangedObjects, ChangedCount, PartitionArena, ScratchArena,
+					Options->MaxObjectsPerLeaf, Options->MaxLeafDepth, Options->MaxDistance, Options->Debug))
+				{
+					printf("Geometry of %d objects changed, rebuilt the spatial partition around them\n", ChangedCount);
+					printf("Time to update spatial partition: %6.4f (s) \n", omp_get_wtime() - BuildStartTime);
+				}
+				else
+				{
+					printf("Top level geometry changed, rebuilding top level spatial partition\n");
+					EndTemporaryMemory(*TopLevelPartitionTemp);
+					*Partition = BuildSpatialPartition(&NewScene, Options, PartitionArena, ScratchArena, false, TopLevelPartitionTemp);
+				}
+			}
+			
+			EndTemporaryMemory(Temp);
+		}
+		
+		if (RunStats)
+		{
+			RunStats->ParseSeconds = ElapsedTime.count() - TextureSeconds;
+			RunStats->TextureSeconds = TextureSeconds;
+			RunStats->BuildSeconds = omp_get_wtime() - BuildStartTime;
+		}
+		
+		*Scene = NewScene;
+		CurrentSceneArena = NextSceneArena;
+		RenderToFile(Scene, Options->UseSpatialPartition ? Partition : 0, Options, SceneArenas + CurrentSceneArena, ScratchArena, ThreadArenas, Replicas, RunStats);
+		if (Options->TraceFile)
+		{
+			WriteTrace(Options->TraceFile);
+		}
+	}
+}
 
 int
 main(int ArgCount, char** Args)
@@ -601,119 +2022,180 @@ main(int ArgCount, char** Args)
 	command_options Options = ParseArgs(ArgCount, Args);
 	if (!Options.Error)
 	{
-		if (Options.PerformRender)
+		if (Options.PerfCounters)
+		{
+			RaisePerfCounterFileLimit(omp_get_max_threads());
+		}
+		
+		if (!Options.BenchFile)
+		{
+			BeginRunTrace(&Options, omp_get_max_threads());
+		}
+		
+		if (Options.MergeFileCount > 0)
+		{
+			memory_arena Arena = MakeArena(1024*1024*1024, 16, Options.HugePages);
+			memory_arena ScratchArena = MakeArena(4ull*1024*1024*1024, 16, Options.HugePages);
+			Success = MergeRenders(&Options, &Arena, &ScratchArena);
+		}
+		else if (Options.BenchFile)
+		{
+			memory_arena Arena = MakeArena(1024*1024*1024, 16, Options.HugePages);
+			memory_arena ScratchArena = MakeArena(4ull*1024*1024*1024, 16, Options.HugePages);
+			Success = RunBenchmark(&Options, &Arena, &ScratchArena);
+		}
+		else if (Options.BaselineFile)
+		{
+			memory_arena Arena = MakeArena(1024*1024*1024, 16, Options.HugePages);
+			memory_arena ScratchArena = MakeArena(4ull*1024*1024*1024, 16, Options.HugePages);
+			Success = RunBaseline(&Options, &Arena, &ScratchArena);
+		}
+		else if (Options.PerformRender)
 		{
 			printf("Options:\n");
 			printf("SceneFile: '%s'\n",
 				Options.SceneFile);
 			printf("OutputFile: '%s'\n",
 				Options.OutputFile);
+			printf("CompressOutput: %s\n",
+				Options.CompressOutput ? "true" : "false");
 			printf("VerticalResolution: %d\n",
 				Options.VerticalResolution);
 			printf("SamplesPerPixel: %d\n",
 				Options.SamplesPerPixel);
 			printf("MaxBounces: %d\n",
 				Options.MaxBounces);
+			printf("Seed: %lu\n",
+				Options.Seed);
+			printf("FilterTextures: %s\n",
+				Options.FilterTextures ? "true" : "false");
 			printf("UseSpatialPartition: %s\n",
 				Options.UseSpatialPartition ? "true" : "false");
 			printf("Debug: %s\n",
 				Options.Debug ? "true" : "false");
-			memory_arena Arena = MakeArena(1024*1024*1024, 16);
-			memory_arena ScratchArena = MakeArena(4ull*1024*1024*1024, 16);
+			printf("Watch: %s\n",
+				Options.Watch ? "true" : "false");
+			printf("NumaReplicate: %s\n",
+				Options.NumaReplicate ? "true" : "false");
+			printf("HugePages: %s\n",
+				Options.HugePages == HugePages_Explicit ? "explicit" :
+				Options.HugePages == HugePages_Transparent ? "transparent" : "none");
+			memory_arena Arena = MakeArena(1024*1024*1024, 16, Options.HugePages);
+			memory_arena ScratchArena = MakeArena(4ull*1024*1024*1024, 16, Options.HugePages);
+			thread_arenas ThreadArenas = MakeThreadArenas(&ScratchArena, omp_get_max_threads(), 256*1024*1024, Options.HugePages);
+			numa_replicas* Replicas = 0;
+			if (Options.NumaReplicate)
+			{
+				Replicas = MakeNumaReplicas(&ScratchArena, 1024*1024*1024, Options.HugePages);
+			}
+			
+			// Without watching, everything shares one arena. Watching needs the scene, partitions and
+			// textures to have separate lifetimes.
+			memory_arena SceneArenas[2] = {};
+			memory_arena* SceneArena = &Arena;
+			memory_arena* PartitionArena = &Arena;
+			memory_arena PartitionArenaStorage = {};
+			memory_arena TextureArena = {};
+			texture_cache TextureCache = {};
+			texture_cache* TextureCachePtr = 0;
+			if (Options.Watch)
+			{
+				SceneArenas[0] = Arena;
+				SceneArenas[1] = MakeArena(1024*1024*1024, 16, Options.HugePages);
+				SceneArena = SceneArenas + 0;
+				PartitionArenaStorage = MakeArena(1024*1024*1024, 16, Options.HugePages);
+				PartitionArena = &PartitionArenaStorage;
+				TextureArena = MakeArena(1024*1024*1024, 16, Options.HugePages);
+				TextureCache = MakeTextureCache(&TextureArena, 1024);
+				TextureCachePtr = &TextureCache;
+			}
+			
+			// Stats for --stats-json are gathered as the render goes and written out with it
+			run_stats RunStats = {};
+			run_stats* RunStatsPtr = 0;
+			if (Options.StatsFile)
+			{
+				RunStats.SceneFile = Options.SceneFile;
+				RunStats.OutputFile = Options.OutputFile;
+				RunStats.SamplesPerPixel = Options.SamplesPerPixel;
+				RunStats.MaxBounces = Options.MaxBounces;
+				RunStats.Seed = Options.Seed;
+				RunStats.FilterTextures = Options.FilterTextures;
+				RunStats.ObjectsPerLeaf = Options.MaxObjectsPerLeaf;
+				RunStats.LeafDepth = Options.MaxLeafDepth;
+				RunStats.Threads = PushArray(&ScratchArena, ThreadArenas.Count, ray_trace_stats);
+				RunStats.ThreadArenas = &ThreadArenas;
+				RunStats.Replicas = Replicas;
+				RunStats.PerfCounters = Options.PerfCounters;
+				if (Options.Watch)
+				{
+					AddStatsArena(&RunStats, "scene 0", SceneArenas + 0);
+					AddStatsArena(&RunStats, "scene 1", SceneArenas + 1);
+					AddStatsArena(&RunStats, "partition", PartitionArena);
+					AddStatsArena(&RunStats, "texture", &TextureArena);
+				}
+				else
+				{
+					AddStatsArena(&RunStats, "main", &Arena);
+				}
+				AddStatsArena(&RunStats, "scratch", &ScratchArena);
+				RunStatsPtr = &RunStats;
+			}
+			
+			// The load and build run on the main thread, so its own counters cover them
+			perf_counters MainCounters = {};
+			if (Options.PerfCounters)
+			{
+				CheckPerfCounters();
+				MainCounters = OpenPerfCounters();
+				StartPerfCounters(&MainCounters);
+			}
+			
 			scene Scene = {};
-			Success = LoadSceneFromFile(Options.SceneFile, &Scene, &Arena, &ScratchArena);
+			f64 LoadStartTime = omp_get_wtime();
+			Success = LoadSceneFromFile(Options.SceneFile, &Scene, SceneArena, &ScratchArena, TextureCachePtr, &RunStats.TextureSeconds);
+			RunStats.ParseSeconds = omp_get_wtime() - LoadStartTime - RunStats.TextureSeconds;
+			TraceEvent("load scene", LoadStartTime);
+			if (Options.PerfCounters)
+			{
+				RunStats.ParseCounters = StopPerfCounters(&MainCounters);
+				PrintPerfCounts("Scene load counters (main thread)", &RunStats.ParseCounters);
+				StartPerfCounters(&MainCounters);
+			}
 			if (Success)
 			{
-				std::chrono::time_point<std::chrono::high_resolution_clock> StartTime;
-				std::chrono::time_point<std::chrono::high_resolution_clock> EndTime;
-				std::chrono::duration<double> ElapsedTime;
-				
-				spatial_partition Partition;
+				spatial_partition Partition = {};
+				temporary_memory TopLevelPartitionTemp = {};
 				if (Options.UseSpatialPartition)
 				{
-					StartTime = std::chrono::high_resolution_clock::now();
-					
-					Partition = GenerateSpatialPartition(&Scene, &Arena, &ScratchArena,
-						Options.MaxObjectsPerLeaf, Options.MaxLeafDepth, Options.MaxDistance, Options.Debug);
-					
-					EndTime = std::chrono::high_resolution_clock::now();
-					ElapsedTime = EndTime - StartTime;
-					printf("Time to build spatial partition: %6.4f (s) \n", ElapsedTime.count());
-					if (Options.Debug)
+					f64 BuildStartTime = omp_get_wtime();
+					Partition = BuildSpatialPartition(&Scene, &Options, PartitionArena, &ScratchArena, true,
+						Options.Watch ? &TopLevelPartitionTemp : 0);
+					RunStats.BuildSeconds = omp_get_wtime() - BuildStartTime;
+					if (Options.PerfCounters)
 					{
-						printf("--DEBUG OUTPUT--\n");
-						printf("Spatial Partition:\n");
-						printf("\tRootNode:\n");
-						PrintNode(Partition.RootNode, 2);
-						if (!Partition.RootNode->IsLeaf)
-						{
-							printf("\t\tChild[0]:\n");
-							PrintNode(Partition.RootNode->Children[0], 3);
-							if (!Partition.RootNode->Children[0]->IsLeaf)
-							{
-								printf("\t\t\tChild[00]:\n");
-								PrintNode(Partition.RootNode->Children[0]->Children[0], 4);
-								printf("\t\t\tChild[01]:\n");
-								PrintNode(Partition.RootNode->Children[0]->Children[1], 4);
-							}
-							printf("\t\tChild[1]:\n");
-							PrintNode(Partition.RootNode->Children[1], 3);
-							if (!Partition.RootNode->Children[1]->IsLeaf)
-							{
-								printf("\t\t\tChild[10]:\n");
-								PrintNode(Partition.RootNode->Children[1]->Children[0], 4);
-								printf("\t\t\tChild[11]:\n");
-								PrintNode(Partition.RootNode->Children[1]->Children[1], 4);
-							}
-						}
-						printf("\tObjectCount = %d\n", Partition.ObjectCount);
-						printf("\tObjectIndices = [");
-						s32 IndicesToPrint = 256;
-						if (Partition.ObjectCount < IndicesToPrint)
-						{
-							IndicesToPrint = Partition.ObjectCount;
-						}
-						for (s32 Index = 0; Index < IndicesToPrint; ++Index)
-						{
-							if (Index > 0)
-							{
-								printf(", ");
-							}
-							printf("%d", Partition.ObjectIndices[Index]);
-						}
-						if (IndicesToPrint < Partition.ObjectCount)
-						{
-							printf(", ... (%d more)", Partition.ObjectCount - IndicesToPrint);
-						}
-						printf("]\n");
-						printf("----------------\n");
+						RunStats.BuildCounters = StopPerfCounters(&MainCounters);
+						PrintPerfCounts("Build counters (main thread)", &RunStats.BuildCounters);
 					}
 				}
-				f32 AspectRatio = Scene.Camera.SurfaceWidth / Scene.Camera.SurfaceHeight;
-				s32 HorizontalResolution = (s32)(AspectRatio * (f32)Options.VerticalResolution);
-				surface Surface = CreateSurface(HorizontalResolution, Options.VerticalResolution, &Arena);
-				
-				StartTime = std::chrono::high_resolution_clock::now();
-				
-				if (Options.UseSpatialPartition)
+				if (Options.PerfCounters)
 				{
-					RayTrace(&Scene, &Partition, &Surface, Options.SamplesPerPixel, Options.MaxBounces, &ScratchArena, Options.Debug);
+					ClosePerfCounters(&MainCounters);
 				}
-				else
+				
+				if (Options.ScalingCount > 0)
 				{
-					RayTrace(&Scene, &Surface, Options.SamplesPerPixel, Options.MaxBounces, &ScratchArena, Options.Debug);
+					RunScaling(&Scene, Options.UseSpatialPartition ? &Partition : 0, &Options, SceneArena, &ScratchArena);
 				}
-				
-				EndTime = std::chrono::high_resolution_clock::now();
-				ElapsedTime = EndTime - StartTime;
-				printf("Time to render scene: %6.4f (s) \n", ElapsedTime.count());
-				
-				Success = WriteTGA(&Surface, Options.OutputFile, &ScratchArena);
-				// surface TextureTest = Scene.Textures[2];
-				// Success = WriteTGA(&TextureTest, Args[2], &ScratchArena);
-				if (!Success)
+				else
 				{
-					fprintf(stderr, "Error writing render to output file: '%s'\n", Options.OutputFile);
+					Success = RenderToFile(&Scene, Options.UseSpatialPartition ? &Partition : 0, &Options, SceneArena, &ScratchArena, &ThreadArenas, Replicas, RunStatsPtr);
+					
+					if (Options.Watch)
+					{
+						WatchScene(&Options, &Scene, &Partition, SceneArenas, 0,
+							PartitionArena, &TopLevelPartitionTemp, TextureCachePtr, &ScratchArena, &ThreadArenas, Replicas, RunStatsPtr);
+					}
 				}
 			}
 			else
@@ -721,6 +2203,11 @@ main(int ArgCount, char** Args)
 				fprintf(stderr, "Error loading scene from file: '%s'\n", Options.SceneFile);
 			}
 		}
+		
+		if (Options.TraceFile && GlobalTrace)
+		{
+			Success = WriteTrace(Options.TraceFile) && Success;
+		}
 	}
 	else
 	{
@@ -0,0 +1,495 @@
+/*
+ * Raybench
+ *
+ * Times closest-hit queries on their own, for fixed sets of rays shot at a scene
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <emmintrin.h>
+
+#define EPSILON 0.00001f
+
+#include "types.h"
+#include "util.h"
+#include "memory.h"
+#include "string.h"
+#include "vector.h"
+#include "random.h"
+#include "scene.h"
+#include "tga.h"
+#include "texture.h"
+
+#include <omp.h>
+#include "png.h"
+#include "pfm.h"
+#include "heatmap.h"
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+
+#include "trace.h"
+
+#include "rowwriter.h"
+#include "progress.h"
+#include "bouncestats.h"
+#include "parser.h"
+#include "numa.h"
+#include "perfcounters.h"
+#include "spatialpartition.h"
+#include "intersect.h"
+
+// Rays are generated once and every kernel traces the same ones, so differences between
+// kernels come from the kernels alone. Shading, sampling and output are left out entirely.
+
+#define MAX_RAYBENCH_KERNELS 8
+#define MAX_RAYBENCH_REPEATS 1000
+
+typedef struct raybench_options
+{
+	b32 Error;
+	b32 PerformBench;
+	const char* SceneFile;
+	s32 RayCount;
+	s32 Repeats;
+	s32 Threads;
+	s32 MaxObjectsPerLeaf;
+	s32 MaxLeafDepth;
+	u64 Seed;
+} raybench_options;
+
+typedef struct ray_set
+{
+	const char* Name;
+	s32 Count;
+	v3* Origins;
+	v3* Dirs;
+} ray_set;
+
+// Either the flat loop over every object or the spatial partition, over all or some of the objects
+typedef struct raybench_kernel
+{
+	const char* Name;
+	scene Scene;
+	spatial_partition* Partition;
+} raybench_kernel;
+
+typedef struct raybench_pass
+{
+	f64 Seconds;
+	s64 Hits;
+	ray_trace_stats Stats;
+} raybench_pass;
+
+function raybench_options
+DefaultRaybenchOptions()
+{
+	raybench_options Default =
+	{
+		false,
+		true,
+		"data/scene.scn",
+		64*1024,
+		10,
+		1,
+		8,
+		30,
+		0,
+	};
+	return Default;
+}
+
+function b32
+ParsePositiveArg(int ArgCount, char** Args, int* ArgIndex, s32* Value)
+{
+	b32 Success = false;
+	const char* Name = Args[*ArgIndex];
+	++*ArgIndex;
+	if (*ArgIndex < ArgCount)
+	{
+		s32 Parsed = (s32)strtol(Args[*ArgIndex], 0, 10);
+		Success = (Parsed > 0);
+		if (Success)
+		{
+			*Value = Parsed;
+		}
+		else
+		{
+			fprintf(stderr, "Invalid value for %s: '%s'\n", Name, Args[*ArgIndex]);
+		}
+	}
+	else
+	{
+		fprintf(stderr, "No argument given after %s\n", Name);
+	}
+	return Success;
+}
+
+function raybench_options
+ParseRaybenchArgs(int ArgCount, char** Args)
+{
+	raybench_options Options = DefaultRaybenchOptions();
+	int ArgIndex = 1;
+	while (!Options.Error && ArgIndex < ArgCount)
+	{
+		char* Arg = Args[ArgIndex];
+		if (CStrEq(Arg, "-h") || CStrEq(Arg, "--help"))
+		{
+			raybench_options Defaults = DefaultRaybenchOptions();
+			printf("Times closest-hit queries against a .scn scene file for fixed sets of primary,\n");
+			printf("diffuse bounce and random rays.\n");
+			printf("Options:\n\n");
+			printf("-s, --scene\n");
+			printf("\tSpecifies the location of the .scn file to use as input.\n");
+			printf("\tDefault: -s %s\n", Defaults.SceneFile);
+			printf("-n, --rays\n");
+			printf("\tSpecifies the number of rays in each ray set.\n");
+			printf("\tDefault: -n %d\n", Defaults.RayCount);
+			printf("-rp, --repeat\n");
+			printf("\tSpecifies the number of timed passes over each ray set, after one warm-up\n");
+			printf("\tpass. The confidence intervals come from the spread between passes.\n");
+			printf("\tDefault: -rp %d\n", Defaults.Repeats);
+			printf("-t, --threads\n");
+			printf("\tSpecifies the number of threads tracing each ray set.\n");
+			printf("\tDefault: -t %d\n", Defaults.Threads);
+			printf("-ol, --objects-per-leaf\n");
+			printf("\tSpecifies the maximum number of objects per leaf in the spatial\n");
+			printf("\tpartition.\n");
+			printf("\tDefault: -ol %d\n", Defaults.MaxObjectsPerLeaf);
+			printf("-ld, --leaf-depth\n");
+			printf("\tSpecifies the maximum depth of a leaf in the spatial partition.\n");
+			printf("\tDefault: -ld %d\n", Defaults.MaxLeafDepth);
+			printf("-sd, --seed\n");
+			printf("\tSpecifies a seed for generating the ray sets.\n");
+			printf("\tDefault: -sd %lu\n", Defaults.Seed);
+			Options.PerformBench = false;
+		}
+		else if (CStrEq(Arg, "-s") || CStrEq(Arg, "--scene"))
+		{
+			++ArgIndex;
+			if (ArgIndex < ArgCount)
+			{
+				Options.SceneFile = Args[ArgIndex];
+			}
+			else
+			{
+				Options.Error = true;
+				fprintf(stderr, "No argument given after --scene\n");
+			}
+		}
+		else if (CStrEq(Arg, "-n") || CStrEq(Arg, "--rays"))
+		{
+			Options.Error = !ParsePositiveArg(ArgCount, Args, &ArgIndex, &Options.RayCount);
+		}
+		else if (CStrEq(Arg, "-rp") || CStrEq(Arg, "--repeat"))
+		{
+			Options.Error = !ParsePositiveArg(ArgCount, Args, &ArgIndex, &Options.Repeats);
+			if (Options.Repeats > MAX_RAYBENCH_REPEATS)
+			{
+				Options.Error = true;
+				fprintf(stderr, "At most %d passes can be timed\n", MAX_RAYBENCH_REPEATS);
+			}
+		}
+		else if (CStrEq(Arg, "-t") || CStrEq(Arg, "--threads"))
+		{
+			Options.Error = !ParsePositiveArg(ArgCount, Args, &ArgIndex, &Options.Threads);
+		}
+		else if (CStrEq(Arg, "-ol") || CStrEq(Arg, "--objects-per-leaf"))
+		{
+			Options.Error = !ParsePositiveArg(ArgCount, Args, &ArgIndex, &Options.MaxObjectsPerLeaf);
+		}
+		else if (CStrEq(Arg, "-ld") || CStrEq(Arg, "--leaf-depth"))
+		{
+			Options.Error = !ParsePositiveArg(ArgCount, Args, &ArgIndex, &Options.MaxLeafDepth);
+		}
+		else if (CStrEq(Arg, "-sd") || CStrEq(Arg, "--seed"))
+		{
+			++ArgIndex;
+			if (ArgIndex < ArgCount)
+			{
+				Options.Seed = strtoull(Args[ArgIndex], 0, 10);
+			}
+			else
+			{
+				Options.Error = true;
+				fprintf(stderr, "No argument given after --seed\n");
+			}
+		}
+		else
+		{
+			Options.Error = true;
+			fprintf(stderr, "Unrecognized option: '%s'\n", Arg);
+		}
+		++ArgIndex;
+	}
+	return Options;
+}
+
+function ray_set
+MakeRaySet(const char* Name, s32 Count, memory_arena* Arena)
+{
+	ray_set Set = {};
+	Set.Name = Name;
+	Set.Origins = PushArray(Arena, Count, v3);
+	Set.Dirs = PushArray(Arena, Count, v3);
+	return Set;
+}
+
+// Camera rays through uniformly random points of the image surface
+function ray_set
+MakePrimaryRays(scene* Scene, s32 Count, random_sequence* RNG, memory_arena* Arena)
+{
+	ray_set Set = MakeRaySet("primary", Count, Arena);
+	camera* Camera = &Scene->Camera;
+	for (s32 Index = 0; Index < Count; ++Index)
+	{
+		v3 SurfacePoint = Camera->XAxis*(RandomBilateral(RNG)*0.5f*Camera->SurfaceWidth) +
+			Camera->YAxis*(RandomBilateral(RNG)*0.5f*Camera->SurfaceHeight) - Camera->ZAxis*Camera->DistToSurface;
+		Set.Origins[Index] = Camera->Origin;
+		Set.Dirs[Index] = NormOrZero(SurfacePoint);
+	}
+	Set.Count = Count;
+	return Set;
+}
+
+// Rays leaving the surfaces the primary rays hit, in the random diffuse directions RayTrace uses
+function ray_set
+MakeBounceRays(scene* Scene, spatial_partition* Partition, ray_set* Primary, s32 Count, random_sequence* RNG, memory_arena* Arena)
+{
+	ray_set Set = MakeRaySet("bounce", Count, Arena);
+	ray_trace_stats Stats = {};
+	for (s32 Index = 0; Index < Primary->Count && Set.Count < Count; ++Index)
+	{
+		ray_hit Hit = RayIntersectScene(Primary->Origins[Index], Primary->Dirs[Index], Scene, Partition, &Stats);
+		if (Hit.Object)
+		{
+			v3 Normal = Hit.Normal;
+			if (Dot(Primary->Dirs[Index], Normal) > 0)
+			{
+				Normal = -Normal;
+			}
+			Set.Origins[Set.Count] = Primary->Origins[Index] + Primary->Dirs[Index]*Hit.Dist + EPSILON*Normal;
+			Set.Dirs[Set.Count] = NormOrDefault(Normal + RandomUnitBallV3(RNG), Normal);
+			++Set.Count;
+		}
+	}
+	return Set;
+}
+
+// Rays from uniformly random points in the bounds of the finite objects, in uniformly random directions
+function ray_set
+MakeRandomRays(scene* Scene, s32 Count, random_sequence* RNG, memory_arena* Arena)
+{
+	ray_set Set = MakeRaySet("random", Count, Arena);
+	rect3 Bounds = {Scene->Camera.Origin, Scene->Camera.Origin};
+	for (s32 Index = 0; Index < Scene->ObjectCount; ++Index)
+	{
+		rect3 ObjectBounds = GetObjectBoundingBox(Scene, Scene->Objects + Index);
+		for (s32 Axis = 0; Axis < 3; ++Axis)
+		{
+			if (ObjectBounds.Min.E[Axis] > F32Min && ObjectBounds.Max.E[Axis] < F32Max)
+			{
+				Bounds.Min.E[Axis] = Minimum(Bounds.Min.E[Axis], ObjectBounds.Min.E[Axis]);
+				Bounds.Max.E[Axis] = Maximum(Bounds.Max.E[Axis], ObjectBounds.Max.E[Axis]);
+			}
+		}
+	}
+	
+	for (s32 Index = 0; Index < Count; ++Index)
+	{
+		for (s32 Axis = 0; Axis < 3; ++Axis)
+		{
+			Set.Origins[Index].E[Axis] = Lerp(Bounds.Min.E[Axis], RandomUnilateral(RNG), Bounds.Max.E[Axis]);
+		}
+		Set.Dirs[Index] = RandomUnitV3(RNG);
+	}
+	Set.Count = Count;
+	return Set;
+}
+
+// The same scene with only the objects of one type, for timing each primitive's test on its own
+function scene
+FilterObjects(scene* Scene, s32 Type, memory_arena* Arena)
+{
+	scene Result = *Scene;
+	Result.ObjectCount = 0;
+	Result.Objects = PushArray(Arena, Scene->ObjectCount, object);
+	for (s32 Index = 0; Index < Scene->ObjectCount; ++Index)
+	{
+		if (Scene->Objects[Index].Type == Type)
+		{
+			Result.Objects[Result.ObjectCount++] = Scene->Objects[Index];
+		}
+	}
+	return Result;
+}
+
+function raybench_pass
+TraceRaySet(raybench_kernel* Kernel, ray_set* Set, s32 Threads)
+{
+	raybench_pass Pass = {};
+	s64 Hits = 0;
+	s64 NodesChecked = 0;
+	s64 ObjectsChecked = 0;
+	f64 StartTime = omp_get_wtime();
+	#pragma omp parallel num_threads(Threads) reduction(+:Hits, NodesChecked, ObjectsChecked)
+	{
+		ray_trace_stats Stats = {};
+		#pragma omp for schedule(static)
+		for (s32 Index = 0; Index < Set->Count; ++Index)
+		{
+			ray_hit Hit;
+			if (Kernel->Partition)
+			{
+				Hit = RayIntersectScene(Set->Origins[Index], Set->Dirs[Index], &Kernel->Scene, Kernel->Partition, &Stats);
+			}
+			else
+			{
+				Hit = RayIntersectScene(Set->Origins[Index], Set->Dirs[Index], &Kernel->Scene, &Stats);
+			}
+			Hits += (Hit.Object != 0);
+		}
+		NodesChecked += Stats.SpatialNodesChecked;
+		ObjectsChecked += Stats.ObjectsChecked;
+	}
+	Pass.Seconds = omp_get_wtime() - StartTime;
+	Pass.Hits = Hits;
+	Pass.Stats.SpatialNodesChecked = NodesChecked;
+	Pass.Stats.ObjectsChecked = ObjectsChecked;
+	return Pass;
+}
+
+// Two-sided 95% quantiles of Student's t distribution for 1 to 30 degrees of freedom
+global f64 StudentT95[30] =
+{
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+// Mean throughput over the passes and the half-width of its 95% confidence interval
+function void
+SummarizeThroughput(f64* MRaysPerSecond, s32 Count, f64* Mean, f64* HalfWidth)
+{
+	f64 Sum = 0;
+	for (s32 Index = 0; Index < Count; ++Index)
+	{
+		Sum += MRaysPerSecond[Index];
+	}
+	*Mean = Sum / (f64)Count;
+	
+	*HalfWidth = 0;
+	if (Count > 1)
+	{
+		f64 SquaredDeviations = 0;
+		for (s32 Index = 0; Index < Count; ++Index)
+		{
+			f64 Deviation = MRaysPerSecond[Index] - *Mean;
+			SquaredDeviations += Deviation*Deviation;
+		}
+		f64 StandardDeviation = sqrt(SquaredDeviations / (f64)(Count - 1));
+		f64 T = Count - 1 <= 30 ? StudentT95[Count - 2] : 1.960;
+		*HalfWidth = T*StandardDeviation / sqrt((f64)Count);
+	}
+}
+
+function void
+RunRaybench(raybench_options* Options, scene* Scene, spatial_partition* Partition, memory_arena* Arena)
+{
+	raybench_kernel Kernels[MAX_RAYBENCH_KERNELS];
+	s32 KernelCount = 0;
+	Kernels[KernelCount++] = {"flat", *Scene, 0};
+	Kernels[KernelCount++] = {"partition", *Scene, Partition};
+	
+	const char* TypeNames[] = {"", "flat planes", "flat spheres", "flat triangles", "flat parallelograms", "flat instances"};
+	for (s32 Type = Obj_Plane; Type <= Obj_Instance; ++Type)
+	{
+		scene TypeScene = FilterObjects(Scene, Type, Arena);
+		if (TypeScene.ObjectCount > 0 && TypeScene.ObjectCount < Scene->ObjectCount)
+		{
+			Kernels[KernelCount++] = {TypeNames[Type], TypeScene, 0};
+		}
+	}
+	
+	random_sequence RNG = SeedRandom(Options->Seed + 1);
+	ray_set Sets[3];
+	Sets[0] = MakePrimaryRays(Scene, Options->RayCount, &RNG, Arena);
+	Sets[1] = MakeBounceRays(Scene, Partition, Sets, Options->RayCount, &RNG, Arena);
+	Sets[2] = MakeRandomRays(Scene, Options->RayCount, &RNG, Arena);
+	
+	printf("%d objects, %d threads, %d rays per set, %d timed passes\n",
+		Scene->ObjectCount, Options->Threads, Options->RayCount, Options->Repeats);
+	printf("%-8s %-20s %9s %9s %9s %9s %12s\n", "Rays", "Kernel", "Count", "Hits", "Nodes/ray", "Objs/ray", "Mrays/s");
+	f64 MRaysPerSecond[MAX_RAYBENCH_REPEATS];
+	for (s32 SetIndex = 0; SetIndex < (s32)ArrayCount(Sets); ++SetIndex)
+	{
+		ray_set* Set = Sets + SetIndex;
+		for (s32 KernelIndex = 0; KernelIndex < KernelCount && Set->Count > 0; ++KernelIndex)
+		{
+			raybench_kernel* Kernel = Kernels + KernelIndex;
+			raybench_pass Pass = TraceRaySet(Kernel, Set, Options->Threads); // Warm-up
+			for (s32 Run = 0; Run < Options->Repeats; ++Run)
+			{
+				Pass = TraceRaySet(Kernel, Set, Options->Threads);
+				MRaysPerSecond[Run] = Pass.Seconds > 0 ? (f64)Set->Count / Pass.Seconds / 1e6 : 0;
+			}
+			
+			f64 Mean = 0;
+			f64 HalfWidth = 0;
+			SummarizeThroughput(MRaysPerSecond, Options->Repeats, &Mean, &HalfWidth);
+			f64 NodesPerRay = (f64)Pass.Stats.SpatialNodesChecked / (f64)Set->Count;
+			f64 ObjectsPerRay = (f64)Pass.Stats.ObjectsChecked / (f64)Set->Count;
+			printf("%-8s %-20s %9d %9ld %9.2f %9.2f %9.3f +- %.3f\n", Set->Name, Kernel->Name, Set->Count, Pass.Hits,
+				NodesPerRay, ObjectsPerRay, Mean, HalfWidth);
+		}
+	}
+}
+
+int
+main(int ArgCount, char** Args)
+{
+	b32 Success = true;
+	
+	raybench_options Options = ParseRaybenchArgs(ArgCount, Args);
+	if (!Options.Error)
+	{
+		if (Options.PerformBench)
+		{
+			memory_arena Arena = MakeArena(1024*1024*1024, 16);
+			memory_arena ScratchArena = MakeArena(4ull*1024*1024*1024, 16);
+			scene Scene = {};
+			Success = LoadSceneFromFile(Options.SceneFile, &Scene, &Arena, &ScratchArena);
+			if (Success)
+			{
+				GenerateGroupPartitions(&Scene, &Arena, &ScratchArena, Options.MaxObjectsPerLeaf, Options.MaxLeafDepth, false);
+				ComputeInstanceBounds(&Scene);
+				spatial_partition Partition = GenerateSpatialPartition(&Scene, &Arena, &ScratchArena,
+					Options.MaxObjectsPerLeaf, Options.MaxLeafDepth, F32Max, false);
+				RunRaybench(&Options, &Scene, &Partition, &Arena);
+			}
+			else
+			{
+				fprintf(stderr, "Error loading scene from file: '%s'\n", Options.SceneFile);
+			}
+		}
+	}
+	else
+	{
+		fprintf(stderr, "Usage: %s -s <scene.scn> -n <rays per set> -rp <timed passes> -t <threads>\n", Args[0]);
+		fprintf(stderr, "For more info, type %s -h\n", Args[0]);
+	}
+	
+	return !Success;
+}
\ No newline at end of file
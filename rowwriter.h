@@ -0,0 +1,190 @@
+/*
+ * rowwriter.h
+ *
+ * For streaming finished rows to the output file while the render is still running
+ */
+
+// Uncompressed TGA and PFM put every row at a fixed offset, so a background thread can
+// convert each row as soon as the render marks it done and pwrite it straight into place.
+// Compressed formats depend on the rows before them and are still written after the render.
+
+#define ROW_WRITER_IDLE_NANOSECONDS 200000
+
+enum row_writer_format
+{
+	RowWriter_TGA,
+	RowWriter_PFM,
+};
+
+typedef struct row_writer
+{
+	surface* Surface;
+	s32 Format;
+	int File;
+	s64 DataOffset;
+	s64 RowSize;
+	u8* RowBuffer;
+	u8* RowDone;
+	u8* RowWritten;
+	s32 RowsWritten;
+	s32 Finished;
+	b32 Error;
+	pthread_t Thread;
+} row_writer;
+
+function b32
+CanStreamOutput(const char* FileName, b32 UseRLE)
+{
+	string Name = WrapZ(FileName);
+	b32 Result = EndsWith(Name, ConstString(".pfm")) ||
+		(!UseRLE && !EndsWith(Name, ConstString(".png")));
+	return Result;
+}
+
+function b32
+WriteAt(int File, void* Data, s64 Size, s64 Offset)
+{
+	u8* Bytes = (u8*)Data;
+	while (Size > 0)
+	{
+		ssize_t Written = pwrite(File, Bytes, Size, Offset);
+		if (Written <= 0)
+		{
+			break;
+		}
+		Bytes += Written;
+		Size -= Written;
+		Offset += Written;
+	}
+	return (Size == 0);
+}
+
+function void
+WriteRow(row_writer* Writer, s32 Y)
+{
+	f64 StartTime = TraceStart();
+	surface* Surface = Writer->Surface;
+	color* Pixel = Surface->Pixels + (s64)Y*Surface->Width;
+	void* Data = Pixel;
+	if (Writer->Format == RowWriter_TGA)
+	{
+		BGR24FromColors(Pixel, Surface->Width, Writer->RowBuffer);
+		Data = Writer->RowBuffer;
+	}
+	
+	if (!WriteAt(Writer->File, Data, Writer->RowSize, Writer->DataOffset + (s64)Y*Writer->RowSize))
+	{
+		Writer->Error = true;
+	}
+	Writer->RowWritten[Y] = true;
+	++Writer->RowsWritten;
+	TraceEvent("write row", StartTime, Y);
+}
+
+function void*
+RowWriterThread(void* Data)
+{
+	row_writer* Writer = (row_writer*)Data;
+	TraceThreadName("row writer");
+	s32 Height = Writer->Surface->Height;
+	while (Writer->RowsWritten < Height)
+	{
+		// Read the flag before scanning, so rows finished before it was set are not missed
+		b32 Finished = __atomic_load_n(&Writer->Finished, __ATOMIC_ACQUIRE);
+		s32 RowsBefore = Writer->RowsWritten;
+		for (s32 Y = 0; Y < Height; ++Y)
+		{
+			if (!Writer->RowWritten[Y] && __atomic_load_n(Writer->RowDone + Y, __ATOMIC_ACQUIRE))
+			{
+				WriteRow(Writer, Y);
+			}
+		}
+		
+		if (Finished && Writer->RowsWritten < Height)
+		{
+			// The render stopped without finishing every row, so there is nothing more to wait for
+			Writer->Error = true;
+			break;
+		}
+		if (Writer->RowsWritten == RowsBefore)
+		{
+			struct timespec Idle = {0, ROW_WRITER_IDLE_NANOSECONDS};
+			nanosleep(&Idle, 0);
+		}
+	}
+	return 0;
+}
+
+// Opens the file, writes everything that does not depend on the render and starts the writer thread
+function b32
+BeginRowWriter(row_writer* Writer, surface* Surface, const char* FileName, memory_arena* Arena)
+{
+	*Writer = {};
+	Writer->Surface = Surface;
+	Writer->Format = EndsWith(WrapZ(FileName), ConstString(".pfm")) ? RowWriter_PFM : RowWriter_TGA;
+	Writer->File = open(FileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	b32 Success = (Writer->File >= 0);
+	
+	if (Success)
+	{
+		s64 PixelCount = (s64)Surface->Width*Surface->Height;
+		if (Writer->Format == RowWriter_TGA)
+		{
+			tga_header Header = MakeTGAHeader(Surface->Width, Surface->Height, TGA_UncompressedTrueColor);
+			Writer->DataOffset = sizeof(tga_header);
+			Writer->RowSize = 3*(s64)Surface->Width;
+			Success = WriteAt(Writer->File, &Header, sizeof(Header), 0);
+		}
+		else
+		{
+			char Header[64];
+			s32 HeaderSize = FormatPFMHeader(Header, sizeof(Header), "PF", Surface->Width, Surface->Height);
+			Writer->DataOffset = HeaderSize;
+			Writer->RowSize = (s64)Surface->Width*sizeof(color);
+			Success = WriteAt(Writer->File, Header, HeaderSize, 0);
+			if (Success && Surface->SampleCounts)
+			{
+				// Sample counts are known before rendering, so they go in right away
+				s64 CountsOffset = Writer->DataOffset + PixelCount*sizeof(color);
+				HeaderSize = FormatPFMHeader(Header, sizeof(Header), "Pf", Surface->Width, Surface->Height);
+				Success = WriteAt(Writer->File, Header, HeaderSize, CountsOffset) &&
+					WriteAt(Writer->File, Surface->SampleCounts, PixelCount*sizeof(f32), CountsOffset + HeaderSize);
+			}
+		}
+		
+		Writer->RowBuffer = PushArray(Arena, Writer->RowSize, u8);
+		Writer->RowDone = PushArray(Arena, Surface->Height, u8);
+		Writer->RowWritten = PushArray(Arena, Surface->Height, u8);
+		for (s32 Y = 0; Y < Surface->Height; ++Y)
+		{
+			Writer->RowDone[Y] = false;
+			Writer->RowWritten[Y] = false;
+		}
+		
+		Success = Success && (pthread_create(&Writer->Thread, 0, RowWriterThread, Writer) == 0);
+		if (!Success)
+		{
+			close(Writer->File);
+			Writer->File = -1;
+		}
+	}
+	return Success;
+}
+
+// Called by the render threads once a row of the surface holds its final colors
+function void
+MarkRowDone(row_writer* Writer, s32 Y)
+{
+	__atomic_store_n(Writer->RowDone + Y, (u8)true, __ATOMIC_RELEASE);
+}
+
+// Waits for the remaining rows to be written and closes the file
+function b32
+EndRowWriter(row_writer* Writer)
+{
+	__atomic_store_n(&Writer->Finished, true, __ATOMIC_RELEASE);
+	pthread_join(Writer->Thread, 0);
+	b32 Success = !Writer->Error;
+	Success = (close(Writer->File) == 0) && Success;
+	return Success;
+}
\ No newline at end of file
@@ -0,0 +1,175 @@
+/*
+ * runstats.h
+ *
+ * Phase timings, tree shape, per-thread counters and arena usage of a render, written out as JSON
+ */
+
+#define MAX_STATS_ARENAS 16
+
+typedef struct stats_arena
+{
+	const char* Name;
+	memory_arena* Arena;
+} stats_arena;
+
+typedef struct run_stats
+{
+	const char* SceneFile;
+	const char* OutputFile;
+	s32 Width;
+	s32 Height;
+	s32 SamplesPerPixel;
+	s32 MaxBounces;
+	u64 Seed;
+	b32 FilterTextures;
+	b32 SpatialPartition;
+	s32 ObjectsPerLeaf;
+	s32 LeafDepth;
+	f64 ParseSeconds; // Reading the scene file, not counting textures
+	f64 TextureSeconds;
+	f64 BuildSeconds;
+	f64 RenderSeconds;
+	f64 WriteSeconds;
+	b32 PerfCounters;
+	perf_counts ParseCounters; // Counted on the main thread, like BuildCounters and WriteCounters
+	perf_counts BuildCounters;
+	perf_counts WriteCounters;
+	partition_stats Partition;
+	ray_trace_stats Overall;
+	bounce_stats* Bounces; // Only gathered with --bounce-stats
+	ray_trace_stats* Threads; // One per thread arena, filled in by RayTrace
+	thread_arenas* ThreadArenas;
+	numa_replicas* Replicas;
+	s32 ArenaCount;
+	stats_arena Arenas[MAX_STATS_ARENAS];
+} run_stats;
+
+function void
+AddStatsArena(run_stats* Stats, const char* Name, memory_arena* Arena)
+{
+	if (Stats->ArenaCount < MAX_STATS_ARENAS)
+	{
+		Stats->Arenas[Stats->ArenaCount++] = {Name, Arena};
+	}
+}
+
+function void
+WriteStatsArena(FILE* File, const char* Name, s32 Index, memory_arena* Arena, b32 First)
+{
+	fprintf(File, "%s\t\t{\"name\": ", First ? "" : ",\n");
+	WriteJSONString(File, Name);
+	if (Index >= 0)
+	{
+		fprintf(File, ", \"index\": %d", Index);
+	}
+	fprintf(File, ", \"capacity\": %ld, \"committed\": %ld, \"allocated\": %ld, \"high_water\": %ld}",
+		Arena->Capacity, Arena->Committed, Arena->Allocated, Arena->HighWater);
+}
+
+function b32
+WriteRunStats(run_stats* Stats, const char* FileName)
+{
+	FILE* File = fopen(FileName, "w");
+	b32 Success = (File != 0);
+	if (Success)
+	{
+		fprintf(File, "{\n\t\"options\": {\"scene\": ");
+		WriteJSONString(File, Stats->SceneFile);
+		fprintf(File, ", \"output\": ");
+		WriteJSONString(File, Stats->OutputFile);
+		fprintf(File, ", \"width\": %d, \"height\": %d, \"samples\": %d, \"bounces\": %d, \"seed\": %lu, "
+			"\"filter_textures\": %s, \"spatial_partition\": %s, \"objects_per_leaf\": %d, \"leaf_depth\": %d},\n",
+			Stats->Width, Stats->Height, Stats->SamplesPerPixel, Stats->MaxBounces, Stats->Seed,
+			Stats->FilterTextures ? "true" : "false", Stats->SpatialPartition ? "true" : "false",
+			Stats->ObjectsPerLeaf, Stats->LeafDepth);
+		
+		fprintf(File, "\t\"phases\": {\"parse_s\": %.6f, \"texture_load_s\": %.6f, \"build_s\": %.6f, \"render_s\": %.6f, \"write_s\": %.6f},\n",
+			Stats->ParseSeconds, Stats->TextureSeconds, Stats->BuildSeconds, Stats->RenderSeconds, Stats->WriteSeconds);
+		
+		if (Stats->PerfCounters)
+		{
+			fprintf(File, "\t\"phase_counters\": {\"parse\": ");
+			WritePerfCountsJSON(File, &Stats->ParseCounters);
+			fprintf(File, ", \"build\": ");
+			WritePerfCountsJSON(File, &Stats->BuildCounters);
+			fprintf(File, ", \"render\": ");
+			WritePerfCountsJSON(File, &Stats->Overall.Counters);
+			fprintf(File, ", \"write\": ");
+			WritePerfCountsJSON(File, &Stats->WriteCounters);
+			fprintf(File, "},\n");
+		}
+		
+		partition_stats* Tree = &Stats->Partition;
+		if (Stats->SpatialPartition)
+		{
+			f64 MeanLeafDepth = Tree->LeafCount > 0 ? (f64)Tree->LeafDepthSum / (f64)Tree->LeafCount : 0;
+			f64 MeanLeafObjects = Tree->LeafCount > 0 ? (f64)Tree->References / (f64)Tree->LeafCount : 0;
+			fprintf(File, "\t\"tree\": {\"nodes\": %d, \"leaves\": %d, \"empty_leaves\": %d, \"max_depth\": %d, \"mean_leaf_depth\": %.3f, "
+				"\"references\": %ld, \"mean_leaf_objects\": %.3f, \"max_leaf_objects\": %d},\n",
+				Tree->NodeCount, Tree->LeafCount, Tree->EmptyLeafCount, Tree->MaxDepth, MeanLeafDepth,
+				Tree->References, MeanLeafObjects, Tree->MaxLeafObjects);
+		}
+		else
+		{
+			fprintf(File, "\t\"tree\": null,\n");
+		}
+		
+		if (Stats->Bounces)
+		{
+			fprintf(File, "\t\"bounces\": ");
+			WriteBounceStatsJSON(File, Stats->Bounces);
+			fprintf(File, ",\n");
+		}
+		
+		ray_trace_stats* Overall = &Stats->Overall;
+		fprintf(File, "\t\"threads\": [\n");
+		for (s32 Index = 0; Index < Overall->ThreadCount; ++Index)
+		{
+			ray_trace_stats* Thread = Stats->Threads + Index;
+			fprintf(File, "%s\t\t{\"thread\": %d, \"rays\": %ld, \"nodes\": %ld, \"objects\": %ld, \"samples\": %ld, \"busy_s\": %.6f, "
+				"\"arena_high_water\": %ld",
+				Index ? ",\n" : "", Index, Thread->RaysCast, Thread->SpatialNodesChecked, Thread->ObjectsChecked,
+				Thread->SamplesComputed, Thread->BusySeconds, Stats->ThreadArenas->Threads[Index].Arena.HighWater);
+			if (Stats->PerfCounters)
+			{
+				fprintf(File, ", \"counters\": ");
+				WritePerfCountsJSON(File, &Thread->Counters);
+			}
+			fprintf(File, "}");
+		}
+		fprintf(File, "\n\t],\n");
+		fprintf(File, "\t\"overall\": {\"threads\": %ld, \"rays\": %ld, \"nodes\": %ld, \"objects\": %ld, \"samples\": %ld, "
+			"\"busy_s\": %.6f, \"max_busy_s\": %.6f, \"imbalance\": %.3f},\n",
+			Overall->ThreadCount, Overall->RaysCast, Overall->SpatialNodesChecked, Overall->ObjectsChecked,
+			Overall->SamplesComputed, Overall->BusySeconds, Overall->MaxBusySeconds, GetLoadImbalance(Overall));
+		
+		fprintf(File, "\t\"arenas\": [\n");
+		b32 First = true;
+		for (s32 Index = 0; Index < Stats->ArenaCount; ++Index)
+		{
+			WriteStatsArena(File, Stats->Arenas[Index].Name, -1, Stats->Arenas[Index].Arena, First);
+			First = false;
+		}
+		for (s32 Index = 0; Index < Stats->ThreadArenas->Count; ++Index)
+		{
+			WriteStatsArena(File, "thread", Index, &Stats->ThreadArenas->Threads[Index].Arena, First);
+			First = false;
+		}
+		if (Stats->Replicas)
+		{
+			for (s32 Node = 0; Node < Stats->Replicas->NodeCount; ++Node)
+			{
+				WriteStatsArena(File, "numa node", Node, Stats->Replicas->NodeArenas + Node, First);
+				First = false;
+			}
+		}
+		fprintf(File, "\n\t]\n}\n");
+		Success = (fclose(File) == 0);
+	}
+	
+	if (!Success)
+	{
+		fprintf(stderr, "Error writing stats to file: '%s'\n", FileName);
+	}
+	return Success;
+}
\ No newline at end of file
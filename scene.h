@@ -14,6 +14,18 @@ typedef struct uv_map
 	uv VertexUV[3];
 } uv_map;
 
+// Everything about how a surface looks. Objects only keep an index into their scene's table of
+// these, so the geometry that traversal touches stays compact.
+typedef struct material
+{
+	color Color;
+	f32 Glossy;
+	f32 Translucency;
+	f32 Refraction;
+	texture_handle Texture;
+	uv_map UVMap;
+} material;
+
 enum object_type
 {
 	Obj_None,
@@ -21,6 +33,7 @@ enum object_type
 	Obj_Sphere,
 	Obj_Triangle,
 	Obj_Parallelogram,
+	Obj_Instance,
 };
 
 typedef struct object
@@ -55,13 +68,12 @@ typedef struct object
 				v3 Axis[2];
 			};
 		} Parallelogram;
+		struct
+		{
+			u32 Index; // Into the Instances of the scene the object is in
+		} Instance;
 	};
-	color Color;
-	f32 Glossy;
-	f32 Translucency;
-	f32 Refraction;
-	texture_handle Texture;
-	uv_map UVMap;
+	u32 Material;
 } object;
 
 typedef struct camera
@@ -87,26 +99,196 @@ typedef struct surface
 	s32 Width;
 	s32 Height;
 	color* Pixels;
+	f32* SampleCounts; // Optional number of samples averaged into each pixel, kept for float output
 } surface;
 
+#define MAX_TEXTURE_LEVELS 16
+
+typedef struct texture_level
+{
+	s32 Width;
+	s32 Height;
+	s32 TilesPerRow;
+	u32* Texels;
+} texture_level;
+
+// Textures keep the 8 bit texels from their file and decode them when sampled. Every level
+// of the mip chain lives in one allocation starting at Texels.
+typedef struct texture
+{
+	s32 Width;
+	s32 Height;
+	s32 LevelCount;
+	s64 TexelCount;
+	u32* Texels;
+	texture_level Levels[MAX_TEXTURE_LEVELS];
+} texture;
+
 typedef struct scene
 {
 	s32 ObjectCount;
 	s32 TextureCount;
+	s32 GroupCount;
+	s32 InstanceCount;
+	s32 MaterialCount;
 	object* Objects;
-	surface* Textures;
+	material* Materials;
+	texture* Textures;
+	struct object_group* Groups;
+	struct instance* Instances;
 	camera Camera;
 	color SkyColor;
+	struct material_table* MaterialTable; // Only set while the scene is being parsed
 } scene;
 
+// A named set of objects that can be placed many times in the scene through instances.
+// Its objects live in their own scene and get their own spatial partition.
+typedef struct object_group
+{
+	string Name;
+	scene Scene;
+	struct spatial_partition* Partition;
+	rect3 Bounds;
+} object_group;
+
+typedef struct instance
+{
+	object_group* Group;
+	v3 Origin;
+	v3 Axis[3]; // Group space -> world space
+	v3 InvAxis[3]; // World space -> group space, stored as rows
+	rect3 Bounds;
+} instance;
+
 typedef struct ray_hit
 {
 	f32 Dist;
 	object* Object;
+	instance* Instance; // That the object was hit in, or 0 for objects of the scene itself
 	v3 Normal;
 	v2 UV;
 } ray_hit;
 
+function v3
+ToInstanceSpace(instance* Instance, v3 V)
+{
+	v3 Result =
+	{
+		Dot(Instance->InvAxis[0], V),
+		Dot(Instance->InvAxis[1], V),
+		Dot(Instance->InvAxis[2], V),
+	};
+	return Result;
+}
+
+function v3
+FromInstanceSpace(instance* Instance, v3 P)
+{
+	v3 Result = Instance->Origin + P.X*Instance->Axis[0] + P.Y*Instance->Axis[1] + P.Z*Instance->Axis[2];
+	return Result;
+}
+
+function v3
+VectorFromInstanceSpace(instance* Instance, v3 V)
+{
+	v3 Result = V.X*Instance->Axis[0] + V.Y*Instance->Axis[1] + V.Z*Instance->Axis[2];
+	return Result;
+}
+
+function v3
+NormalFromInstanceSpace(instance* Instance, v3 Normal)
+{
+	// Normals transform by the inverse transpose
+	v3 Result = NormOrZero(Normal.X*Instance->InvAxis[0] + Normal.Y*Instance->InvAxis[1] + Normal.Z*Instance->InvAxis[2]);
+	return Result;
+}
+
+function void
+TranslateObject(scene* Scene, object* Object, v3 Offset)
+{
+	switch (Object->Type)
+	{
+		case Obj_Plane:
+		{
+			Object->Plane.Displacement += Dot(Object->Plane.Normal, Offset);
+		} break;
+		
+		case Obj_Sphere:
+		{
+			Object->Sphere.Center = Object->Sphere.Center + Offset;
+		} break;
+		
+		case Obj_Triangle:
+		{
+			Object->Triangle.Vertex[0] = Object->Triangle.Vertex[0] + Offset;
+			Object->Triangle.Vertex[1] = Object->Triangle.Vertex[1] + Offset;
+			Object->Triangle.Vertex[2] = Object->Triangle.Vertex[2] + Offset;
+		} break;
+		
+		case Obj_Parallelogram:
+		{
+			Object->Parallelogram.Origin = Object->Parallelogram.Origin + Offset;
+		} break;
+		
+		case Obj_Instance:
+		{
+			instance* Instance = Scene->Instances + Object->Instance.Index;
+			Instance->Origin = Instance->Origin + Offset;
+		} break;
+		
+		default:
+		{
+			fprintf(stderr, "Error: Object of type %d passed to TranslateObject!\n", Object->Type);
+		} break;
+	}
+}
+
+function b32
+ObjectGeometryMatches(object* A, scene* SceneA, object* B, scene* SceneB)
+{
+	b32 Result = (A->Type == B->Type);
+	if (Result)
+	{
+		if (A->Type == Obj_Instance)
+		{
+			instance* InstanceA = SceneA->Instances + A->Instance.Index;
+			instance* InstanceB = SceneB->Instances + B->Instance.Index;
+			Result = ((InstanceA->Group - SceneA->Groups) == (InstanceB->Group - SceneB->Groups) &&
+				InstanceA->Origin == InstanceB->Origin &&
+				InstanceA->Axis[0] == InstanceB->Axis[0] &&
+				InstanceA->Axis[1] == InstanceB->Axis[1] &&
+				InstanceA->Axis[2] == InstanceB->Axis[2]);
+		}
+		else
+		{
+			// Objects are zero initialized before parsing, so the unused bytes of the union match too
+			u8* BytesA = (u8*)&A->Plane;
+			u8* BytesB = (u8*)&B->Plane;
+			for (u64 Index = 0; Index < sizeof(A->Parallelogram); ++Index)
+			{
+				if (BytesA[Index] != BytesB[Index])
+				{
+					Result = false;
+					break;
+				}
+			}
+		}
+	}
+	return Result;
+}
+
+// Compares only what the spatial partitions depend on. Materials, textures and the camera can change freely.
+function b32
+SceneGeometryMatches(scene* A, scene* B)
+{
+	b32 Result = (A->ObjectCount == B->ObjectCount);
+	for (s32 Index = 0; Result && Index < A->ObjectCount; ++Index)
+	{
+		Result = ObjectGeometryMatches(A->Objects + Index, A, B->Objects + Index, B);
+	}
+	return Result;
+}
+
 function camera
 LookAt(v3 Origin, v3 Destination)
 {
@@ -4,12 +4,6 @@
  * Spatial partition for the scene
  */
 
-typedef struct rect3
-{
-	v3 Min;
-	v3 Max;
-} rect3;
-
 typedef struct spatial_node
 {
 	rect3 Bounds;
@@ -28,15 +22,80 @@ typedef struct spatial_partition
 	s32* ObjectIndices;
 } spatial_partition;
 
+// Shape of a built tree. Depth counts splits from the root, so a lone root leaf is at depth 0.
+typedef struct partition_stats
+{
+	s32 NodeCount;
+	s32 LeafCount;
+	s32 EmptyLeafCount;
+	s32 MaxDepth;
+	s32 MaxLeafObjects;
+	s64 References; // Object indices over all leaves, so objects straddling a split count once per leaf
+	s64 LeafDepthSum;
+} partition_stats;
+
 typedef struct ray_trace_stats
 {
 	s64 RaysCast;
 	s64 SpatialNodesChecked;
 	s64 ObjectsChecked;
 	s64 SamplesComputed;
-	s64 Padding[4];
+	f64 BusySeconds; // Time spent on rows, summed over threads
+	f64 MaxBusySeconds; // Busiest thread, only set in the overall stats
+	s64 ThreadCount;
+	perf_counts Counters; // Only counted when asked for
+	s64 Padding[3];
 } ray_trace_stats;
 
+// Busiest thread over the average thread, so 1 when the rows were spread evenly
+function f64
+GetLoadImbalance(ray_trace_stats* Stats)
+{
+	f64 MeanBusySeconds = Stats->ThreadCount > 0 ? Stats->BusySeconds / (f64)Stats->ThreadCount : 0;
+	f64 Result = MeanBusySeconds > 0 ? Stats->MaxBusySeconds / MeanBusySeconds : 1.0;
+	return Result;
+}
+
+function void
+AccumulatePartitionStats(spatial_node* Node, s32 Depth, partition_stats* Stats)
+{
+	++Stats->NodeCount;
+	if (Depth > Stats->MaxDepth)
+	{
+		Stats->MaxDepth = Depth;
+	}
+	if (Node->IsLeaf)
+	{
+		++Stats->LeafCount;
+		Stats->LeafDepthSum += Depth;
+		Stats->References += Node->ObjectCount;
+		if (Node->ObjectCount == 0)
+		{
+			++Stats->EmptyLeafCount;
+		}
+		if (Node->ObjectCount > Stats->MaxLeafObjects)
+		{
+			Stats->MaxLeafObjects = Node->ObjectCount;
+		}
+	}
+	else
+	{
+		AccumulatePartitionStats(Node->Children[0], Depth + 1, Stats);
+		AccumulatePartitionStats(Node->Children[1], Depth + 1, Stats);
+	}
+}
+
+function partition_stats
+GetPartitionStats(spatial_partition* Partition)
+{
+	partition_stats Stats = {};
+	if (Partition && Partition->RootNode)
+	{
+		AccumulatePartitionStats(Partition->RootNode, 0, &Stats);
+	}
+	return Stats;
+}
+
 function rect3
 Union(rect3 A, rect3 B)
 {
@@ -126,7 +185,7 @@ PrintNode(spatial_node* Node, s32 Indent=0)
 }
 
 function rect3
-GetObjectBoundingBox(object* Object)
+GetObjectBoundingBox(scene* Scene, object* Object)
 {
 	rect3 Result = {};
 	switch (Object->Type)
@@ -186,6 +245,11 @@ GetObjectBoundingBox(object* Object)
 			Result.Max.Z = Maximum(Maximum(Maximum(V0.Z, V1.Z), V2.Z), V3.Z);
 		} break;
 		
+		case Obj_Instance:
+		{
+			Result = Scene->Instances[Object->Instance.Index].Bounds;
+		} break;
+		
 		default:
 		{
 			fprintf(stderr, "Error: Object of type %d passed to GetObjectBoundingBox!\n", Object->Type);
@@ -195,7 +259,7 @@ GetObjectBoundingBox(object* Object)
 }
 
 function rect3
-GetRelativeBoundingBox(object* Object, rect3 Bounds)
+GetRelativeBoundingBox(scene* Scene, object* Object, rect3 Bounds)
 {
 	rect3 Result = {};
 	switch (Object->Type)
@@ -516,6 +580,11 @@ GetRelativeBoundingBox(object* Object, rect3 Bounds)
 			}
 		} break;
 		
+		case Obj_Instance:
+		{
+			Result = Intersection(Scene->Instances[Object->Instance.Index].Bounds, Bounds);
+		} break;
+		
 		default:
 		{
 			fprintf(stderr, "Error: Object of type %d passed to GetRelativeBoundingBox!\n", Object->Type);
@@ -524,45 +593,15 @@ GetRelativeBoundingBox(object* Object, rect3 Bounds)
 	return Result;
 }
 
+// Splits the cell RootBounds over the given objects, whose bounding boxes are looked up by object index.
+// A whole partition is built from the root cell, and watch mode rebuilds single subtrees with it.
 function spatial_partition
-GenerateSpatialPartition(scene* Scene, memory_arena* Arena, memory_arena* ScratchArena, s32 MaxObjectsPerLeaf, s32 MaxLeafDepth, f32 MaxDistance, b32 DebugOn)
+GenerateSpatialSubtree(scene* Scene, s32* ObjectIndices, s32 ObjectCount, rect3* ObjectBoundingBoxes, rect3 RootBounds,
+	memory_arena* Arena, memory_arena* ScratchArena, s32 MaxObjectsPerLeaf, s32 MaxLeafDepth, b32 DebugOn)
 {
 	spatial_partition Result = {};
-	if (Scene->ObjectCount > MaxObjectsPerLeaf)
+	if (ObjectCount > MaxObjectsPerLeaf && MaxLeafDepth >= 0)
 	{
-		temporary_memory Temp = BeginTemporaryMemory(ScratchArena);
-		
-		rect3* ObjectBoundingBoxes = PushArray(ScratchArena, Scene->ObjectCount, rect3);
-		ObjectBoundingBoxes[0] = GetObjectBoundingBox(Scene->Objects + 0);
-		if (DebugOn)
-		{
-			printf("--DEBUG OUTPUT--\n");
-			printf("Bounding Boxes:");
-			printf("0: ");
-			PrintRect(ObjectBoundingBoxes[0]);
-			printf("\n");
-		}
-		rect3 RootBounds = ObjectBoundingBoxes[0];
-		for (s32 Index = 1; Index < Scene->ObjectCount; ++Index)
-		{
-			ObjectBoundingBoxes[Index] = GetObjectBoundingBox(Scene->Objects + Index);
-			if (DebugOn)
-			{
-				printf("%d: ", Index);
-				PrintRect(ObjectBoundingBoxes[Index]);
-				printf("\n");
-			}
-			RootBounds = Union(RootBounds, ObjectBoundingBoxes[Index]);
-		}
-		
-		v3 MaxDistV = {MaxDistance, MaxDistance, MaxDistance};
-		rect3 CameraBounds =
-		{
-			Scene->Camera.Origin - MaxDistV,
-			Scene->Camera.Origin + MaxDistV,
-		};
-		RootBounds = Intersection(RootBounds, CameraBounds);
-		
 		Result.RootNode = PushStruct(Arena, spatial_node);
 		Result.RootNode->Bounds = RootBounds;
 		Result.RootNode->IsLeaf = false;
@@ -571,10 +610,10 @@ GenerateSpatialPartition(scene* Scene, memory_arena* Arena, memory_arena* Scratc
 		
 		temporary_memory CircularStart = BeginTemporaryMemory(ScratchArena);
 		
-		s32* TempObjectIndices = PushArray(ScratchArena, 2*Scene->ObjectCount, s32);
+		s32* TempObjectIndices = PushArray(ScratchArena, 2*ObjectCount, s32);
 		
 		s32 SplitAxisIndex = -1;
-		s32 BestCount = Scene->ObjectCount;
+		s32 BestCount = ObjectCount;
 		s32 SplitCountLow = 0;
 		s32 LargestAxisIndex = 0;
 		f32 LargestAxisSize = F32Min;
@@ -584,14 +623,15 @@ GenerateSpatialPartition(scene* Scene, memory_arena* Arena, memory_arena* Scratc
 			f32 SplitPoint = 0.5f * (RootBounds.Max.E[AxisIndex] + RootBounds.Min.E[AxisIndex]);
 			s32 CountLow = 0;
 			s32 CountHigh = 0;
-			for (s32 Index = 0; Index < Scene->ObjectCount; ++Index)
+			for (s32 Index = 0; Index < ObjectCount; ++Index)
 			{
-				if (ObjectBoundingBoxes[Index].Min.E[AxisIndex] < SplitPoint)
+				s32 ObjectIndex = ObjectIndices[Index];
+				if (ObjectBoundingBoxes[ObjectIndex].Min.E[AxisIndex] < SplitPoint)
 				{
 					++CountLow;
 				}
 				
-				if (ObjectBoundingBoxes[Index].Max.E[AxisIndex] >= SplitPoint)
+				if (ObjectBoundingBoxes[ObjectIndex].Max.E[AxisIndex] >= SplitPoint)
 				{
 					++CountHigh;
 				}
@@ -625,17 +665,18 @@ GenerateSpatialPartition(scene* Scene, memory_arena* Arena, memory_arena* Scratc
 		f32 SplitPoint = 0.5f * (RootBounds.Max.E[SplitAxisIndex] + RootBounds.Min.E[SplitAxisIndex]);
 		s32 CountLow = 0;
 		s32 CountHigh = 0;
-		for (s32 Index = 0; Index < Scene->ObjectCount; ++Index)
+		for (s32 Index = 0; Index < ObjectCount; ++Index)
 		{
-			if (ObjectBoundingBoxes[Index].Min.E[SplitAxisIndex] < SplitPoint)
+			s32 ObjectIndex = ObjectIndices[Index];
+			if (ObjectBoundingBoxes[ObjectIndex].Min.E[SplitAxisIndex] < SplitPoint)
 			{
-				TempObjectIndices[CountLow] = Index;
+				TempObjectIndices[CountLow] = ObjectIndex;
 				++CountLow;
 			}
 			
-			if (ObjectBoundingBoxes[Index].Max.E[SplitAxisIndex] >= SplitPoint)
+			if (ObjectBoundingBoxes[ObjectIndex].Max.E[SplitAxisIndex] >= SplitPoint)
 			{
-				TempObjectIndices[SplitCountLow + CountHigh] = Index;
+				TempObjectIndices[SplitCountLow + CountHigh] = ObjectIndex;
 				++CountHigh;
 			}
 		}
@@ -660,6 +701,7 @@ GenerateSpatialPartition(scene* Scene, memory_arena* Arena, memory_arena* Scratc
 		
 		for (s32 Depth = 0; Depth < MaxLeafDepth; ++Depth)
 		{
+			f64 LevelStartTime = TraceStart();
 			if (DebugOn)
 			{
 				printf("Depth: %d\n", Depth);
@@ -703,7 +745,7 @@ GenerateSpatialPartition(scene* Scene, memory_arena* Arena, memory_arena* Scratc
 						{
 							s32 ObjectIndex = TempObjectIndices[Node->FirstObjectIndex + Index];
 							object* Object = Scene->Objects + ObjectIndex;
-							ObjectBoundingBoxes[ObjectIndex] = GetRelativeBoundingBox(Object, Node->Bounds);
+							ObjectBoundingBoxes[ObjectIndex] = GetRelativeBoundingBox(Scene, Object, Node->Bounds);
 						}
 						for (s32 AxisIndex = 0; AxisIndex < 3; ++AxisIndex)
 						{
@@ -820,6 +862,7 @@ GenerateSpatialPartition(scene* Scene, memory_arena* Arena, memory_arena* Scratc
 			TotalIndexCount = IndexCount;
 			
 			TempObjectIndices = NewTempObjectIndices;
+			TraceEvent("partition level", LevelStartTime, Depth);
 			
 			if (!NodeSplit)
 			{
@@ -845,6 +888,68 @@ GenerateSpatialPartition(scene* Scene, memory_arena* Arena, memory_arena* Scratc
 		
 		SetAlignment(Arena, OldAlignment);
 		EndTemporaryMemory(CircularStart);
+	}
+	else
+	{
+		Result.ObjectCount = ObjectCount;
+		Result.RootNode = PushStruct(Arena, spatial_node);
+		Result.RootNode->Bounds = RootBounds;
+		Result.RootNode->IsLeaf = true;
+		Result.RootNode->ObjectCount = ObjectCount;
+		Result.RootNode->FirstObjectIndex = 0;
+		Result.ObjectIndices = (s32*)PushCopyArray(Arena, ObjectCount, ObjectIndices);
+		Result.LeafCount = 1;
+	}
+	return Result;
+}
+
+function spatial_partition
+GenerateSpatialPartition(scene* Scene, memory_arena* Arena, memory_arena* ScratchArena, s32 MaxObjectsPerLeaf, s32 MaxLeafDepth, f32 MaxDistance, b32 DebugOn)
+{
+	spatial_partition Result = {};
+	if (Scene->ObjectCount > MaxObjectsPerLeaf)
+	{
+		temporary_memory Temp = BeginTemporaryMemory(ScratchArena);
+		
+		rect3* ObjectBoundingBoxes = PushArray(ScratchArena, Scene->ObjectCount, rect3);
+		ObjectBoundingBoxes[0] = GetObjectBoundingBox(Scene, Scene->Objects + 0);
+		if (DebugOn)
+		{
+			printf("--DEBUG OUTPUT--\n");
+			printf("Bounding Boxes:");
+			printf("0: ");
+			PrintRect(ObjectBoundingBoxes[0]);
+			printf("\n");
+		}
+		rect3 RootBounds = ObjectBoundingBoxes[0];
+		for (s32 Index = 1; Index < Scene->ObjectCount; ++Index)
+		{
+			ObjectBoundingBoxes[Index] = GetObjectBoundingBox(Scene, Scene->Objects + Index);
+			if (DebugOn)
+			{
+				printf("%d: ", Index);
+				PrintRect(ObjectBoundingBoxes[Index]);
+				printf("\n");
+			}
+			RootBounds = Union(RootBounds, ObjectBoundingBoxes[Index]);
+		}
+		
+		v3 MaxDistV = {MaxDistance, MaxDistance, MaxDistance};
+		rect3 CameraBounds =
+		{
+			Scene->Camera.Origin - MaxDistV,
+			Scene->Camera.Origin + MaxDistV,
+		};
+		RootBounds = Intersection(RootBounds, CameraBounds);
+		
+		s32* ObjectIndices = PushArray(ScratchArena, Scene->ObjectCount, s32);
+		for (s32 Index = 0; Index < Scene->ObjectCount; ++Index)
+		{
+			ObjectIndices[Index] = Index;
+		}
+		Result = GenerateSpatialSubtree(Scene, ObjectIndices, Scene->ObjectCount, ObjectBoundingBoxes, RootBounds,
+			Arena, ScratchArena, MaxObjectsPerLeaf, MaxLeafDepth, DebugOn);
+		
 		EndTemporaryMemory(Temp);
 	}
 	else
@@ -865,6 +970,316 @@ GenerateSpatialPartition(scene* Scene, memory_arena* Arena, memory_arena* Scratc
 	return Result;
 }
 
+function b32
+IsEmpty(rect3 Bounds)
+{
+	b32 Result = (Bounds.Min.X > Bounds.Max.X) || (Bounds.Min.Y > Bounds.Max.Y) || (Bounds.Min.Z > Bounds.Max.Z);
+	return Result;
+}
+
+function b32
+Contains(rect3 Outer, rect3 Inner)
+{
+	b32 Result =
+		(Inner.Min.X >= Outer.Min.X) && (Inner.Max.X <= Outer.Max.X) &&
+		(Inner.Min.Y >= Outer.Min.Y) && (Inner.Max.Y <= Outer.Max.Y) &&
+		(Inner.Min.Z >= Outer.Min.Z) && (Inner.Max.Z <= Outer.Max.Z);
+	return Result;
+}
+
+#define LEAF_GATHERED 2 // Marks a leaf that is already in the list, while gathering leaves to update
+
+// Every leaf whose cell an object with these bounds could reach, by the same rule the build uses to send
+// objects down. Stops marking once MaxLeaves are gathered, and counts on so the caller can tell.
+function void
+GatherOverlappedLeaves(spatial_node* Node, s32 Depth, rect3 Bounds, spatial_node** Leaves, s32* LeafDepths, s32* LeafCount, s32 MaxLeaves)
+{
+	if (Node->IsLeaf)
+	{
+		if (Node->IsLeaf != LEAF_GATHERED)
+		{
+			if (*LeafCount < MaxLeaves)
+			{
+				Node->IsLeaf = LEAF_GATHERED;
+				Leaves[*LeafCount] = Node;
+				LeafDepths[*LeafCount] = Depth;
+			}
+			++*LeafCount;
+		}
+	}
+	else if (*LeafCount <= MaxLeaves)
+	{
+		s32 Axis = Node->SplitAxisIndex;
+		f32 SplitPoint = Node->Children[0]->Bounds.Max.E[Axis];
+		if (Bounds.Min.E[Axis] < SplitPoint)
+		{
+			GatherOverlappedLeaves(Node->Children[0], Depth + 1, Bounds, Leaves, LeafDepths, LeafCount, MaxLeaves);
+		}
+		if (Bounds.Max.E[Axis] >= SplitPoint)
+		{
+			GatherOverlappedLeaves(Node->Children[1], Depth + 1, Bounds, Leaves, LeafDepths, LeafCount, MaxLeaves);
+		}
+	}
+}
+
+function void
+OffsetLeafIndices(spatial_node* Node, s32 Offset)
+{
+	if (Node->IsLeaf)
+	{
+		Node->FirstObjectIndex += Offset;
+	}
+	else
+	{
+		OffsetLeafIndices(Node->Children[0], Offset);
+		OffsetLeafIndices(Node->Children[1], Offset);
+	}
+}
+
+// Copies the object indices of every leaf into one array again. Leaves starting past OldCount take
+// theirs from ExtraIndices instead, where the leaves built by an update keep them.
+function void
+CompactLeafIndices(spatial_node* Node, s32* OldIndices, s32 OldCount, s32* ExtraIndices, s32* Dest, s32* DestCount, s32* LeafCount)
+{
+	if (Node->IsLeaf)
+	{
+		s32* Source = Node->FirstObjectIndex < OldCount ? OldIndices + Node->FirstObjectIndex :
+			ExtraIndices + (Node->FirstObjectIndex - OldCount);
+		for (s32 Index = 0; Index < Node->ObjectCount; ++Index)
+		{
+			Dest[*DestCount + Index] = Source[Index];
+		}
+		Node->FirstObjectIndex = *DestCount;
+		*DestCount += Node->ObjectCount;
+		++*LeafCount;
+	}
+	else
+	{
+		CompactLeafIndices(Node->Children[0], OldIndices, OldCount, ExtraIndices, Dest, DestCount, LeafCount);
+		CompactLeafIndices(Node->Children[1], OldIndices, OldCount, ExtraIndices, Dest, DestCount, LeafCount);
+	}
+}
+
+// Brings a partition of OldScene up to date for NewScene, which has the same objects except for the
+// changed ones listed. Only the leaves a changed object reached before or reaches now get their objects
+// again, and a leaf that ends up with too many is split like the build would. The rest of the tree is
+// kept. Returns false when so much would change that building it from scratch is as cheap, or when the
+// changes reach outside the root cell. The new nodes go on Arena, and the ones they replace are left there.
+function b32
+UpdateSpatialPartition(spatial_partition* Partition, scene* OldScene, scene* NewScene, s32* ChangedObjects, s32 ChangedCount,
+	memory_arena* Arena, memory_arena* ScratchArena, s32 MaxObjectsPerLeaf, s32 MaxLeafDepth, f32 MaxDistance, b32 DebugOn)
+{
+	b32 Success = (OldScene->ObjectCount == NewScene->ObjectCount && 4*ChangedCount <= NewScene->ObjectCount);
+	spatial_node* Root = Partition->RootNode;
+	if (Success && !Root->IsLeaf && ChangedCount > 0)
+	{
+		temporary_memory Temp = BeginTemporaryMemory(ScratchArena);
+		
+		v3 MaxDistV = {MaxDistance, MaxDistance, MaxDistance};
+		rect3 CameraBounds =
+		{
+			NewScene->Camera.Origin - MaxDistV,
+			NewScene->Camera.Origin + MaxDistV,
+		};
+		
+		s32 MaxLeaves = Partition->LeafCount / 4 + 1;
+		spatial_node** Leaves = PushArray(ScratchArena, MaxLeaves, spatial_node*);
+		s32* LeafDepths = PushArray(ScratchArena, MaxLeaves, s32);
+		s32 LeafCount = 0;
+		for (s32 Index = 0; Success && Index < ChangedCount; ++Index)
+		{
+			s32 ObjectIndex = ChangedObjects[Index];
+			rect3 OldBounds = Intersection(GetObjectBoundingBox(OldScene, OldScene->Objects + ObjectIndex), Root->Bounds);
+			rect3 NewBounds = Intersection(GetObjectBoundingBox(NewScene, NewScene->Objects + ObjectIndex), CameraBounds);
+			if (!IsEmpty(NewBounds) && !Contains(Root->Bounds, NewBounds))
+			{
+				Success = false; // The root cell would have to grow
+			}
+			else
+			{
+				if (!IsEmpty(OldBounds))
+				{
+					GatherOverlappedLeaves(Root, 0, OldBounds, Leaves, LeafDepths, &LeafCount, MaxLeaves);
+				}
+				if (!IsEmpty(NewBounds))
+				{
+					GatherOverlappedLeaves(Root, 0, NewBounds, Leaves, LeafDepths, &LeafCount, MaxLeaves);
+				}
+				Success = (LeafCount <= MaxLeaves);
+			}
+		}
+		
+		if (Success)
+		{
+			// Changed objects are skipped where they were and added back wherever they reach now
+			u8* Changed = PushArray(ScratchArena, NewScene->ObjectCount, u8);
+			for (s32 Index = 0; Index < NewScene->ObjectCount; ++Index)
+			{
+				Changed[Index] = false;
+			}
+			for (s32 Index = 0; Index < ChangedCount; ++Index)
+			{
+				Changed[ChangedObjects[Index]] = true;
+			}
+			
+			s32* ObjectIndices = PushArray(ScratchArena, NewScene->ObjectCount, s32);
+			rect3* ObjectBoundingBoxes = PushArray(ScratchArena, NewScene->ObjectCount, rect3);
+			s32** LeafIndices = PushArray(ScratchArena, LeafCount, s32*);
+			s32* LeafIndexCounts = PushArray(ScratchArena, LeafCount, s32);
+			s32 ExtraCount = 0;
+			for (s32 LeafIndex = 0; LeafIndex < LeafCount; ++LeafIndex)
+			{
+				spatial_node* Leaf = Leaves[LeafIndex];
+				s32 ObjectCount = 0;
+				for (s32 Index = 0; Index < Leaf->ObjectCount; ++Index)
+				{
+					s32 ObjectIndex = Partition->ObjectIndices[Leaf->FirstObjectIndex + Index];
+					rect3 Bounds = GetRelativeBoundingBox(NewScene, NewScene->Objects + ObjectIndex, Leaf->Bounds);
+					if (!Changed[ObjectIndex] && !IsEmpty(Bounds))
+					{
+						ObjectBoundingBoxes[ObjectIndex] = Bounds;
+						ObjectIndices[ObjectCount++] = ObjectIndex;
+					}
+				}
+				for (s32 Index = 0; Index < ChangedCount; ++Index)
+				{
+					s32 ObjectIndex = ChangedObjects[Index];
+					rect3 Bounds = GetRelativeBoundingBox(NewScene, NewScene->Objects + ObjectIndex, Leaf->Bounds);
+					if (!IsEmpty(Bounds))
+					{
+						ObjectBoundingBoxes[ObjectIndex] = Bounds;
+						ObjectIndices[ObjectCount++] = ObjectIndex;
+					}
+				}
+				
+				spatial_partition Subtree = GenerateSpatialSubtree(NewScene, ObjectIndices, ObjectCount, ObjectBoundingBoxes, Leaf->Bounds,
+					Arena, ScratchArena, MaxObjectsPerLeaf, MaxLeafDepth - LeafDepths[LeafIndex], DebugOn);
+				*Leaf = *Subtree.RootNode;
+				LeafIndices[LeafIndex] = Subtree.ObjectIndices;
+				LeafIndexCounts[LeafIndex] = Subtree.ObjectCount;
+				ExtraCount += Subtree.ObjectCount;
+			}
+			
+			// The new leaves are numbered on from the end of the old indices, and everything is gathered in
+			// scratch and copied back, so a large partition doesn't need room for a second copy
+			s32* ExtraIndices = PushArray(ScratchArena, ExtraCount, s32);
+			s32 ExtraIndex = 0;
+			for (s32 LeafIndex = 0; LeafIndex < LeafCount; ++LeafIndex)
+			{
+				OffsetLeafIndices(Leaves[LeafIndex], Partition->ObjectCount + ExtraIndex);
+				for (s32 Index = 0; Index < LeafIndexCounts[LeafIndex]; ++Index)
+				{
+					ExtraIndices[ExtraIndex++] = LeafIndices[LeafIndex][Index];
+				}
+			}
+			s32* NewIndices = PushArray(ScratchArena, Partition->ObjectCount + ExtraCount, s32);
+			s32 IndexCount = 0;
+			s32 NewLeafCount = 0;
+			CompactLeafIndices(Root, Partition->ObjectIndices, Partition->ObjectCount, ExtraIndices, NewIndices, &IndexCount, &NewLeafCount);
+			if (IndexCount > Partition->ObjectCount)
+			{
+				if (HasRoom(Arena, IndexCount*sizeof(s32)))
+				{
+					Partition->ObjectIndices = PushArray(Arena, IndexCount, s32);
+				}
+				else
+				{
+					Success = false; // The leaves were changed already, so the partition has to be built again
+				}
+			}
+			if (Success)
+			{
+				for (s32 Index = 0; Index < IndexCount; ++Index)
+				{
+					Partition->ObjectIndices[Index] = NewIndices[Index];
+				}
+				Partition->ObjectCount = IndexCount;
+				Partition->LeafCount = NewLeafCount;
+				if (DebugOn)
+				{
+					printf("Updated %d leaves for %d changed objects\n", LeafCount, ChangedCount);
+				}
+			}
+		}
+		else
+		{
+			for (s32 Index = 0; Index < LeafCount && Index < MaxLeaves; ++Index)
+			{
+				Leaves[Index]->IsLeaf = true;
+			}
+		}
+		
+		EndTemporaryMemory(Temp);
+	}
+	return Success;
+}
+
+// Bottom level: one partition per group, built in the group's own space
+function void
+GenerateGroupPartition(scene* Scene, s32 GroupIndex, memory_arena* Arena, memory_arena* ScratchArena, s32 MaxObjectsPerLeaf, s32 MaxLeafDepth, b32 DebugOn)
+{
+	f64 GroupStartTime = TraceStart();
+	object_group* Group = Scene->Groups + GroupIndex;
+	Group->Partition = PushStruct(Arena, spatial_partition);
+	*Group->Partition = GenerateSpatialPartition(&Group->Scene, Arena, ScratchArena,
+		MaxObjectsPerLeaf, MaxLeafDepth, F32Max, DebugOn);
+	
+	Group->Bounds = (rect3){{F32Max, F32Max, F32Max}, {F32Min, F32Min, F32Min}};
+	for (s32 Index = 0; Index < Group->Scene.ObjectCount; ++Index)
+	{
+		Group->Bounds = Union(Group->Bounds, GetObjectBoundingBox(&Group->Scene, Group->Scene.Objects + Index));
+	}
+	TraceEvent("group partition", GroupStartTime, GroupIndex);
+}
+
+function void
+GenerateGroupPartitions(scene* Scene, memory_arena* Arena, memory_arena* ScratchArena, s32 MaxObjectsPerLeaf, s32 MaxLeafDepth, b32 DebugOn)
+{
+	for (s32 GroupIndex = 0; GroupIndex < Scene->GroupCount; ++GroupIndex)
+	{
+		GenerateGroupPartition(Scene, GroupIndex, Arena, ScratchArena, MaxObjectsPerLeaf, MaxLeafDepth, DebugOn);
+	}
+}
+
+// Top level: instances become objects of the scene bounded by their transformed group bounds
+function void
+ComputeInstanceBounds(scene* Scene)
+{
+	for (s32 InstanceIndex = 0; InstanceIndex < Scene->InstanceCount; ++InstanceIndex)
+	{
+		instance* Instance = Scene->Instances + InstanceIndex;
+		rect3 GroupBounds = Instance->Group->Bounds;
+		if (GroupBounds.Min.X > GroupBounds.Max.X)
+		{
+			Instance->Bounds = GroupBounds; // Empty group
+		}
+		else if (GroupBounds.Min.X == F32Min || GroupBounds.Min.Y == F32Min || GroupBounds.Min.Z == F32Min ||
+			GroupBounds.Max.X == F32Max || GroupBounds.Max.Y == F32Max || GroupBounds.Max.Z == F32Max)
+		{
+			// Unbounded groups (planes) stay unbounded, rather than overflowing when transformed
+			Instance->Bounds = (rect3){{F32Min, F32Min, F32Min}, {F32Max, F32Max, F32Max}};
+		}
+		else
+		{
+			Instance->Bounds = (rect3){{F32Max, F32Max, F32Max}, {F32Min, F32Min, F32Min}};
+			for (s32 CornerIndex = 0; CornerIndex < 8; ++CornerIndex)
+			{
+				v3 Corner =
+				{
+					(CornerIndex & 1) ? GroupBounds.Max.X : GroupBounds.Min.X,
+					(CornerIndex & 2) ? GroupBounds.Max.Y : GroupBounds.Min.Y,
+					(CornerIndex & 4) ? GroupBounds.Max.Z : GroupBounds.Min.Z,
+				};
+				v3 WorldCorner = FromInstanceSpace(Instance, Corner);
+				Instance->Bounds = Union(Instance->Bounds, (rect3){WorldCorner, WorldCorner});
+			}
+		}
+	}
+}
+
+// In intersect.h, so both ways of intersecting a scene share it
+function void IntersectInstance(ray_hit* RayHit, instance* Instance, v3 RayOrigin, v3 RayDir, b32 UsePartition, ray_trace_stats* Stats);
+
 function ray_hit
 RayIntersectScene(v3 RayOrigin, v3 RayDir, scene* Scene, spatial_partition* Partition, ray_trace_stats* Stats)
 {
@@ -907,6 +1322,7 @@ RayIntersectScene(v3 RayOrigin, v3 RayDir, scene* Scene, spatial_partition* Part
 							// Record a hit
 							RayHit.Dist = Hit;
 							RayHit.Object = Object;
+							RayHit.Instance = 0;
 							RayHit.Normal = (RayDDotNormal < 0 ? Object->Plane.Normal : -Object->Plane.Normal);
 						}
 					}
@@ -934,6 +1350,7 @@ RayIntersectScene(v3 RayOrigin, v3 RayDir, scene* Scene, spatial_partition* Part
 							v3 Normal = NormOrZero(RelHitPoint);
 							RayHit.Dist = Hit;
 							RayHit.Object = Object;
+							RayHit.Instance = 0;
 							RayHit.Normal = Normal; //(Inside ? -Normal : Normal);
 						}
 					}
@@ -966,6 +1383,7 @@ RayIntersectScene(v3 RayOrigin, v3 RayDir, scene* Scene, spatial_partition* Part
 										// Record a hit
 										RayHit.Dist = Hit;
 										RayHit.Object = Object;
+										RayHit.Instance = 0;
 										RayHit.Normal = (RayDDotNormal < 0 ? Normal : -Normal);
 										RayHit.UV = (uv){U, V};
 									}
@@ -1000,6 +1418,7 @@ RayIntersectScene(v3 RayOrigin, v3 RayDir, scene* Scene, spatial_partition* Part
 										// Record a hit
 										RayHit.Dist = Hit;
 										RayHit.Object = Object;
+										RayHit.Instance = 0;
 										RayHit.Normal = (RayDDotNormal < 0 ? Normal : -Normal);
 										RayHit.UV = (uv){U, V};
 									}
@@ -1009,6 +1428,15 @@ RayIntersectScene(v3 RayOrigin, v3 RayDir, scene* Scene, spatial_partition* Part
 					}
 				} break;
 				
+				case Obj_Instance:
+				{
+					// Trace the group in its own space, against its own partition
+					ray_trace_stats InstanceStats = {};
+					IntersectInstance(&RayHit, Scene->Instances + Object->Instance.Index, RayOrigin, RayDir, true, &InstanceStats);
+					SpatialNodesChecked += InstanceStats.SpatialNodesChecked;
+					ObjectsChecked += InstanceStats.ObjectsChecked;
+				} break;
+				
 				default:
 				{
 					fprintf(stderr, "Error: Encountered object of type %d in RayIntersectScene!\n", Object->Type);
@@ -1108,8 +1536,73 @@ RayIntersectScene(v3 RayOrigin, v3 RayDir, scene* Scene, spatial_partition* Part
 	return RayHit;
 }
 
+// Dest starts as a copy of its source node, so its child pointers still lead into the original tree
 function void
-RayTrace(scene* Scene, spatial_partition* Partition, surface* Surface, s32 SamplesPerPixel, s32 MaxBounces, memory_arena* ScratchArena, b32 DebugOn)
+CopySpatialChildren(spatial_node* Dest, memory_arena* Arena)
+{
+	if (!Dest->IsLeaf)
+	{
+		spatial_node* Children = PushArray(Arena, 2, spatial_node);
+		Children[0] = *Dest->Children[0];
+		Children[1] = *Dest->Children[1];
+		Dest->Children[0] = Children + 0;
+		Dest->Children[1] = Children + 1;
+		CopySpatialChildren(Children + 0, Arena);
+		CopySpatialChildren(Children + 1, Arena);
+	}
+}
+
+function void
+ReplicateScene(numa_replicas* Replicas, scene* Scene, spatial_partition* Partition, s32 ThreadCount)
+{
+	for (s32 Node = 0; Node < Replicas->NodeCount; ++Node)
+	{
+		ResetArena(Replicas->NodeArenas + Node);
+		Replicas->Built[Node] = false;
+		Replicas->Partitions[Node] = 0;
+	}
+	
+	#pragma omp parallel num_threads(ThreadCount)
+	{
+		// The first thread to show up on each node makes that node's copy
+		s32 Node = GetCurrentNumaNode();
+		b32 Claimed = false;
+		if (Node < Replicas->NodeCount)
+		{
+			#pragma omp critical (NumaReplicaClaim)
+			{
+				if (!Replicas->Built[Node])
+				{
+					Replicas->Built[Node] = true;
+					Claimed = true;
+				}
+			}
+		}
+		
+		if (Claimed)
+		{
+			memory_arena* Arena = Replicas->NodeArenas + Node;
+			scene* Copy = Replicas->Scenes + Node;
+			*Copy = *Scene;
+			Copy->Objects = (object*)PushCopyArray(Arena, Scene->ObjectCount, Scene->Objects);
+			Copy->Materials = (material*)PushCopyArray(Arena, Scene->MaterialCount, Scene->Materials);
+			if (Partition)
+			{
+				spatial_partition* PartitionCopy = PushStruct(Arena, spatial_partition);
+				Replicas->Partitions[Node] = PartitionCopy;
+				*PartitionCopy = *Partition;
+				PartitionCopy->ObjectIndices = (s32*)PushCopyArray(Arena, Partition->ObjectCount, Partition->ObjectIndices);
+				PartitionCopy->RootNode = PushStruct(Arena, spatial_node);
+				*PartitionCopy->RootNode = *Partition->RootNode;
+				CopySpatialChildren(PartitionCopy->RootNode, Arena);
+			}
+		}
+	}
+}
+
+function ray_trace_stats
+RayTrace(scene* Scene, spatial_partition* Partition, surface* Surface, s32 SamplesPerPixel, s32 MaxBounces, u64 Seed, b32 FilterTextures, memory_arena* ScratchArena, thread_arenas* ThreadArenas,
+	numa_replicas* Replicas, row_writer* RowWriter, pixel_costs* Costs, progress_reporter* Progress, ray_trace_stats* ThreadStats, bounce_stats* BounceStats, b32 CountHardwareEvents, b32 PrintStats, b32 DebugOn)
 {
 	temporary_memory Temp = BeginTemporaryMemory(ScratchArena);
 	b32 HitTexture = false; // Debug purposes
@@ -1119,19 +1612,29 @@ RayTrace(scene* Scene, spatial_partition* Partition, surface* Surface, s32 Sampl
 	f32 SampleWidth = PixelWidth / (f32) SamplesPerPixel;
 	f32 SampleHeight = PixelHeight / (f32) SamplesPerPixel;
 	f32 SampleWeight = 1.0f / (SamplesPerPixel*SamplesPerPixel);
+	f32 SampleSpread = sqrtf(SampleWidth*SampleHeight) / Scene->Camera.DistToSurface; // Angle covered by one sample's ray cone
 	v3 SurfaceOrigin = Scene->Camera.XAxis*(-0.5f*Scene->Camera.SurfaceWidth + 0.5f*SampleWidth) + Scene->Camera.YAxis*(-0.5f*Scene->Camera.SurfaceHeight + 0.5f*SampleHeight) - Scene->Camera.ZAxis*Scene->Camera.DistToSurface;
 	
-	s64 OldAlignment = ScratchArena->Alignment;
-	SetAlignment(ScratchArena, 64); // Make sure to align to cache lines to avoid false sharing
-	ray_trace_stats* AllStats = PushArray(ScratchArena, 0, ray_trace_stats); // Just find the location of the start, reserve the right number later ;)
+	ray_trace_stats** AllStats = PushArray(ScratchArena, ThreadArenas->Count, ray_trace_stats*);
+	bounce_stats** AllBounces = BounceStats ? PushArray(ScratchArena, ThreadArenas->Count, bounce_stats*) : 0;
 	s32 NumThreads;
-	#pragma omp parallel
+	#pragma omp parallel num_threads(ThreadArenas->Count)
 	{
 		s32 ThreadNum = omp_get_thread_num();
+		memory_arena* ThreadArena = &ThreadArenas->Threads[ThreadNum].Arena;
+		
+		// Traverse this NUMA node's copy of the objects and tree, if there is one
+		scene* ThreadScene = Scene;
+		spatial_partition* ThreadPartition = Partition;
+		GetNumaReplica(Replicas, &ThreadScene, &ThreadPartition);
+		
 		if (ThreadNum == 0)
 		{
 			NumThreads = omp_get_num_threads();
-			printf("%d Threads...\n", NumThreads);
+			if (PrintStats)
+			{
+				printf("%d Threads...\n", NumThreads);
+			}
 			if (DebugOn)
 			{
 				printf("--DEBUG OUTPUT--\n");
@@ -1139,16 +1642,36 @@ RayTrace(scene* Scene, spatial_partition* Partition, surface* Surface, s32 Sampl
 		}
 		
 		ray_trace_stats Stats = {};
-		#pragma omp for
+		bounce_stats* Bounces = 0;
+		if (BounceStats)
+		{
+			Bounces = PushStruct(ThreadArena, bounce_stats);
+			*Bounces = {};
+		}
+		perf_counters Counters = {};
+		if (CountHardwareEvents)
+		{
+			Counters = OpenPerfCounters();
+			StartPerfCounters(&Counters);
+		}
+		
+		// No barrier at the end of the rows, so the counters stop before the thread waits for the others
+		#pragma omp for nowait
 		for (s32 Y = 0; Y < Surface->Height; ++Y)
 		{
+			f64 RowStartTime = omp_get_wtime();
+			temporary_memory RowTemp = BeginTemporaryMemory(ThreadArena); // Anything allocated for a row is freed after it
 			if (DebugOn)
 			{
 				printf("Y=%d\n", Y);
 			}
-			random_sequence RNG = SeedRandom(4815162342ull*(Y + 1) + 1123581321ull); // Make sure each thread has own random sequence. This keeps it deterministic
+			random_sequence RNG = SeedRandom(4815162342ull*(Y + 1) + 1123581321ull + Seed*2654435761ull); // Make sure each thread has own random sequence. This keeps it deterministic
 			for (s32 X = 0; X < Surface->Width; ++X)
 			{
+				s64 RaysBefore = Stats.RaysCast;
+				s64 NodesBefore = Stats.SpatialNodesChecked;
+				s64 ObjectsBefore = Stats.ObjectsChecked;
+				f64 PixelStartTime = Costs ? omp_get_wtime() : 0;
 				color PixelColor = {};
 				for (s32 J = 0; J < SamplesPerPixel; ++J)
 				{
@@ -1166,8 +1689,21 @@ RayTrace(scene* Scene, spatial_partition* Partition, surface* Surface, s32 Sampl
 						v3 RayDir = NormOrZero(SurfaceOrigin + SurfaceX + SurfaceY);
 						
 						color SampleColor = {1.0f, 1.0f, 1.0f};
+						f32 ConeWidth = 0;
+						f32 ConeSpread = SampleSpread;
+						b32 Escaped = false;
+						if (Bounces)
+						{
+							++Bounces->Paths;
+						}
 						for (s32 Bounce = 0; Bounce < MaxBounces; ++Bounce)
 						{
+							bounce_depth_stats* BounceDepth = Bounces ? GetBounceDepth(Bounces, Bounce) : 0;
+							if (BounceDepth)
+							{
+								++BounceDepth->Rays;
+								BounceDepth->ThroughputSum += GetThroughput(SampleColor);
+							}
 							if (DebugOn && Debug)
 							{
 								printf("X(%d) Y(%d) Bounce(%d)\n",
@@ -1176,11 +1712,13 @@ RayTrace(scene* Scene, spatial_partition* Partition, surface* Surface, s32 Sampl
 									RayOrigin.X, RayOrigin.Y, RayOrigin.Z, RayDir.X, RayDir.Y, RayDir.Z);
 							}
 							
-							ray_hit Hit = RayIntersectScene(RayOrigin, RayDir, Scene, Partition, &Stats);
+							ray_hit Hit = RayIntersectScene(RayOrigin, RayDir, ThreadScene, ThreadPartition, &Stats);
 							if (Hit.Dist > 0)
 							{
 								RayOrigin = RayOrigin + RayDir*Hit.Dist;
 								f32 RayDDotNormal = Dot(RayDir, Hit.Normal);
+								material* Material = ThreadScene->Materials + Hit.Object->Material;
+								ConeWidth += ConeSpread*Hit.Dist;
 								
 								if (DebugOn && Debug)
 								{
@@ -1197,11 +1735,15 @@ RayTrace(scene* Scene, spatial_partition* Partition, surface* Surface, s32 Sampl
 								
 								// Bounce direction
 								f32 Random = RandomUnilateral(&RNG);
-								if (Random < Hit.Object->Translucency)
+								if (Random < Material->Translucency)
 								{
 									// Pass through the object
+									if (BounceDepth)
+									{
+										++BounceDepth->Translucent;
+									}
 									v3 ParallelComponent = RayDir - Hit.Normal*RayDDotNormal;
-									f32 RefractionCoeff = 1.0f + Hit.Object->Refraction;
+									f32 RefractionCoeff = 1.0f + Material->Refraction;
 									if (RayDDotNormal < 0)
 									{
 										RefractionCoeff = 1.0f / RefractionCoeff;
@@ -1219,27 +1761,28 @@ RayTrace(scene* Scene, spatial_partition* Partition, surface* Surface, s32 Sampl
 									{
 										RandomBounce = -RandomBounce;
 									}
-									RayDir = NormOrDefault(Lerp(RandomBounce, Hit.Object->Glossy, Reflection), Hit.Normal);
+									RayDir = NormOrDefault(Lerp(RandomBounce, Material->Glossy, Reflection), Hit.Normal);
 									Falloff = Abs(Dot(RayDir, Hit.Normal));
+									ConeSpread += (1.0f - Material->Glossy)*RAY_CONE_DIFFUSE_SPREAD;
 								}
 								RayOrigin = RayOrigin + EPSILON*RayDir; // Try to move a little away from the surface to "de-bounce"
 								
-								if (Hit.Object->Texture.Index > 0)
+								if (Material->Texture.Index > 0)
 								{
-									surface* Texture = Scene->Textures + Hit.Object->Texture.Index - 1;
-									v2 SampleUV = Lerp(Hit.Object->UVMap.VertexUV[0], Hit.UV.U, Hit.Object->UVMap.VertexUV[1]) +
-										Lerp(Hit.Object->UVMap.VertexUV[0], Hit.UV.V, Hit.Object->UVMap.VertexUV[2]);
-									s32 SampleX = (s32)(SampleUV.U*(f32)Texture->Width) % Texture->Width;
-									if (SampleX < 0)
+									texture* Texture = Scene->Textures + Material->Texture.Index - 1;
+									v2 SampleUV = Lerp(Material->UVMap.VertexUV[0], Hit.UV.U, Material->UVMap.VertexUV[1]) +
+										Lerp(Material->UVMap.VertexUV[0], Hit.UV.V, Material->UVMap.VertexUV[2]);
+									f32 LevelOfDetail = 0;
+									color TextureColor;
+									if (FilterTextures)
 									{
-										SampleX += Texture->Width;
+										LevelOfDetail = TextureLevelOfDetail(Texture, Hit.Object, Hit.Instance, Material, ConeWidth, RayDDotNormal);
+										TextureColor = SampleTexture(Texture, SampleUV, LevelOfDetail);
 									}
-									s32 SampleY = (s32)(SampleUV.V*(f32)Texture->Height) % Texture->Height;
-									if (SampleY < 0)
+									else
 									{
-										SampleY += Texture->Height;
+										TextureColor = SampleTextureNearest(Texture, SampleUV);
 									}
-									color TextureColor = Texture->Pixels[SampleY*Texture->Width + SampleX];
 									
 									if (DebugOn && Debug && !HitTexture && Bounce == 0)
 									{
@@ -1247,9 +1790,9 @@ RayTrace(scene* Scene, spatial_partition* Partition, surface* Surface, s32 Sampl
 										printf("X(%d) Y(%d)\n",
 											X, Y);
 										printf("ObjectType(%d) Texture(%d)\n",
-											Hit.Object->Type, Hit.Object->Texture.Index);
-										printf("SampleUV(%.2f,%.2f) SampleX(%d) SampleY(%d)\n",
-											SampleUV.U, SampleUV.V, SampleX, SampleY);
+											Hit.Object->Type, Material->Texture.Index);
+										printf("SampleUV(%.2f,%.2f) LevelOfDetail(%.2f)\n",
+											SampleUV.U, SampleUV.V, LevelOfDetail);
 									}
 									
 									SampleColor.R *= TextureColor.R*Falloff;
@@ -1258,9 +1801,9 @@ RayTrace(scene* Scene, spatial_partition* Partition, surface* Surface, s32 Sampl
 								}
 								else
 								{
-									SampleColor.R *= Hit.Object->Color.R*Falloff;
-									SampleColor.G *= Hit.Object->Color.G*Falloff;
-									SampleColor.B *= Hit.Object->Color.B*Falloff;
+									SampleColor.R *= Material->Color.R*Falloff;
+									SampleColor.G *= Material->Color.G*Falloff;
+									SampleColor.B *= Material->Color.B*Falloff;
 								}
 								
 								if (DebugOn && Debug)
@@ -1274,9 +1817,18 @@ RayTrace(scene* Scene, spatial_partition* Partition, surface* Surface, s32 Sampl
 								SampleColor.R *= Scene->SkyColor.R;
 								SampleColor.G *= Scene->SkyColor.G;
 								SampleColor.B *= Scene->SkyColor.B;
+								if (BounceDepth)
+								{
+									++BounceDepth->Escapes;
+								}
+								Escaped = true;
 								break;
 							}
 						}
+						if (Bounces && !Escaped)
+						{
+							RecordCutOff(Bounces, SampleColor);
+						}
 						
 						PixelColor.R += SampleColor.R;
 						PixelColor.G += SampleColor.G;
@@ -1284,11 +1836,39 @@ RayTrace(scene* Scene, spatial_partition* Partition, surface* Surface, s32 Sampl
 					}
 				}
 				Surface->Pixels[Y*Surface->Width + X] = PixelColor*SampleWeight;
+				if (Costs)
+				{
+					s64 Index = (s64)Y*Surface->Width + X;
+					Costs->Values[PixelCost_Rays][Index] = (f32)(Stats.RaysCast - RaysBefore);
+					Costs->Values[PixelCost_Nodes][Index] = (f32)(Stats.SpatialNodesChecked - NodesBefore);
+					Costs->Values[PixelCost_Objects][Index] = (f32)(Stats.ObjectsChecked - ObjectsBefore);
+					Costs->Values[PixelCost_Nanoseconds][Index] = (f32)((omp_get_wtime() - PixelStartTime)*1e9);
+				}
 			}
+			if (RowWriter)
+			{
+				MarkRowDone(RowWriter, Y);
+			}
+			if (Progress)
+			{
+				MarkRowProgress(Progress, ThreadNum, Stats.RaysCast);
+			}
+			EndTemporaryMemory(RowTemp);
+			Stats.BusySeconds += omp_get_wtime() - RowStartTime;
+			TraceEvent("row", RowStartTime, Y);
+		}
+		if (CountHardwareEvents)
+		{
+			Stats.Counters = StopPerfCounters(&Counters);
+			ClosePerfCounters(&Counters);
+		}
+		AllStats[ThreadNum] = PushStruct(ThreadArena, ray_trace_stats);
+		*AllStats[ThreadNum] = Stats;
+		if (Bounces)
+		{
+			AllBounces[ThreadNum] = Bounces;
 		}
-		AllStats[ThreadNum] = Stats;
 	}
-	PushArray(ScratchArena, NumThreads, ray_trace_stats); // Actually reserve the space :)
 	
 	if (DebugOn)
 	{
@@ -1298,17 +1878,57 @@ RayTrace(scene* Scene, spatial_partition* Partition, surface* Surface, s32 Sampl
 	ray_trace_stats OverallStats = {};
 	for (s32 Index = 0; Index < NumThreads; ++Index)
 	{
-		printf("Thread %d: %ld rays cast, %ld spatial nodes checked, %ld objects checked, %ld samples computed\n",
-			Index, AllStats[Index].RaysCast, AllStats[Index].SpatialNodesChecked, AllStats[Index].ObjectsChecked, AllStats[Index].SamplesComputed);
-		OverallStats.RaysCast += AllStats[Index].RaysCast;
-		OverallStats.SpatialNodesChecked += AllStats[Index].SpatialNodesChecked;
-		OverallStats.ObjectsChecked += AllStats[Index].ObjectsChecked;
-		OverallStats.SamplesComputed += AllStats[Index].SamplesComputed;
+		// Callers collecting the per-thread stats get them in ThreadStats rather than one line per thread
+		if (ThreadStats)
+		{
+			ThreadStats[Index] = *AllStats[Index];
+		}
+		else if (PrintStats)
+		{
+			printf("Thread %d: %ld rays cast, %ld spatial nodes checked, %ld objects checked, %ld samples computed, %6.4f (s) busy\n",
+				Index, AllStats[Index]->RaysCast, AllStats[Index]->SpatialNodesChecked, AllStats[Index]->ObjectsChecked, AllStats[Index]->SamplesComputed, AllStats[Index]->BusySeconds);
+			if (CountHardwareEvents)
+			{
+				PrintPerfCounts("\tCounters", &AllStats[Index]->Counters);
+			}
+		}
+		OverallStats.RaysCast += AllStats[Index]->RaysCast;
+		OverallStats.SpatialNodesChecked += AllStats[Index]->SpatialNodesChecked;
+		OverallStats.ObjectsChecked += AllStats[Index]->ObjectsChecked;
+		OverallStats.SamplesComputed += AllStats[Index]->SamplesComputed;
+		OverallStats.BusySeconds += AllStats[Index]->BusySeconds;
+		AddPerfCounts(&OverallStats.Counters, &AllStats[Index]->Counters);
+		if (AllStats[Index]->BusySeconds > OverallStats.MaxBusySeconds)
+		{
+			OverallStats.MaxBusySeconds = AllStats[Index]->BusySeconds;
+		}
+	}
+	OverallStats.ThreadCount = NumThreads;
+	if (BounceStats)
+	{
+		*BounceStats = {};
+		BounceStats->MaxBounces = MaxBounces;
+		for (s32 Index = 0; Index < NumThreads; ++Index)
+		{
+			AddBounceStats(BounceStats, AllBounces[Index]);
+		}
+	}
+	if (PrintStats)
+	{
+		printf("--------\n");
+		printf("Overall: %ld rays cast, %ld spatial nodes checked, %ld objects checked, %ld samples computed, load imbalance %.2f\n",
+			OverallStats.RaysCast, OverallStats.SpatialNodesChecked, OverallStats.ObjectsChecked, OverallStats.SamplesComputed, GetLoadImbalance(&OverallStats));
+		if (CountHardwareEvents)
+		{
+			PrintPerfCounts("Overall counters", &OverallStats.Counters);
+		}
 	}
-	printf("--------\n");
-	printf("Overall: %ld rays cast, %ld spatial nodes checked, %ld objects checked, %ld samples computed\n",
-		OverallStats.RaysCast, OverallStats.SpatialNodesChecked, OverallStats.ObjectsChecked, OverallStats.SamplesComputed);
 	
+	// The per-thread stats were the last thing left in the thread arenas, so the pass is done with them
+	for (s32 Index = 0; Index < NumThreads; ++Index)
+	{
+		ResetArena(&ThreadArenas->Threads[Index].Arena);
+	}
 	EndTemporaryMemory(Temp);
-	SetAlignment(ScratchArena, OldAlignment);
+	return OverallStats;
 }
\ No newline at end of file
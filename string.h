@@ -99,6 +99,17 @@ StartsWith(string A, string B)
 	return Result;
 }
 
+function b32
+EndsWith(string A, string B)
+{
+	b32 Result = (A.Count >= B.Count);
+	if (Result)
+	{
+		Result = StartsWith((string){B.Count, A.Data + A.Count - B.Count}, B);
+	}
+	return Result;
+}
+
 function b32
 StringsMatch(string A, string B)
 {
@@ -116,3 +127,41 @@ StringsMatch(string A, string B)
 	}
 	return Result;
 }
+
+function s64
+CountOccurrences(string A, string B)
+{
+	s64 Result = 0;
+	for (s64 Index = 0; Index + B.Count <= A.Count; ++Index)
+	{
+		if (A.Data[Index] == B.Data[0] && StartsWith((string){A.Count - Index, A.Data + Index}, B))
+		{
+			++Result;
+		}
+	}
+	return Result;
+}
+
+// Writes a C string as a quoted JSON string, escaping the characters JSON does not allow as they are
+function void
+WriteJSONString(FILE* File, const char* String)
+{
+	fputc('"', File);
+	for (const char* C = String ? String : ""; *C; ++C)
+	{
+		if (*C == '"' || *C == '\\')
+		{
+			fputc('\\', File);
+			fputc(*C, File);
+		}
+		else if ((u8)*C < 0x20)
+		{
+			fprintf(File, "\\u%04x", (u8)*C);
+		}
+		else
+		{
+			fputc(*C, File);
+		}
+	}
+	fputc('"', File);
+}
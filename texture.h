@@ -0,0 +1,267 @@
+/*
+ * texture.h
+ *
+ * Mip chains of tiled texels, filtered sampling and picking a level from a ray cone
+ */
+
+// Each level is stored as 4x4 tiles of texels, so one tile fills a 64 byte cache line and a
+// bilinear lookup usually stays inside one or two lines
+#define TEXTURE_TILE_SHIFT 2
+#define TEXTURE_TILE_SIZE (1 << TEXTURE_TILE_SHIFT)
+#define TEXTURE_TILE_MASK (TEXTURE_TILE_SIZE - 1)
+
+// How much a ray cone widens when it bounces off a fully diffuse surface
+#define RAY_CONE_DIFFUSE_SPREAD 0.5f
+
+function s64
+TexelIndex(texture_level* Level, s32 X, s32 Y)
+{
+	s64 Tile = (s64)(Y >> TEXTURE_TILE_SHIFT)*Level->TilesPerRow + (X >> TEXTURE_TILE_SHIFT);
+	s64 Result = (Tile << (2*TEXTURE_TILE_SHIFT)) + ((Y & TEXTURE_TILE_MASK) << TEXTURE_TILE_SHIFT) + (X & TEXTURE_TILE_MASK);
+	return Result;
+}
+
+function s64
+TiledTexelCount(s32 Width, s32 Height)
+{
+	s64 TilesPerRow = (Width + TEXTURE_TILE_MASK) >> TEXTURE_TILE_SHIFT;
+	s64 TileRows = (Height + TEXTURE_TILE_MASK) >> TEXTURE_TILE_SHIFT;
+	s64 Result = TilesPerRow*TileRows*TEXTURE_TILE_SIZE*TEXTURE_TILE_SIZE;
+	return Result;
+}
+
+// Rounds a linear component back to the 8 bit encoding used in texels
+function u32
+TexelComponentFromLinear(f32 C)
+{
+#ifdef NO_GAMMA_CORRECTION
+	u32 Result = (u32)(Clamp01(C)*255.0f + 0.5f);
+#else
+	u32 Result = (u32)(sqrtf(Clamp01(C))*255.0f + 0.5f);
+#endif
+	return Result;
+}
+
+// Averages 2x2 blocks of the previous level in linear space. Odd sizes repeat the last row or column.
+function void
+DownsampleTextureLevel(texture_level* Source, texture_level* Dest)
+{
+	#pragma omp parallel for
+	for (s32 Y = 0; Y < Dest->Height; ++Y)
+	{
+		s32 Y0 = 2*Y;
+		s32 Y1 = Y0 + 1 < Source->Height ? Y0 + 1 : Y0;
+		for (s32 X = 0; X < Dest->Width; ++X)
+		{
+			s32 X0 = 2*X;
+			s32 X1 = X0 + 1 < Source->Width ? X0 + 1 : X0;
+			color Sum = ColorFromTexel(Source->Texels[TexelIndex(Source, X0, Y0)]) +
+				ColorFromTexel(Source->Texels[TexelIndex(Source, X1, Y0)]) +
+				ColorFromTexel(Source->Texels[TexelIndex(Source, X0, Y1)]) +
+				ColorFromTexel(Source->Texels[TexelIndex(Source, X1, Y1)]);
+			Sum = Sum*0.25f;
+			Dest->Texels[TexelIndex(Dest, X, Y)] = (TexelComponentFromLinear(Sum.R) |
+				(TexelComponentFromLinear(Sum.G) << 8) |
+				(TexelComponentFromLinear(Sum.B) << 16) |
+				(0xFFu << 24));
+		}
+	}
+}
+
+// Fills in the size of every level of the mip chain and the texel count over all of them
+function void
+PlanTextureLevels(texture* Texture, s32 Width, s32 Height)
+{
+	Texture->Width = Width;
+	Texture->Height = Height;
+	Texture->LevelCount = 0;
+	Texture->TexelCount = 0;
+	while (Width > 0 && Height > 0 && Texture->LevelCount < MAX_TEXTURE_LEVELS)
+	{
+		texture_level* Level = Texture->Levels + Texture->LevelCount++;
+		Level->Width = Width;
+		Level->Height = Height;
+		Level->TilesPerRow = (Width + TEXTURE_TILE_MASK) >> TEXTURE_TILE_SHIFT;
+		Texture->TexelCount += TiledTexelCount(Width, Height);
+		if (Width == 1 && Height == 1)
+		{
+			break;
+		}
+		Width = Width > 1 ? Width/2 : 1;
+		Height = Height > 1 ? Height/2 : 1;
+	}
+}
+
+// Upper bounds on what LoadTexture allocates for a file, so each load can get its own fixed arenas
+function void
+GetTextureLoadSizes(const char* FileName, s64* ArenaSize, s64* ScratchSize)
+{
+	s32 Width = 0;
+	s32 Height = 0;
+	s64 FileSize = 0;
+	ReadTGASize(FileName, &Width, &Height, &FileSize);
+	texture Plan = {};
+	PlanTextureLevels(&Plan, Width, Height);
+	s64 PixelCount = (s64)Width*Height;
+	*ArenaSize = Plan.TexelCount*sizeof(u32) + 64;
+	*ScratchSize = FileSize + PixelCount*(sizeof(u32) + 3) + 64;
+}
+
+// Reads a TARGA file through the scratch arena, then tiles it and builds the full mip chain in Arena
+function texture
+LoadTexture(const char* FileName, memory_arena* Arena, memory_arena* ScratchArena)
+{
+	texture Texture = {};
+	temporary_memory Temp = BeginTemporaryMemory(ScratchArena);
+	s32 Width = 0;
+	s32 Height = 0;
+	u32* Rows = (u32*)LoadTGAPixels(FileName, ScratchArena, true, &Width, &Height);
+	b32 Loaded = (Rows && Width > 0 && Height > 0);
+	if (Loaded)
+	{
+		// The arena was sized from the file as it was when the load was planned, which may not be
+		// the file that was read, so a size that no longer fits fails this load like a missing file
+		PlanTextureLevels(&Texture, Width, Height);
+		Loaded = HasRoom(Arena, Texture.TexelCount*sizeof(u32));
+		if (!Loaded)
+		{
+			fprintf(stderr, "Error reading file %s: Changed to a %dx%d image while loading\n", FileName, Width, Height);
+			Texture = {};
+		}
+	}
+	
+	if (Loaded)
+	{
+		s64 TexelCount = Texture.TexelCount;
+		Texture.Texels = PushArray(Arena, TexelCount, u32);
+		u32* NextTexels = Texture.Texels;
+		for (s32 LevelIndex = 0; LevelIndex < Texture.LevelCount; ++LevelIndex)
+		{
+			texture_level* Level = Texture.Levels + LevelIndex;
+			Level->Texels = NextTexels;
+			NextTexels += TiledTexelCount(Level->Width, Level->Height);
+		}
+		
+		texture_level* Base = Texture.Levels;
+		#pragma omp parallel for
+		for (s32 Y = 0; Y < Base->Height; ++Y)
+		{
+			for (s32 X = 0; X < Base->Width; ++X)
+			{
+				Base->Texels[TexelIndex(Base, X, Y)] = Rows[(s64)Y*Base->Width + X];
+			}
+		}
+		for (s32 LevelIndex = 1; LevelIndex < Texture.LevelCount; ++LevelIndex)
+		{
+			DownsampleTextureLevel(Texture.Levels + LevelIndex - 1, Texture.Levels + LevelIndex);
+		}
+	}
+	EndTemporaryMemory(Temp);
+	return Texture;
+}
+
+function s32
+WrapTexelCoordinate(s32 Value, s32 Size)
+{
+	s32 Result = Value % Size;
+	if (Result < 0)
+	{
+		Result += Size;
+	}
+	return Result;
+}
+
+// Single texel from the full resolution level, like textures were always sampled before filtering
+function color
+SampleTextureNearest(texture* Texture, v2 UV)
+{
+	texture_level* Level = Texture->Levels;
+	s32 X = WrapTexelCoordinate((s32)(UV.U*(f32)Level->Width), Level->Width);
+	s32 Y = WrapTexelCoordinate((s32)(UV.V*(f32)Level->Height), Level->Height);
+	color Result = ColorFromTexel(Level->Texels[TexelIndex(Level, X, Y)]);
+	return Result;
+}
+
+function color
+SampleTextureLevelBilinear(texture_level* Level, v2 UV)
+{
+	f32 FX = UV.U*(f32)Level->Width - 0.5f;
+	f32 FY = UV.V*(f32)Level->Height - 0.5f;
+	f32 FloorX = floorf(FX);
+	f32 FloorY = floorf(FY);
+	f32 TX = FX - FloorX;
+	f32 TY = FY - FloorY;
+	s32 X0 = WrapTexelCoordinate((s32)FloorX, Level->Width);
+	s32 Y0 = WrapTexelCoordinate((s32)FloorY, Level->Height);
+	s32 X1 = X0 + 1 < Level->Width ? X0 + 1 : 0;
+	s32 Y1 = Y0 + 1 < Level->Height ? Y0 + 1 : 0;
+	
+	color Bottom = Lerp(ColorFromTexel(Level->Texels[TexelIndex(Level, X0, Y0)]), TX,
+		ColorFromTexel(Level->Texels[TexelIndex(Level, X1, Y0)]));
+	color Top = Lerp(ColorFromTexel(Level->Texels[TexelIndex(Level, X0, Y1)]), TX,
+		ColorFromTexel(Level->Texels[TexelIndex(Level, X1, Y1)]));
+	color Result = Lerp(Bottom, TY, Top);
+	return Result;
+}
+
+// Bilinear lookups in the two levels around LevelOfDetail, blended together. Magnified
+// textures keep hard texel edges, since scene textures are often just a few texels.
+function color
+SampleTexture(texture* Texture, v2 UV, f32 LevelOfDetail)
+{
+	color Result;
+	f32 MaxLevel = (f32)(Texture->LevelCount - 1);
+	if (LevelOfDetail <= 0)
+	{
+		Result = SampleTextureNearest(Texture, UV);
+	}
+	else if (LevelOfDetail >= MaxLevel)
+	{
+		Result = SampleTextureLevelBilinear(Texture->Levels + Texture->LevelCount - 1, UV);
+	}
+	else
+	{
+		s32 Lower = (s32)LevelOfDetail;
+		f32 T = LevelOfDetail - (f32)Lower;
+		Result = Lerp(SampleTextureLevelBilinear(Texture->Levels + Lower, UV), T,
+			SampleTextureLevelBilinear(Texture->Levels + Lower + 1, UV));
+	}
+	return Result;
+}
+
+// Level of detail for a ray cone of the given width hitting the object, from the ratio of
+// texel area to world area of the object's UV mapping (Akenine-Moller et al., Ray Tracing Gems ch. 20).
+// Objects hit in an instance are in group space, so their edges go through its transform first.
+function f32
+TextureLevelOfDetail(texture* Texture, object* Object, instance* Instance, material* Material, f32 ConeWidth, f32 RayDDotNormal)
+{
+	f32 Result = 0;
+	v3 AB = {};
+	v3 AC = {};
+	if (Object->Type == Obj_Triangle)
+	{
+		AB = Object->Triangle.Vertex[1] - Object->Triangle.Vertex[0];
+		AC = Object->Triangle.Vertex[2] - Object->Triangle.Vertex[0];
+	}
+	else if (Object->Type == Obj_Parallelogram)
+	{
+		AB = Object->Parallelogram.XAxis;
+		AC = Object->Parallelogram.YAxis;
+	}
+	if (Instance)
+	{
+		AB = VectorFromInstanceSpace(Instance, AB);
+		AC = VectorFromInstanceSpace(Instance, AC);
+	}
+	
+	f32 WorldArea = Length(Cross(AB, AC));
+	v2 UVAB = Material->UVMap.VertexUV[1] - Material->UVMap.VertexUV[0];
+	v2 UVAC = Material->UVMap.VertexUV[2] - Material->UVMap.VertexUV[0];
+	f32 TexelArea = Abs(UVAB.U*UVAC.V - UVAB.V*UVAC.U)*(f32)Texture->Width*(f32)Texture->Height;
+	f32 Cosine = Abs(RayDDotNormal);
+	if (WorldArea > EPSILON && TexelArea > EPSILON && ConeWidth > EPSILON && Cosine > EPSILON)
+	{
+		Result = 0.5f*log2f(TexelArea/WorldArea) + log2f(ConeWidth/Cosine);
+	}
+	return Result;
+}
\ No newline at end of file
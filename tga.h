@@ -35,7 +35,7 @@ enum tga_image_type
 	TGA_UncompressedColorMapped,
 	TGA_UncompressedTrueColor,
 	TGA_UncompressedBlackAndWhite,
-	TGA_RLEColorMapped,
+	TGA_RLEColorMapped = 9,
 	TGA_RLETrueColor,
 	TGA_RLEBlackAndWhite,
 };
@@ -85,10 +85,235 @@ U8FromColorComponent(f32 C)
 	return Result;
 }
 
-function surface
-LoadTGA(const char* FileName, memory_arena* Arena)
+// Converts Count color components with exactly the rounding of U8FromColorComponent. SSE2
+// clamps, takes the square root and truncates sixteen components per iteration.
+function void
+U8FromColorComponents(f32* Source, s64 Count, u8* Dest)
 {
-	surface Surface = {};
+	s64 Index = 0;
+#ifdef __SSE2__
+	__m128 Zero = _mm_setzero_ps();
+	__m128 One = _mm_set1_ps(1.0f);
+	__m128 Scale = _mm_set1_ps(255.0f);
+	for (; Index + 16 <= Count; Index += 16)
+	{
+		__m128i Values[4];
+		for (s32 Part = 0; Part < 4; ++Part)
+		{
+			__m128 C = _mm_loadu_ps(Source + Index + 4*Part);
+			C = _mm_max_ps(Zero, _mm_min_ps(One, C));
+#ifndef NO_GAMMA_CORRECTION
+			C = _mm_sqrt_ps(C);
+#endif
+			Values[Part] = _mm_cvttps_epi32(_mm_mul_ps(C, Scale));
+		}
+		__m128i Low = _mm_packs_epi32(Values[0], Values[1]);
+		__m128i High = _mm_packs_epi32(Values[2], Values[3]);
+		_mm_storeu_si128((__m128i*)(Dest + Index), _mm_packus_epi16(Low, High));
+	}
+#endif
+	for (; Index < Count; ++Index)
+	{
+		Dest[Index] = U8FromColorComponent(Source[Index]);
+	}
+}
+
+function void
+RGB24FromColors(color* Source, s64 Count, u8* Dest)
+{
+	U8FromColorComponents((f32*)Source, 3*Count, Dest);
+}
+
+function void
+BGR24FromColors(color* Source, s64 Count, u8* Dest)
+{
+	U8FromColorComponents((f32*)Source, 3*Count, Dest);
+	for (s64 Index = 0; Index < Count; ++Index)
+	{
+		u8 R = Dest[3*Index + 0];
+		Dest[3*Index + 0] = Dest[3*Index + 2];
+		Dest[3*Index + 2] = R;
+	}
+}
+
+// Every 8 bit component maps to one of 256 floats, so loading looks them up instead of dividing
+global f32 ColorComponentTable[256];
+global b32 ColorComponentTableReady;
+
+function void
+InitColorComponentTable()
+{
+	if (!ColorComponentTableReady)
+	{
+		for (s32 Index = 0; Index < 256; ++Index)
+		{
+			ColorComponentTable[Index] = ColorFromRGB24((u8)Index, 0, 0).R;
+		}
+		ColorComponentTableReady = true;
+	}
+}
+
+function void
+ColorsFromBGR24(u8* Source, s64 Count, color* Dest)
+{
+	for (s64 Index = 0; Index < Count; ++Index)
+	{
+		Dest[Index].R = ColorComponentTable[Source[3*Index + 2]];
+		Dest[Index].G = ColorComponentTable[Source[3*Index + 1]];
+		Dest[Index].B = ColorComponentTable[Source[3*Index + 0]];
+	}
+}
+
+// Texels keep the 8 bit components from the file as R | G << 8 | B << 16 | A << 24
+function void
+TexelsFromBGR24(u8* Source, s64 Count, u32* Dest)
+{
+	for (s64 Index = 0; Index < Count; ++Index)
+	{
+		Dest[Index] = ((u32)Source[3*Index + 2] |
+			((u32)Source[3*Index + 1] << 8) |
+			((u32)Source[3*Index + 0] << 16) |
+			(0xFFu << 24));
+	}
+}
+
+// Decodes to the same color LoadTGA would have stored for the texel
+function color
+ColorFromTexel(u32 Texel)
+{
+	color Result =
+	{
+		ColorComponentTable[Texel & 0xFF],
+		ColorComponentTable[(Texel >> 8) & 0xFF],
+		ColorComponentTable[(Texel >> 16) & 0xFF],
+	};
+	return Result;
+}
+
+// Worst case size of one RLE encoded row: all raw packets, each holding at most 128 pixels
+function s64
+MaxRLERowSize(s32 Width)
+{
+	s64 Result = 3*(s64)Width + (Width + 127)/128;
+	return Result;
+}
+
+function b32
+BGR24Equal(u8* A, u8* B)
+{
+	b32 Result = (A[0] == B[0] && A[1] == B[1] && A[2] == B[2]);
+	return Result;
+}
+
+// Packets never cross rows, so rows can be encoded independently
+function s64
+EncodeRLERow(u8* Source, s32 Width, u8* Dest)
+{
+	u8* DestByte = Dest;
+	s32 X = 0;
+	while (X < Width)
+	{
+		s32 RunLength = 1;
+		while (X + RunLength < Width && RunLength < 128 &&
+			BGR24Equal(Source + 3*X, Source + 3*(X + RunLength)))
+		{
+			++RunLength;
+		}
+		
+		if (RunLength > 1)
+		{
+			*DestByte++ = (u8)(0x80 | (RunLength - 1));
+			*DestByte++ = Source[3*X + 0];
+			*DestByte++ = Source[3*X + 1];
+			*DestByte++ = Source[3*X + 2];
+			X += RunLength;
+		}
+		else
+		{
+			// Take raw pixels until the next repeated pair, which gets its own run packet
+			s32 RawLength = 1;
+			while (X + RawLength < Width && RawLength < 128 &&
+				!(X + RawLength + 1 < Width && BGR24Equal(Source + 3*(X + RawLength), Source + 3*(X + RawLength + 1))))
+			{
+				++RawLength;
+			}
+			
+			*DestByte++ = (u8)(RawLength - 1);
+			for (s32 Index = 0; Index < 3*RawLength; ++Index)
+			{
+				*DestByte++ = Source[3*X + Index];
+			}
+			X += RawLength;
+		}
+	}
+	return DestByte - Dest;
+}
+
+function b32
+DecodeRLE(buffer* Source, u8* Dest, s64 PixelCount)
+{
+	b32 Success = true;
+	s64 PixelIndex = 0;
+	while (Success && PixelIndex < PixelCount)
+	{
+		if (Source->Count >= 1)
+		{
+			u8 PacketHeader = *Consume(Source, u8);
+			s64 Count = (PacketHeader & 0x7F) + 1;
+			b32 IsRun = (PacketHeader & 0x80);
+			s64 SourceSize = IsRun ? 3 : 3*Count;
+			if (Source->Count >= SourceSize && PixelIndex + Count <= PixelCount)
+			{
+				u8* SourceColor = ConsumeSize(Source, SourceSize);
+				for (s64 Index = 0; Index < Count; ++Index)
+				{
+					u8* Pixel = IsRun ? SourceColor : SourceColor + 3*Index;
+					Dest[3*(PixelIndex + Index) + 0] = Pixel[0];
+					Dest[3*(PixelIndex + Index) + 1] = Pixel[1];
+					Dest[3*(PixelIndex + Index) + 2] = Pixel[2];
+				}
+				PixelIndex += Count;
+			}
+			else
+			{
+				Success = false;
+			}
+		}
+		else
+		{
+			Success = false;
+		}
+	}
+	return Success;
+}
+
+// Reads just the image size from a TARGA header, along with the size of the whole file
+function b32
+ReadTGASize(const char* FileName, s32* Width, s32* Height, s64* FileSize)
+{
+	b32 Success = false;
+	FILE* SourceFile = fopen(FileName, "rb");
+	if (SourceFile)
+	{
+		tga_header Header = {};
+		if (fread(&Header, sizeof(tga_header), 1, SourceFile) == 1)
+		{
+			*Width = Header.ImageSpecification.Width;
+			*Height = Header.ImageSpecification.Height;
+			fseek(SourceFile, 0, SEEK_END);
+			*FileSize = ftell(SourceFile);
+			Success = true;
+		}
+		fclose(SourceFile);
+	}
+	return Success;
+}
+
+// Reads a TARGA file into either float colors or packed texels, depending on Packed
+function void*
+LoadTGAPixels(const char* FileName, memory_arena* Arena, b32 Packed, s32* Width, s32* Height)
+{
+	void* Pixels = 0;
 	
 	buffer Buffer = {};
 	FILE* SourceFile = fopen(FileName, "rb");
@@ -102,34 +327,80 @@ LoadTGA(const char* FileName, memory_arena* Arena)
 		b32 Error = false;
 		temporary_memory OriginalMem = BeginTemporaryMemory(Arena);
 		
-		Surface.Pixels = (color*)PushArray(Arena, Buffer.Count - sizeof(tga_header), f32);
-		
-		temporary_memory Temp = BeginTemporaryMemory(Arena);
-		
-		Buffer.Data = PushArray(Arena, Buffer.Count, u8);
-		s64 BytesRead = fread(Buffer.Data, sizeof(u8), Buffer.Count, SourceFile);
-		
-		if (BytesRead == Buffer.Count)
+		tga_header Header = {};
+		if (Buffer.Count >= (s64)sizeof(tga_header) && fread(&Header, sizeof(tga_header), 1, SourceFile) == 1)
 		{
-			tga_header* Header = Consume(&Buffer, tga_header);
-			if (Header->IDLength == 0 &&
-				Header->ColorMapType == TGA_NoColorMap &&
-				Header->ImageType == TGA_UncompressedTrueColor)
+			Buffer.Count -= sizeof(tga_header);
+			if (Header.IDLength == 0 &&
+				Header.ColorMapType == TGA_NoColorMap &&
+				(Header.ImageType == TGA_UncompressedTrueColor || Header.ImageType == TGA_RLETrueColor) &&
+				Header.ImageSpecification.PixelDepth == 24)
 			{
-				Surface.Width = Header->ImageSpecification.Width;
-				Surface.Height = Header->ImageSpecification.Height;
+				*Width = Header.ImageSpecification.Width;
+				*Height = Header.ImageSpecification.Height;
+				s64 PixelCount = (s64)*Width * *Height;
+				s64 DecodeSize = (Header.ImageType == TGA_RLETrueColor) ? 3*PixelCount : 0;
+				s64 PixelsSize = PixelCount*(Packed ? sizeof(u32) : sizeof(color));
 				
-				u8* SourceColor = Buffer.Data;
-				color* DestPixel = Surface.Pixels;
-				for (s32 Y = 0; Y < Surface.Height; ++Y)
+				// An arena sized for the file ahead of time is too small for it if the file grew since
+				if (!HasRoom(Arena, PixelsSize + Buffer.Count + DecodeSize + 2*Arena->Alignment))
+				{
+					Error = true;
+					fprintf(stderr, "Error reading file %s: Not enough memory for a %dx%d image\n", FileName, *Width, *Height);
+				}
+				else
 				{
-					for (s32 X = 0; X < Surface.Width; ++X)
+					Pixels = PushSize(Arena, PixelsSize);
+					
+					temporary_memory Temp = BeginTemporaryMemory(Arena);
+					
+					Buffer.Data = PushArray(Arena, Buffer.Count, u8);
+					s64 BytesRead = fread(Buffer.Data, sizeof(u8), Buffer.Count, SourceFile);
+					
+					if (BytesRead == Buffer.Count)
 					{
-						u8 B = *SourceColor++;
-						u8 G = *SourceColor++;
-						u8 R = *SourceColor++;
-						*DestPixel++ = ColorFromRGB24(R, G, B);
+						u8* SourceColor = Buffer.Data;
+						if (Header.ImageType == TGA_RLETrueColor)
+						{
+							SourceColor = PushArray(Arena, 3*PixelCount, u8);
+							if (!DecodeRLE(&Buffer, SourceColor, PixelCount))
+							{
+								Error = true;
+								fprintf(stderr, "Error reading file %s: Corrupt RLE data\n", FileName);
+							}
+						}
+						else if (Buffer.Count < 3*PixelCount)
+						{
+							Error = true;
+							fprintf(stderr, "Error reading file %s: File is too short for a %dx%d image\n",
+								FileName, *Width, *Height);
+						}
+						
+						if (!Error)
+						{
+							InitColorComponentTable();
+							#pragma omp parallel for
+							for (s32 Y = 0; Y < *Height; ++Y)
+							{
+								s64 RowStart = (s64)Y * *Width;
+								if (Packed)
+								{
+									TexelsFromBGR24(SourceColor + 3*RowStart, *Width, (u32*)Pixels + RowStart);
+								}
+								else
+								{
+									ColorsFromBGR24(SourceColor + 3*RowStart, *Width, (color*)Pixels + RowStart);
+								}
+							}
+						}
 					}
+					else
+					{
+						Error = true;
+						fprintf(stderr, "Error reading file %s. Read %ld bytes\n", FileName, BytesRead);
+					}
+					
+					EndTemporaryMemory(Temp);
 				}
 			}
 			else
@@ -141,31 +412,60 @@ LoadTGA(const char* FileName, memory_arena* Arena)
 		else
 		{
 			Error = true;
-			fprintf(stderr, "Error reading file %s. Read %ld bytes\n", FileName, BytesRead);
+			fprintf(stderr, "Error reading file %s: Missing TARGA header\n", FileName);
 		}
 		
-		EndTemporaryMemory(Temp);
-		
 		if (Error)
 		{
-			Surface.Pixels = 0;
+			Pixels = 0;
 			EndTemporaryMemory(OriginalMem);
 		}
 		else
 		{
 			KeepTemporaryMemory(OriginalMem);
 		}
+		fclose(SourceFile);
 	}
 	else
 	{
 		fprintf(stderr, "Error reading file %s\n", FileName);
 	}
 	
+	return Pixels;
+}
+
+function surface
+LoadTGA(const char* FileName, memory_arena* Arena)
+{
+	surface Surface = {};
+	Surface.Pixels = (color*)LoadTGAPixels(FileName, Arena, false, &Surface.Width, &Surface.Height);
 	return Surface;
 }
 
+function tga_header
+MakeTGAHeader(s32 Width, s32 Height, s32 ImageType)
+{
+	tga_header Header =
+	{
+		.IDLength = 0,
+		.ColorMapType = TGA_NoColorMap,
+		.ImageType = (u8)ImageType,
+		.ColorMapSpecification = {0},
+		.ImageSpecification =
+		{
+			.XOrigin = 0,
+			.YOrigin = 0,
+			.Width = (u16)Width,
+			.Height = (u16)Height,
+			.PixelDepth = 24,
+			.ImageDescriptor = 0x00,
+		},
+	};
+	return Header;
+}
+
 function b32
-WriteTGA(surface* Surface, const char* FileName, memory_arena* Arena)
+WriteTGA(surface* Surface, const char* FileName, memory_arena* Arena, b32 UseRLE = false)
 {
 	b32 Success = true;
 	FILE* DestFile = fopen(FileName, "wb");
@@ -173,43 +473,48 @@ WriteTGA(surface* Surface, const char* FileName, memory_arena* Arena)
 	if (DestFile)
 	{
 		temporary_memory Temp = BeginTemporaryMemory(Arena);
-		tga_header Header =
-		{
-			.IDLength = 0,
-			.ColorMapType = TGA_NoColorMap,
-			.ImageType = TGA_UncompressedTrueColor,
-			.ColorMapSpecification = {0},
-			.ImageSpecification =
-			{
-				.XOrigin = 0,
-				.YOrigin = 0,
-				.Width = (u16)Surface->Width,
-				.Height = (u16)Surface->Height,
-				.PixelDepth = 24,
-				.ImageDescriptor = 0x00,
-			},
-		};
+		tga_header Header = MakeTGAHeader(Surface->Width, Surface->Height, UseRLE ? TGA_RLETrueColor : TGA_UncompressedTrueColor);
 		
-		u64 ImageDataSize = Surface->Width * Surface->Height * 3;
+		s64 RowSize = 3*(s64)Surface->Width;
+		u64 ImageDataSize = RowSize * Surface->Height;
 		u8* ImageDataBuffer = PushArray(Arena, ImageDataSize, u8);
 		
 		if (ImageDataBuffer)
 		{
-			u8* DestColor = ImageDataBuffer;
-			color* Pixel = Surface->Pixels;
+			#pragma omp parallel for
 			for (s32 Y = 0; Y < Surface->Height; ++Y)
 			{
-				for (s32 X = 0; X < Surface->Width; ++X)
+				BGR24FromColors(Surface->Pixels + Y*Surface->Width, Surface->Width, ImageDataBuffer + Y*RowSize);
+			}
+			
+			if (UseRLE)
+			{
+				// Each thread encodes a band of rows into fixed size slots, then the
+				// encoded rows are packed together in order
+				s64 MaxRowSize = MaxRLERowSize(Surface->Width);
+				u8* EncodedData = PushArray(Arena, MaxRowSize * Surface->Height, u8);
+				s64* EncodedRowSizes = PushArray(Arena, Surface->Height, s64);
+				#pragma omp parallel for
+				for (s32 Y = 0; Y < Surface->Height; ++Y)
+				{
+					EncodedRowSizes[Y] = EncodeRLERow(ImageDataBuffer + Y*RowSize, Surface->Width, EncodedData + Y*MaxRowSize);
+				}
+				
+				ImageDataSize = 0;
+				for (s32 Y = 0; Y < Surface->Height; ++Y)
 				{
-					*DestColor++ = U8FromColorComponent(Pixel->B);
-					*DestColor++ = U8FromColorComponent(Pixel->G);
-					*DestColor++ = U8FromColorComponent(Pixel->R);
-					++Pixel;
+					u8* EncodedRow = EncodedData + Y*MaxRowSize;
+					for (s64 Index = 0; Index < EncodedRowSizes[Y]; ++Index)
+					{
+						EncodedData[ImageDataSize + Index] = EncodedRow[Index];
+					}
+					ImageDataSize += EncodedRowSizes[Y];
 				}
+				ImageDataBuffer = EncodedData;
 			}
 			
 			Success = (fwrite(&Header, sizeof(tga_header), 1, DestFile) == 1);
-			if (Success)
+			if (Success && ImageDataSize > 0)
 			{
 				Success = (fwrite(ImageDataBuffer, ImageDataSize, 1, DestFile) == 1);
 			}
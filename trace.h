@@ -0,0 +1,185 @@
+/*
+ * trace.h
+ *
+ * Per-thread timeline events, written out as a Chrome trace that Perfetto or chrome://tracing can open
+ */
+
+// Each thread claims a buffer of its own the first time it records an event, so recording is a plain
+// store that no other thread contends with. The buffers are rings that keep the most recent events.
+// Until BeginTrace is called there is no trace, and every recording call is a single branch.
+
+#define TRACE_EVENTS_PER_THREAD (64*1024)
+#define TRACE_EXTRA_THREADS 8 // Tracks for threads outside the OpenMP pool, like the main thread and the row writer
+
+typedef struct trace_event
+{
+	const char* Name;
+	f64 Start;
+	f64 End;
+	s64 Arg;
+} trace_event;
+
+typedef struct trace_thread
+{
+	s64 EventCount; // Every event ever recorded, so the ring has wrapped once this passes its capacity
+	trace_event* Events;
+	const char* Name;
+	u8 Padding[CACHE_LINE_SIZE - sizeof(s64) - sizeof(trace_event*) - sizeof(const char*)];
+} trace_thread;
+
+typedef struct trace
+{
+	f64 StartTime;
+	s32 MaxThreadCount;
+	s32 ThreadCount;
+	trace_thread* Threads;
+	memory_arena Arena;
+} trace;
+
+global trace* GlobalTrace;
+global __thread s32 TraceThreadSlot = -1;
+
+// Reserves the buffers up front. Pages are only touched as events are recorded, so threads that
+// never record anything cost address space and nothing else.
+function void
+BeginTrace(s32 MaxThreadCount)
+{
+	s64 BufferSize = (s64)MaxThreadCount*TRACE_EVENTS_PER_THREAD*sizeof(trace_event);
+	memory_arena Arena = MakeArena(BufferSize + MaxThreadCount*sizeof(trace_thread) + sizeof(trace) + 4096, CACHE_LINE_SIZE);
+	trace* Trace = PushStruct(&Arena, trace);
+	*Trace = {};
+	Trace->StartTime = omp_get_wtime();
+	Trace->MaxThreadCount = MaxThreadCount;
+	Trace->Threads = PushArray(&Arena, MaxThreadCount, trace_thread);
+	for (s32 Index = 0; Index < MaxThreadCount; ++Index)
+	{
+		Trace->Threads[Index] = {};
+		Trace->Threads[Index].Events = PushArray(&Arena, TRACE_EVENTS_PER_THREAD, trace_event);
+	}
+	Trace->Arena = Arena;
+	GlobalTrace = Trace;
+}
+
+function trace_thread*
+GetTraceThread()
+{
+	trace_thread* Result = 0;
+	trace* Trace = GlobalTrace;
+	if (Trace)
+	{
+		if (TraceThreadSlot < 0)
+		{
+			TraceThreadSlot = __atomic_fetch_add(&Trace->ThreadCount, 1, __ATOMIC_RELAXED);
+		}
+		if (TraceThreadSlot < Trace->MaxThreadCount)
+		{
+			Result = Trace->Threads + TraceThreadSlot;
+		}
+	}
+	return Result;
+}
+
+// Start time to hand to TraceEvent later, or nothing when no trace is being recorded
+function f64
+TraceStart()
+{
+	f64 Result = GlobalTrace ? omp_get_wtime() : 0;
+	return Result;
+}
+
+// Records a span from StartTime until now on the calling thread's timeline
+function void
+TraceEvent(const char* Name, f64 StartTime, s64 Arg = -1)
+{
+	if (GlobalTrace)
+	{
+		trace_thread* Thread = GetTraceThread();
+		if (Thread)
+		{
+			trace_event* Event = Thread->Events + (Thread->EventCount % TRACE_EVENTS_PER_THREAD);
+			Event->Name = Name;
+			Event->Start = StartTime;
+			Event->End = omp_get_wtime();
+			Event->Arg = Arg;
+			++Thread->EventCount;
+		}
+	}
+}
+
+// Names the calling thread's track in the trace, otherwise it is shown as its slot number. Helper
+// threads like the row writer are started again for every render, so a thread without a slot takes
+// over the track of an earlier thread with the same name rather than using up a new one.
+function void
+TraceThreadName(const char* Name)
+{
+	trace* Trace = GlobalTrace;
+	if (Trace)
+	{
+		if (TraceThreadSlot < 0)
+		{
+			s32 ThreadCount = __atomic_load_n(&Trace->ThreadCount, __ATOMIC_RELAXED);
+			for (s32 Index = 0; Index < ThreadCount && Index < Trace->MaxThreadCount; ++Index)
+			{
+				const char* SlotName = __atomic_load_n(&Trace->Threads[Index].Name, __ATOMIC_RELAXED);
+				if (SlotName && strcmp(SlotName, Name) == 0)
+				{
+					TraceThreadSlot = Index;
+					break;
+				}
+			}
+		}
+		
+		trace_thread* Thread = GetTraceThread();
+		if (Thread)
+		{
+			__atomic_store_n(&Thread->Name, Name, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+// Meant to be called once the traced threads are idle, since their buffers are read without locking
+function b32
+WriteTrace(const char* FileName)
+{
+	b32 Success = (GlobalTrace != 0);
+	FILE* File = Success ? fopen(FileName, "w") : 0;
+	Success = (File != 0);
+	if (Success)
+	{
+		trace* Trace = GlobalTrace;
+		s32 ThreadCount = Trace->ThreadCount < Trace->MaxThreadCount ? Trace->ThreadCount : Trace->MaxThreadCount;
+		fprintf(File, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+		fprintf(File, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"ray\"}}");
+		for (s32 ThreadIndex = 0; ThreadIndex < ThreadCount; ++ThreadIndex)
+		{
+			trace_thread* Thread = Trace->Threads + ThreadIndex;
+			if (Thread->Name)
+			{
+				fprintf(File, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+					ThreadIndex, Thread->Name);
+			}
+			
+			// Oldest first, starting after the last overwritten event if the ring has wrapped
+			s64 First = Thread->EventCount > TRACE_EVENTS_PER_THREAD ? Thread->EventCount - TRACE_EVENTS_PER_THREAD : 0;
+			for (s64 Index = First; Index < Thread->EventCount; ++Index)
+			{
+				trace_event* Event = Thread->Events + (Index % TRACE_EVENTS_PER_THREAD);
+				fprintf(File, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+					Event->Name, ThreadIndex, (Event->Start - Trace->StartTime)*1e6, (Event->End - Event->Start)*1e6);
+				if (Event->Arg >= 0)
+				{
+					fprintf(File, ", \"args\": {\"value\": %ld}", Event->Arg);
+				}
+				fprintf(File, "}");
+			}
+		}
+		fprintf(File, "\n]}\n");
+		Success = (fclose(File) == 0);
+	}
+	
+	if (!Success)
+	{
+		fprintf(stderr, "Error writing trace to file: '%s'\n", FileName);
+	}
+	return Success;
+}
\ No newline at end of file
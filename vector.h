@@ -42,6 +42,12 @@ typedef union v3
 	f32 E[3];
 } v3, color;
 
+typedef struct rect3
+{
+	v3 Min;
+	v3 Max;
+} rect3;
+
 // Scalar
 
 function f32